@@ -16,6 +16,35 @@ $(SONG_BUILDDIR)/%.o: $(SONG_SUBDIR)/%.s
 $(MID_BUILDDIR)/%.o: $(MID_ASM_DIR)/%.s
 	$(AS) $(ASFLAGS) -I sound -o $@ $<
 
+AIF_CRY_STAMP := $(BUILD_DIR)/aif2pcm_cries.stamp
+AIF_SOUND_STAMP := $(BUILD_DIR)/aif2pcm_sound.stamp
+
+ifeq ($(AIF_BATCH),1)
+
+# Un `aif2pcm --dir` por directorio convierte todos sus .aif en paralelo. Las
+# reglas reales son las de los stamps; aif2pcm no reescribe los .bin que no
+# cambian. Solo cubre los directorios de AIF_SOUND_DIRS y el de los cries.
+AIF_SOUND_DIRS := $(SOUND_BIN_DIR)/direct_sound_samples $(SOUND_BIN_DIR)/direct_sound_samples/phonemes
+
+$(AIF_CRY_STAMP): $(wildcard $(CRY_SUBDIR)/*.aif)
+	@mkdir -p $(@D)
+	$(AIF) --dir $(CRY_SUBDIR) --compress
+	@touch $@
+
+$(AIF_SOUND_STAMP): $(foreach dir,$(AIF_SOUND_DIRS),$(wildcard $(dir)/*.aif))
+	@mkdir -p $(@D)
+	$(foreach dir,$(AIF_SOUND_DIRS),$(AIF) --dir $(dir) && ) true
+	@touch $@
+
+$(call stamp_outputs,$(AIF_CRY_STAMP),$(patsubst $(CRY_SUBDIR)/%.aif,$(CRY_BIN_DIR)/%.bin,$(wildcard $(CRY_SUBDIR)/*.aif)))
+$(call stamp_outputs,$(AIF_SOUND_STAMP),$(patsubst sound/%.aif,$(SOUND_BIN_DIR)/%.bin,$(foreach dir,$(AIF_SOUND_DIRS),$(wildcard $(dir)/*.aif))))
+
+$(CRY_BIN_DIR)/%.bin: $(CRY_SUBDIR)/%.aif $(AIF_CRY_STAMP) ;
+
+$(SOUND_BIN_DIR)/%.bin: sound/%.aif $(AIF_SOUND_STAMP) ;
+
+else
+
 # Compressed cries
 $(CRY_BIN_DIR)/%.bin: $(CRY_SUBDIR)/%.aif 
 	$(AIF) $< $@ --compress
@@ -24,15 +53,35 @@ $(CRY_BIN_DIR)/%.bin: $(CRY_SUBDIR)/%.aif
 $(SOUND_BIN_DIR)/%.bin: sound/%.aif 
 	$(AIF) $< $@
 
+endif
+
 # For each line in midi.cfg, we do some trickery to convert it into a make rule for the `.mid` file described on the line
 # Data following the colon in said file corresponds to arguments passed into mid2agb
 MID_CFG_PATH := $(MID_SUBDIR)/midi.cfg
+MID_BATCH_STAMP := $(BUILD_DIR)/mid2agb.stamp
+
+ifeq ($(MID_BATCH),1)
+
+# Un solo `mid2agb --batch` convierte todas las canciones de midi.cfg en
+# paralelo. La regla real es la del stamp; mid2agb no reescribe los .s que no
+# cambian, así que solo se reensamblan las canciones que de verdad cambiaron.
+
+# $1: Source path no extension, $2 Options (los lee mid2agb de midi.cfg)
+define MID_RULE
+MID_BATCH_SRCS += $(MID_SUBDIR)/$1.mid
+MID_BATCH_OUTPUTS += $(MID_ASM_DIR)/$1.s
+$(MID_ASM_DIR)/$1.s: $(MID_BATCH_STAMP) ;
+endef
+
+else
 
 # $1: Source path no extension, $2 Options
 define MID_RULE
 $(MID_ASM_DIR)/$1.s: $(MID_SUBDIR)/$1.mid $(MID_CFG_PATH)
 	$(MID) $$< $$@ $2
 endef
+
+endif
 #                            source path,                             remaining text (options)
 define MID_EXPANSION
 	$(eval $(call MID_RULE,$(basename $(patsubst %:,%,$(word 1,$1))),$(wordlist 2,999,$1)))
@@ -40,6 +89,14 @@ endef
 
 $(foreach line,$(shell cat $(MID_CFG_PATH) | sed "s/ /__SPACE__/g"),$(call MID_EXPANSION,$(subst __SPACE__, ,$(line))))
 
+ifeq ($(MID_BATCH),1)
+$(call stamp_outputs,$(MID_BATCH_STAMP),$(MID_BATCH_OUTPUTS))
+$(MID_BATCH_STAMP): $(MID_BATCH_SRCS) $(MID_CFG_PATH)
+	@mkdir -p $(@D)
+	$(MID) --batch $(MID_CFG_PATH)
+	@touch $@
+endif
+
 # Warn users building without a .cfg - build will fail at link time
 $(MID_ASM_DIR)/%.s: $(MID_SUBDIR)/%.mid
 	$(warning $< does not have an associated entry in midi.cfg! It cannot be built)
@@ -16,7 +16,10 @@ genera dos artefactos:
 
   2. src/sima_rooms_data.h -- las tablas de C (tile grafico compuesto, solido,
      spawn, escalera, enemigos) que src/sima_rooms.c consume. GENERADO, no
-     editar a mano: se pisa entero en cada ejecucion.
+     editar a mano: se regenera entero en cada ejecucion.
+
+Las salidas solo se escriben si sus bytes cambian: si un cambio en el JSON no
+afecta a un archivo, su mtime queda igual y make no recompila lo que lo usa.
 
 Ademas re-escribe el numero de SIMA_FLOOR_COUNT en include/sima_rooms.h para
 que coincida con el numero de pisos CON CONTENIDO del JSON (spawn != null).
@@ -36,6 +39,7 @@ Requiere que graphics/sima/gen.py se haya corrido antes al menos una vez
 (grounds.png, walls.png, props.png deben existir ya re-indexados con la
 paleta fija de SIMA: indice 0 = TRANSPARENT = (255,0,0), 1..4 = tonos).
 """
+import io
 import json
 import os
 import re
@@ -190,14 +194,36 @@ def build_rooms(data, sheets):
     return floors, tile_images, n_tiles
 
 
+def write_if_changed(path, data):
+    """Escribe data (bytes) en path salvo que el archivo ya tenga exactamente
+    esos bytes; en ese caso no lo toca, para no cambiar su mtime. Devuelve
+    True si escribio."""
+    try:
+        with open(path, "rb") as f:
+            if f.read() == data:
+                return False
+    except FileNotFoundError:
+        pass
+    with open(path, "wb") as f:
+        f.write(data)
+    return True
+
+
+def _changed_note(changed):
+    return "" if changed else ", sin cambios"
+
+
 def write_atlas(tile_images):
     atlas = Image.new("P", (CELL_PX * len(tile_images), CELL_PX), 0)
     atlas.putpalette(_PALETTE)
     for i, img in enumerate(tile_images):
         atlas.paste(img, (i * CELL_PX, 0))
     path = os.path.join(OUT, "tiles.png")
-    atlas.save(path)
-    print(f"tiles.png  ({atlas.width}x{atlas.height}, {len(tile_images)} celdas compuestas)")
+    png = io.BytesIO()
+    atlas.save(png, format="PNG")
+    changed = write_if_changed(path, png.getvalue())
+    print(f"tiles.png  ({atlas.width}x{atlas.height}, {len(tile_images)} celdas compuestas"
+          f"{_changed_note(changed)})")
 
 
 def _c_grid(values, per_row=ROOM_W, fmt="{}"):
@@ -290,10 +316,9 @@ def write_header(floors, n_tiles):
     lines.append("#endif // GUARD_SIMA_ROOMS_DATA_H")
     lines.append("")
 
-    with open(DATA_HEADER, "w", encoding="utf-8") as f:
-        f.write("\n".join(lines))
+    changed = write_if_changed(DATA_HEADER, "\n".join(lines).encode("utf-8"))
     print(f"{DATA_HEADER}  ({floor_count} piso(s) con contenido, {n_tiles} tiles, "
-          f"{max_enemies} enemigo(s) maximo)")
+          f"{max_enemies} enemigo(s) maximo{_changed_note(changed)})")
 
 
 def patch_floor_count(floor_count):
@@ -311,8 +336,7 @@ def patch_floor_count(floor_count):
 
     new_text = pattern.sub(f"#define SIMA_FLOOR_COUNT {floor_count}", text, count=1)
     if new_text != text:
-        with open(PUBLIC_HEADER, "w", encoding="utf-8") as f:
-            f.write(new_text)
+        write_if_changed(PUBLIC_HEADER, new_text.encode("utf-8"))
         print(f"{PUBLIC_HEADER}  (SIMA_FLOOR_COUNT -> {floor_count})")
     else:
         print(f"{PUBLIC_HEADER}  (SIMA_FLOOR_COUNT ya era {floor_count}, sin cambios)")
@@ -0,0 +1,40 @@
+#ifndef GUARD_CYCLE_COUNTER_H
+#define GUARD_CYCLE_COUNTER_H
+
+// Contador de ciclos de CPU para medir en builds de debug/test: TM2 cuenta a
+// 16.78 MHz y TM3 va en cascada (TIMER_COUNTUP) con su desborde, asi que el
+// par es un contador libre de 32 bits. No se resetea al medir: cada medida
+// es la diferencia entre dos lecturas, y por eso las medidas se pueden
+// anidar (un task dentro de RunTasks dentro de un frame).
+//
+// TM3 es tambien el timer del link por cable (src/link.c); no usar esto en
+// builds de release ni con el link activo.
+
+static inline void CycleCounter_Start(void)
+{
+    if ((REG_TM2CNT_H & TIMER_ENABLE) && (REG_TM3CNT_H & TIMER_ENABLE))
+        return;
+
+    REG_TM2CNT_H = 0;
+    REG_TM3CNT_H = 0;
+    REG_TM2CNT_L = 0;
+    REG_TM3CNT_L = 0;
+    REG_TM3CNT_H = TIMER_ENABLE | TIMER_COUNTUP;
+    REG_TM2CNT_H = TIMER_ENABLE | TIMER_1CLK;
+}
+
+static inline u32 CycleCounter_Read(void)
+{
+    u16 hi, lo;
+
+    // Si TM2 desborda entre las dos lecturas, TM3 cambia: se relee.
+    do
+    {
+        hi = REG_TM3CNT_L;
+        lo = REG_TM2CNT_L;
+    } while (hi != REG_TM3CNT_L);
+
+    return ((u32)hi << 16) | lo;
+}
+
+#endif // GUARD_CYCLE_COUNTER_H
@@ -0,0 +1,61 @@
+#ifndef GUARD_FRAME_PROFILER_H
+#define GUARD_FRAME_PROFILER_H
+
+// Profiler de frame (build con FRAME_PROFILER=1, activado por defecto en
+// PHANTOM_TEST): cada zona suma los ciclos de CPU de cada llamada, medidos
+// con el contador libre de include/cycle_counter.h, y cada
+// PROFILER_WINDOW_FRAMES frames se vuelcan min/avg/max a gFrameProfile.
+// Las zonas del hilo principal incluyen el tiempo de las interrupciones que
+// caigan en medio (VBlank/HBlank), igual que el presupuesto real del frame.
+enum ProfilerZone
+{
+    PROFILER_ZONE_CALLBACKS,      // CB1 + CB2 (CallCallbacks)
+    PROFILER_ZONE_RUN_TASKS,
+    PROFILER_ZONE_ANIMATE_SPRITES,
+    PROFILER_ZONE_BUILD_OAM,
+    PROFILER_ZONE_TEXT_PRINTERS,
+    PROFILER_ZONE_PALETTE_FADE,
+    PROFILER_ZONE_VBLANK_CB,
+    PROFILER_ZONE_DMA3_REQUESTS,
+    PROFILER_ZONE_HBLANK_CB,
+    PROFILER_ZONE_COUNT,
+};
+
+#define PROFILER_WINDOW_FRAMES 60
+
+// Un frame de la GBA: 228 líneas de 1232 ciclos.
+#define PROFILER_FRAME_CYCLES 280896
+
+// Última ventana cerrada, en ciclos por llamada. samples es el número de
+// llamadas de la ventana (0 = la zona no corrió). Global (no static) para
+// que tools/phantom-debug lo encuentre por símbolo en el .map.
+struct ProfilerZoneStats
+{
+    u32 min;
+    u32 avg;
+    u32 max;
+    u32 samples;
+};
+
+#ifdef FRAME_PROFILER
+
+extern struct ProfilerZoneStats gFrameProfile[PROFILER_ZONE_COUNT];
+
+void FrameProfiler_Init(void);
+void FrameProfiler_Begin(u8 zone);
+void FrameProfiler_End(u8 zone);
+void FrameProfiler_EndFrame(void);
+void FrameProfiler_Latch(void);
+void FrameProfiler_VBlank(void);
+
+#define PROFILER_BEGIN(zone) FrameProfiler_Begin(zone)
+#define PROFILER_END(zone) FrameProfiler_End(zone)
+
+#else
+
+#define PROFILER_BEGIN(zone)
+#define PROFILER_END(zone)
+
+#endif // FRAME_PROFILER
+
+#endif // GUARD_FRAME_PROFILER_H
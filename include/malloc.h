@@ -18,4 +18,27 @@ void *AllocZeroed(u32 size);
 void Free(void *pointer);
 void InitHeap(void *heapStart, u32 heapSize);
 
+bool32 ScreenArena_Open(u32 size, void (*owner)(void));
+void *ScreenArena_Alloc(u32 size);
+void *ScreenArena_AllocZeroed(u32 size);
+void ScreenArena_Release(void);
+void ScreenArena_OnMainCallbackSwitch(void (*from)(void), void (*to)(void));
+
+#ifndef NDEBUG
+struct HeapStats
+{
+    u32 size;
+    u32 used;         // Bytes in allocated blocks, headers included.
+    u32 peak;         // Highest value of used since InitHeap.
+    u32 totalFree;
+    u32 largestFree;
+    u32 freeBlocks;
+    u32 fragmentation; // Per mille: 1000 - 1000 * largestFree / totalFree.
+    u32 failedAllocs;
+};
+
+void GetHeapStats(struct HeapStats *stats);
+void DebugPrintHeapStats(void);
+#endif
+
 #endif // GUARD_ALLOC_H
@@ -35,4 +35,20 @@ u8 GetTaskCount(void);
 void SetWordTaskArg(u8 taskId, u8 dataElem, u32 value);
 u32 GetWordTaskArg(u8 taskId, u8 dataElem);
 
+#ifndef NDEBUG
+// Per-task cycle cost, measured around each call made by RunTasks. Reset
+// when a task is created in that slot.
+struct TaskCycleStats
+{
+    TaskFunc maxFunc; // The task's function when max was measured.
+    u32 last;
+    u32 max;
+    u32 total;
+    u32 runs;
+};
+
+const struct TaskCycleStats *GetTaskCycleStats(u8 taskId);
+void DebugPrintTaskCycles(void);
+#endif
+
 #endif // GUARD_TASK_H
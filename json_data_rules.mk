@@ -1,28 +1,53 @@
 # JSON files are run through jsonproc, which is a tool that converts JSON data to an output file
 # based on an Inja template. https://github.com/pantor/inja
 
-AUTO_GEN_TARGETS += $(DATA_SRC_SUBDIR)/wild_encounters.h
-$(DATA_SRC_SUBDIR)/wild_encounters.h: $(DATA_SRC_SUBDIR)/wild_encounters.json $(DATA_SRC_SUBDIR)/wild_encounters.json.txt
-	$(JSONPROC) $^ $@
+# $(call jsonproc_output,OUTPUT,JSON,TEMPLATE): declara una salida de jsonproc.
+# La receta depende del modo (ver JSONPROC_MANIFEST abajo).
+define jsonproc_output
+AUTO_GEN_TARGETS += $1
+JSONPROC_OUTPUTS += $1
+JSONPROC_JOBS += $2 $3 $1
+$1: $2 $3
+endef
+
+$(eval $(call jsonproc_output,$(DATA_SRC_SUBDIR)/wild_encounters.h,$(DATA_SRC_SUBDIR)/wild_encounters.json,$(DATA_SRC_SUBDIR)/wild_encounters.json.txt))
 
 $(C_BUILDDIR)/wild_encounter.o: c_dep += $(DATA_SRC_SUBDIR)/wild_encounters.h
 
-AUTO_GEN_TARGETS += $(DATA_SRC_SUBDIR)/region_map/region_map_entries.h
-$(DATA_SRC_SUBDIR)/region_map/region_map_entries.h: $(DATA_SRC_SUBDIR)/region_map/region_map_sections.json $(DATA_SRC_SUBDIR)/region_map/region_map_sections.json.txt
-	$(JSONPROC) $^ $@
+$(eval $(call jsonproc_output,$(DATA_SRC_SUBDIR)/region_map/region_map_entries.h,$(DATA_SRC_SUBDIR)/region_map/region_map_sections.json,$(DATA_SRC_SUBDIR)/region_map/region_map_sections.json.txt))
 
 $(C_BUILDDIR)/region_map.o: c_dep += $(DATA_SRC_SUBDIR)/region_map/region_map_entries.h
 
-AUTO_GEN_TARGETS += include/constants/region_map_sections.h
-include/constants/region_map_sections.h: $(DATA_SRC_SUBDIR)/region_map/region_map_sections.json $(DATA_SRC_SUBDIR)/region_map/region_map_sections.constants.json.txt
-	$(JSONPROC) $^ $@
+$(eval $(call jsonproc_output,include/constants/region_map_sections.h,$(DATA_SRC_SUBDIR)/region_map/region_map_sections.json,$(DATA_SRC_SUBDIR)/region_map/region_map_sections.constants.json.txt))
 
-AUTO_GEN_TARGETS += $(DATA_SRC_SUBDIR)/heal_locations.h
-$(DATA_SRC_SUBDIR)/heal_locations.h: $(DATA_SRC_SUBDIR)/heal_locations.json $(DATA_SRC_SUBDIR)/heal_locations.json.txt
-	$(JSONPROC) $^ $@
+$(eval $(call jsonproc_output,$(DATA_SRC_SUBDIR)/heal_locations.h,$(DATA_SRC_SUBDIR)/heal_locations.json,$(DATA_SRC_SUBDIR)/heal_locations.json.txt))
 
 $(C_BUILDDIR)/heal_location.o: c_dep += $(DATA_SRC_SUBDIR)/heal_locations.h
 
-AUTO_GEN_TARGETS += include/constants/heal_locations.h
-include/constants/heal_locations.h: $(DATA_SRC_SUBDIR)/heal_locations.json $(DATA_SRC_SUBDIR)/heal_locations.constants.json.txt
+$(eval $(call jsonproc_output,include/constants/heal_locations.h,$(DATA_SRC_SUBDIR)/heal_locations.json,$(DATA_SRC_SUBDIR)/heal_locations.constants.json.txt))
+
+JSONPROC_STAMP := $(BUILD_DIR)/jsonproc.stamp
+
+ifeq ($(JSONPROC_MANIFEST),1)
+
+# Un solo `jsonproc -m` renderiza todas las salidas: cada JSON y template se
+# parsea una vez, las salidas se renderizan en paralelo y se loguea el tiempo
+# de cada una. Igual que con MAPJSON_ALL, la regla real es la del stamp y
+# jsonproc no reescribe las salidas que no cambian.
+JSONPROC_MANIFEST_FILE := $(BUILD_DIR)/jsonproc_manifest.txt
+
+$(JSONPROC_STAMP): $(filter-out $(JSONPROC_OUTPUTS),$(JSONPROC_JOBS))
+	@mkdir -p $(@D)
+	@printf '%s %s %s\n' $(JSONPROC_JOBS) > $(JSONPROC_MANIFEST_FILE)
+	$(JSONPROC) -m $(JSONPROC_MANIFEST_FILE)
+	@touch $@
+
+$(call stamp_outputs,$(JSONPROC_STAMP),$(JSONPROC_OUTPUTS))
+$(JSONPROC_OUTPUTS): $(JSONPROC_STAMP) ;
+
+else
+
+$(JSONPROC_OUTPUTS):
 	$(JSONPROC) $^ $@
+
+endif
@@ -18,6 +18,7 @@ MAP_CONNECTIONS := $(patsubst $(MAPS_DIR)/%/,$(MAPS_DIR)/%/connections.inc,$(MAP
 MAP_EVENTS := $(patsubst $(MAPS_DIR)/%/,$(MAPS_DIR)/%/events.inc,$(MAP_DIRS))
 MAP_HEADERS := $(patsubst $(MAPS_DIR)/%/,$(MAPS_DIR)/%/header.inc,$(MAP_DIRS))
 MAP_JSONS := $(patsubst $(MAPS_DIR)/%/,$(MAPS_DIR)/%/map.json,$(MAP_DIRS))
+MAPJSON_ALL_STAMP := $(BUILD_DIR)/mapjson_all.stamp
 
 $(DATA_ASM_BUILDDIR)/maps.o: $(DATA_ASM_SUBDIR)/maps.s $(LAYOUTS_DIR)/layouts.inc $(LAYOUTS_DIR)/layouts_table.inc $(MAPS_DIR)/headers.inc $(MAPS_DIR)/groups.inc $(MAPS_DIR)/connections.inc $(MAP_CONNECTIONS) $(MAP_HEADERS)
 	$(PREPROC) $< charmap.txt | $(CPP) -I include - | $(PREPROC) -ie $< charmap.txt | $(AS) $(ASFLAGS) -o $@
@@ -25,6 +26,28 @@ $(DATA_ASM_BUILDDIR)/map_events.o: $(DATA_ASM_SUBDIR)/map_events.s $(MAPS_DIR)/e
 	$(PREPROC) $< charmap.txt | $(CPP) -I include - | $(PREPROC) -ie $< charmap.txt | $(AS) $(ASFLAGS) -o $@
 
 
+ifeq ($(MAPJSON_ALL),1)
+
+# Un solo `mapjson all` genera todos los archivos de abajo. Solo reescribe los
+# que cambian, así que la regla real es la del stamp y cada salida cuelga de él
+# con una receta vacía: make vuelve a mirar su mtime y no recompila lo que la
+# incluye si el texto es el mismo.
+$(MAPJSON_ALL_STAMP): $(MAP_JSONS) $(MAPS_DIR)/map_groups.json $(LAYOUTS_DIR)/layouts.json
+	@mkdir -p $(@D)
+	@$(MAPJSON) all emerald $(MAPS_DIR)/map_groups.json $(LAYOUTS_DIR)/layouts.json $(MAPS_OUTDIR) $(LAYOUTS_OUTDIR) $(INCLUDECONSTS_OUTDIR) $(MAP_JSONS)
+	@echo "$(MAPJSON) all emerald $(MAPS_DIR)/map_groups.json $(LAYOUTS_DIR)/layouts.json $(MAPS_OUTDIR) $(LAYOUTS_OUTDIR) $(INCLUDECONSTS_OUTDIR) <MAP_JSONS>"
+	@touch $@
+
+MAPJSON_ALL_OUTPUTS := $(MAP_CONNECTIONS) $(MAP_EVENTS) $(MAP_HEADERS) \
+	$(MAPS_OUTDIR)/connections.inc $(MAPS_OUTDIR)/groups.inc $(MAPS_OUTDIR)/events.inc $(MAPS_OUTDIR)/headers.inc $(INCLUDECONSTS_OUTDIR)/map_groups.h \
+	$(LAYOUTS_OUTDIR)/layouts.inc $(LAYOUTS_OUTDIR)/layouts_table.inc $(INCLUDECONSTS_OUTDIR)/layouts.h \
+	$(INCLUDECONSTS_OUTDIR)/map_event_ids.h
+$(call stamp_outputs,$(MAPJSON_ALL_STAMP),$(MAPJSON_ALL_OUTPUTS))
+
+$(MAPJSON_ALL_OUTPUTS): $(MAPJSON_ALL_STAMP) ;
+
+else
+
 $(MAPS_OUTDIR)/%/header.inc $(MAPS_OUTDIR)/%/events.inc $(MAPS_OUTDIR)/%/connections.inc: $(MAPS_DIR)/%/map.json
 	$(MAPJSON) map emerald $< $(LAYOUTS_DIR)/layouts.json $(@D)
 
@@ -39,3 +62,5 @@ $(LAYOUTS_OUTDIR)/layouts.inc $(LAYOUTS_OUTDIR)/layouts_table.inc $(INCLUDECONST
 $(INCLUDECONSTS_OUTDIR)/map_event_ids.h: $(MAP_JSONS)
 	@$(MAPJSON) event_constants emerald $^ $(INCLUDECONSTS_OUTDIR)/map_event_ids.h
 	@echo "$(MAPJSON) event_constants emerald <MAP_JSONS> $(INCLUDECONSTS_OUTDIR)/map_event_ids.h"
+
+endif
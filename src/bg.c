@@ -38,15 +38,30 @@ struct BgConfig2
     s32 bg_y;
 };
 
+// The part of a BG's tilemap buffer written since it was last copied to
+// VRAM: a bitmask of dirty rows of the first 32x32 screen block, and the
+// column span covering every write. Writes the span can't describe (affine
+// BGs, larger text screens) mark the whole tilemap instead.
+struct BgDirtyTilemap
+{
+    u32 rows;
+    u8 left;
+    u8 right;
+    bool8 whole;
+};
+
 static struct BgControl sGpuBgConfigs;
 static struct BgConfig2 sGpuBgConfigs2[NUM_BACKGROUNDS];
 static u32 sDmaBusyBitfield[NUM_BACKGROUNDS];
+static struct BgDirtyTilemap sDirtyTilemaps[NUM_BACKGROUNDS];
 
 COMMON_DATA u32 gWindowTileAutoAllocEnabled = 0;
 
 static const struct BgConfig sZeroedBgControlStruct = { 0 };
 
 static u32 GetBgType(u8 bg);
+static void MarkBgTilemapDirty(u8 bg, u8 x, u8 y, u8 width, u8 height);
+static void ClearBgTilemapDirty(u8 bg);
 
 void ResetBgs(void)
 {
@@ -73,6 +88,7 @@ void ResetBgControlStructs(void)
     for (i = 0; i < NUM_BACKGROUNDS; i++)
     {
         sGpuBgConfigs.configs[i] = sZeroedBgControlStruct;
+        ClearBgTilemapDirty(i);
     }
 }
 
@@ -850,6 +866,7 @@ void SetBgTilemapBuffer(u8 bg, void *tilemap)
     if (!IsInvalidBg32(bg) && GetBgControlAttribute(bg, BG_CTRL_ATTR_VISIBLE))
     {
         sGpuBgConfigs2[bg].tilemap = tilemap;
+        ClearBgTilemapDirty(bg);
     }
 }
 
@@ -858,6 +875,7 @@ void UnsetBgTilemapBuffer(u8 bg)
     if (!IsInvalidBg32(bg) && GetBgControlAttribute(bg, BG_CTRL_ATTR_VISIBLE))
     {
         sGpuBgConfigs2[bg].tilemap = NULL;
+        ClearBgTilemapDirty(bg);
     }
 }
 
@@ -879,6 +897,7 @@ void CopyToBgTilemapBuffer(u8 bg, const void *src, u16 mode, u16 destOffset)
             CpuCopy16(src, (void *)(sGpuBgConfigs2[bg].tilemap + (destOffset * 2)), mode);
         else
             LZ77UnCompWram(src, (void *)(sGpuBgConfigs2[bg].tilemap + (destOffset * 2)));
+        sDirtyTilemaps[bg].whole = TRUE;
     }
 }
 
@@ -901,6 +920,54 @@ void CopyBgTilemapBufferToVram(u8 bg)
             break;
         }
         LoadBgVram(bg, sGpuBgConfigs2[bg].tilemap, sizeToLoad, 0, 2);
+        ClearBgTilemapDirty(bg);
+    }
+}
+
+// Like CopyBgTilemapBufferToVram, but only queues the rows written through
+// the tilemap buffer functions since the last copy, each trimmed to the dirty
+// column span. Full-width rows next to each other go out as one request.
+// Writes made directly through GetBgTilemapBuffer are not tracked.
+void CopyDirtyBgTilemapBufferToVram(u8 bg)
+{
+    struct BgDirtyTilemap *dirty;
+    u16 *tilemap;
+    u8 row, lastRow;
+    u16 rowBytes;
+
+    if (IsInvalidBg32(bg) || IsTileMapOutsideWram(bg))
+        return;
+
+    dirty = &sDirtyTilemaps[bg];
+    if (dirty->whole || GetBgType(bg) != BG_TYPE_NORMAL)
+    {
+        if (dirty->whole || dirty->rows != 0)
+            CopyBgTilemapBufferToVram(bg);
+        return;
+    }
+
+    tilemap = sGpuBgConfigs2[bg].tilemap;
+    rowBytes = (dirty->right - dirty->left + 1) * 2;
+
+    for (row = 0; dirty->rows != 0; row++)
+    {
+        if (!(dirty->rows & (1u << row)))
+            continue;
+
+        lastRow = row;
+        if (rowBytes == 32 * 2)
+        {
+            while (lastRow < 31 && (dirty->rows & (1u << (lastRow + 1))))
+                lastRow++;
+        }
+
+        if (LoadBgVram(bg, &tilemap[row * 32 + dirty->left], rowBytes * (lastRow - row + 1),
+                       (row * 32 + dirty->left) * 2, 2) == 0xFF)
+            return; // The DMA3 queue is full: the rest stays dirty for the next flush.
+
+        for (; row < lastRow; row++)
+            dirty->rows &= ~(1u << row);
+        dirty->rows &= ~(1u << row);
     }
 }
 
@@ -940,6 +1007,7 @@ void CopyToBgTilemapBufferRect(u8 bg, const void *src, u8 destX, u8 destY, u8 wi
             break;
         }
         }
+        MarkBgTilemapDirty(bg, destX, destY, width, height);
     }
 }
 
@@ -989,6 +1057,7 @@ void CopyRectToBgTilemapBufferRect(u8 bg, const void *src, u8 srcX, u8 srcY, u8
             }
             break;
         }
+        MarkBgTilemapDirty(bg, destX, destY, rectWidth, rectHeight);
     }
 }
 
@@ -1022,6 +1091,7 @@ void FillBgTilemapBufferRect_Palette0(u8 bg, u16 tileNum, u8 x, u8 y, u8 width,
             }
             break;
         }
+        MarkBgTilemapDirty(bg, x, y, width, height);
     }
 }
 
@@ -1067,6 +1137,7 @@ void WriteSequenceToBgTilemapBuffer(u8 bg, u16 firstTileNum, u8 x, u8 y, u8 widt
             }
             break;
         }
+        MarkBgTilemapDirty(bg, x, y, width, height);
     }
 }
 
@@ -1245,3 +1316,43 @@ bool32 IsTileMapOutsideWram(u8 bg)
     else
         return FALSE;
 }
+
+static void MarkBgTilemapDirty(u8 bg, u8 x, u8 y, u8 width, u8 height)
+{
+    struct BgDirtyTilemap *dirty = &sDirtyTilemaps[bg];
+    u32 rows;
+
+    if (width == 0 || height == 0)
+        return;
+
+    if (GetBgType(bg) != BG_TYPE_NORMAL
+     || GetBgControlAttribute(bg, BG_CTRL_ATTR_SCREENSIZE) != 0
+     || x + width > 32
+     || y + height > 32)
+    {
+        dirty->whole = TRUE;
+        return;
+    }
+
+    if (dirty->rows == 0)
+    {
+        dirty->left = x;
+        dirty->right = x + width - 1;
+    }
+    else
+    {
+        if (x < dirty->left)
+            dirty->left = x;
+        if (x + width - 1 > dirty->right)
+            dirty->right = x + width - 1;
+    }
+
+    rows = (height == 32) ? 0xFFFFFFFF : ((1u << height) - 1);
+    dirty->rows |= rows << y;
+}
+
+static void ClearBgTilemapDirty(u8 bg)
+{
+    sDirtyTilemaps[bg].rows = 0;
+    sDirtyTilemaps[bg].whole = FALSE;
+}
@@ -0,0 +1,362 @@
+#include "global.h"
+#include "frame_profiler.h"
+
+#ifdef FRAME_PROFILER
+
+#include "cycle_counter.h"
+#include "gpu_regs.h"
+#include "main.h"
+#include "palette.h"
+#include "constants/rgb.h"
+
+// Profiler de frame: ver include/frame_profiler.h. Las zonas acumulan en
+// sZoneAccum durante la ventana; FrameProfiler_Latch la cierra, vuelca el
+// resultado en gFrameProfile y lo reporta -- por DebugPrintf (":P PROF") en
+// PHANTOM_TEST, o en el overlay de BG0 en cualquier otro build.
+
+struct ProfilerZoneAccum
+{
+    u32 start;
+    u32 min;
+    u32 max;
+    u32 total;
+    u32 samples;
+};
+
+EWRAM_DATA struct ProfilerZoneStats gFrameProfile[PROFILER_ZONE_COUNT] = {0};
+EWRAM_DATA static struct ProfilerZoneAccum sZoneAccum[PROFILER_ZONE_COUNT] = {0};
+EWRAM_DATA static u8 sWindowFrames = 0;
+
+// Nombre largo para el log y etiqueta de 3 letras para el overlay.
+static const char *const sZoneNames[PROFILER_ZONE_COUNT][2] =
+{
+    [PROFILER_ZONE_CALLBACKS]       = {"callbacks",       "CB "},
+    [PROFILER_ZONE_RUN_TASKS]       = {"run-tasks",       "TSK"},
+    [PROFILER_ZONE_ANIMATE_SPRITES] = {"animate-sprites", "ANM"},
+    [PROFILER_ZONE_BUILD_OAM]       = {"build-oam",       "OAM"},
+    [PROFILER_ZONE_TEXT_PRINTERS]   = {"text-printers",   "TXT"},
+    [PROFILER_ZONE_PALETTE_FADE]    = {"palette-fade",    "PAL"},
+    [PROFILER_ZONE_VBLANK_CB]       = {"vblank-cb",       "VBL"},
+    [PROFILER_ZONE_DMA3_REQUESTS]   = {"dma3-requests",   "DMA"},
+    [PROFILER_ZONE_HBLANK_CB]       = {"hblank-cb",       "HBL"},
+};
+
+#ifndef PHANTOM_TEST
+static void DrawOverlay(void);
+static void ToggleOverlay(void);
+
+EWRAM_DATA static bool8 sOverlayShown = FALSE;
+#endif
+
+static void ResetZoneAccum(void)
+{
+    u8 zone;
+
+    for (zone = 0; zone < PROFILER_ZONE_COUNT; zone++)
+    {
+        sZoneAccum[zone].min = 0xFFFFFFFF;
+        sZoneAccum[zone].max = 0;
+        sZoneAccum[zone].total = 0;
+        sZoneAccum[zone].samples = 0;
+    }
+}
+
+void FrameProfiler_Init(void)
+{
+    CycleCounter_Start();
+    ResetZoneAccum();
+    sWindowFrames = 0;
+}
+
+void FrameProfiler_Begin(u8 zone)
+{
+    sZoneAccum[zone].start = CycleCounter_Read();
+}
+
+void FrameProfiler_End(u8 zone)
+{
+    struct ProfilerZoneAccum *accum = &sZoneAccum[zone];
+    u32 cycles = CycleCounter_Read() - accum->start;
+
+    accum->total += cycles;
+    accum->samples++;
+    if (cycles < accum->min)
+        accum->min = cycles;
+    if (cycles > accum->max)
+        accum->max = cycles;
+}
+
+void FrameProfiler_Latch(void)
+{
+    u8 zone;
+
+    for (zone = 0; zone < PROFILER_ZONE_COUNT; zone++)
+    {
+        struct ProfilerZoneAccum *accum = &sZoneAccum[zone];
+        struct ProfilerZoneStats *stats = &gFrameProfile[zone];
+
+        stats->samples = accum->samples;
+        if (accum->samples != 0)
+        {
+            stats->min = accum->min;
+            stats->avg = accum->total / accum->samples;
+            stats->max = accum->max;
+            DebugPrintf(":P PROF %s min=%d avg=%d max=%d n=%d",
+                        sZoneNames[zone][0], stats->min, stats->avg, stats->max, stats->samples);
+        }
+        else
+        {
+            stats->min = 0;
+            stats->avg = 0;
+            stats->max = 0;
+        }
+    }
+    ResetZoneAccum();
+
+#ifndef PHANTOM_TEST
+    if (sOverlayShown)
+        DrawOverlay();
+#endif
+}
+
+// Llamado por el bucle principal una vez por frame, antes de esperar al
+// VBlank.
+void FrameProfiler_EndFrame(void)
+{
+    if (++sWindowFrames >= PROFILER_WINDOW_FRAMES)
+    {
+        sWindowFrames = 0;
+        FrameProfiler_Latch();
+    }
+
+#ifndef PHANTOM_TEST
+    if ((gMain.heldKeysRaw & (L_BUTTON | R_BUTTON)) == (L_BUTTON | R_BUTTON)
+     && (gMain.newKeysRaw & SELECT_BUTTON))
+        ToggleOverlay();
+#endif
+}
+
+#ifndef PHANTOM_TEST
+
+// OVERLAY: BG0 pasa a apuntar a glifos propios al principio del char block
+// 3 y al map block 31, con la paleta 15 (color 1 = texto, 2 = fondo). Al
+// mostrarlo se guarda lo que habia en esa VRAM y se cargan los glifos una
+// sola vez; al ocultarlo se restaura esa copia, salvo que la pantalla haya
+// cargado algo encima mientras tanto. Mientras se ve, los glifos no se
+// recargan (pisarian lo que la pantalla haya cargado desde entonces, y la
+// copia guardada ya no lo reflejaria): si la pantalla limpia esa VRAM, el
+// overlay se ve vacio hasta volver a activarlo. FrameProfiler_VBlank
+// reescribe el mapa y los registros de BG0 en cada VBlank (despues de los de
+// la pantalla) para ganarles. La pantalla debajo pierde BG0 mientras tanto:
+// es una herramienta de debug.
+#define OVERLAY_CHAR_BASE 3
+#define OVERLAY_MAP_BASE  31
+#define OVERLAY_PALETTE   15
+#define OVERLAY_ROWS      (DISPLAY_HEIGHT / 8)
+#define OVERLAY_COLOR_FG  1
+#define OVERLAY_COLOR_BG  2
+
+static const char sGlyphChars[] = " 0123456789ABCDGHIKLMNOPSTVX-";
+
+static const u8 sGlyphs[][8] =
+{
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+    {0x00, 0x1C, 0x22, 0x32, 0x2A, 0x26, 0x22, 0x1C}, // '0'
+    {0x00, 0x08, 0x0C, 0x08, 0x08, 0x08, 0x08, 0x1C}, // '1'
+    {0x00, 0x1C, 0x22, 0x20, 0x10, 0x08, 0x04, 0x3E}, // '2'
+    {0x00, 0x1E, 0x20, 0x20, 0x1C, 0x20, 0x20, 0x1E}, // '3'
+    {0x00, 0x10, 0x18, 0x14, 0x12, 0x3E, 0x10, 0x10}, // '4'
+    {0x00, 0x3E, 0x02, 0x1E, 0x20, 0x20, 0x22, 0x1C}, // '5'
+    {0x00, 0x18, 0x04, 0x02, 0x1E, 0x22, 0x22, 0x1C}, // '6'
+    {0x00, 0x3E, 0x20, 0x10, 0x08, 0x04, 0x04, 0x04}, // '7'
+    {0x00, 0x1C, 0x22, 0x22, 0x1C, 0x22, 0x22, 0x1C}, // '8'
+    {0x00, 0x1C, 0x22, 0x22, 0x3C, 0x20, 0x10, 0x0C}, // '9'
+    {0x00, 0x1C, 0x22, 0x22, 0x3E, 0x22, 0x22, 0x22}, // 'A'
+    {0x00, 0x1E, 0x22, 0x22, 0x1E, 0x22, 0x22, 0x1E}, // 'B'
+    {0x00, 0x1C, 0x22, 0x02, 0x02, 0x02, 0x22, 0x1C}, // 'C'
+    {0x00, 0x1E, 0x22, 0x22, 0x22, 0x22, 0x22, 0x1E}, // 'D'
+    {0x00, 0x1C, 0x22, 0x02, 0x3A, 0x22, 0x22, 0x3C}, // 'G'
+    {0x00, 0x22, 0x22, 0x22, 0x3E, 0x22, 0x22, 0x22}, // 'H'
+    {0x00, 0x1C, 0x08, 0x08, 0x08, 0x08, 0x08, 0x1C}, // 'I'
+    {0x00, 0x22, 0x12, 0x0A, 0x06, 0x0A, 0x12, 0x22}, // 'K'
+    {0x00, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x3E}, // 'L'
+    {0x00, 0x22, 0x36, 0x2A, 0x2A, 0x22, 0x22, 0x22}, // 'M'
+    {0x00, 0x22, 0x26, 0x2A, 0x32, 0x22, 0x22, 0x22}, // 'N'
+    {0x00, 0x1C, 0x22, 0x22, 0x22, 0x22, 0x22, 0x1C}, // 'O'
+    {0x00, 0x1E, 0x22, 0x22, 0x1E, 0x02, 0x02, 0x02}, // 'P'
+    {0x00, 0x3C, 0x02, 0x02, 0x1C, 0x20, 0x20, 0x1E}, // 'S'
+    {0x00, 0x3E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08}, // 'T'
+    {0x00, 0x22, 0x22, 0x22, 0x22, 0x22, 0x14, 0x08}, // 'V'
+    {0x00, 0x22, 0x22, 0x14, 0x08, 0x14, 0x22, 0x22}, // 'X'
+    {0x00, 0x00, 0x00, 0x00, 0x3E, 0x00, 0x00, 0x00}, // '-'
+};
+
+#define OVERLAY_TILE_COUNT (1 + ARRAY_COUNT(sGlyphs))  // tile 0: transparente
+
+EWRAM_DATA static u16 sOverlayMap[OVERLAY_ROWS * 32] = {0};
+EWRAM_DATA static u32 sSavedTiles[OVERLAY_TILE_COUNT * TILE_SIZE_4BPP / sizeof(u32)] = {0};
+EWRAM_DATA static u16 sSavedMap[OVERLAY_ROWS * 32] = {0};
+
+// Fila y del tile de la VRAM del overlay; el tile 0 es el transparente.
+static u32 GetOverlayTileRow(u32 tile, u32 y)
+{
+    u32 row = 0;
+    u32 x;
+
+    if (tile == 0)
+        return 0;
+
+    // 4bpp: el pixel x va en el nibble x.
+    for (x = 0; x < 8; x++)
+        row |= ((sGlyphs[tile - 1][y] >> x) & 1 ? OVERLAY_COLOR_FG : OVERLAY_COLOR_BG) << (x * 4);
+    return row;
+}
+
+static void LoadOverlayGlyphs(void)
+{
+    u32 *dest = (u32 *)BG_CHAR_ADDR(OVERLAY_CHAR_BASE);
+    u32 tile, y;
+
+    for (tile = 0; tile < OVERLAY_TILE_COUNT; tile++)
+    {
+        for (y = 0; y < 8; y++)
+            *dest++ = GetOverlayTileRow(tile, y);
+    }
+}
+
+// Si la pantalla cargó sus propios tiles encima de los glifos mientras se
+// veía el overlay, esos son más nuevos que la copia guardada.
+static bool8 AreOverlayGlyphsLoaded(void)
+{
+    const u32 *src = (const u32 *)BG_CHAR_ADDR(OVERLAY_CHAR_BASE);
+    u32 tile, y;
+
+    for (tile = 0; tile < OVERLAY_TILE_COUNT; tile++)
+    {
+        for (y = 0; y < 8; y++)
+        {
+            if (*src++ != GetOverlayTileRow(tile, y))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static u16 GetGlyphTile(char c)
+{
+    u16 i;
+
+    for (i = 0; sGlyphChars[i] != '\0'; i++)
+    {
+        if (sGlyphChars[i] == c)
+            return (1 + i) | (OVERLAY_PALETTE << 12);
+    }
+    return 1 | (OVERLAY_PALETTE << 12); // espacio
+}
+
+static void DrawOverlayText(u8 row, u8 col, const char *str)
+{
+    while (*str != '\0' && col < 32)
+        sOverlayMap[row * 32 + col++] = GetGlyphTile(*str++);
+}
+
+// Numero alineado a la derecha en un campo de 6 columnas (un frame entero,
+// 280896 ciclos, cabe justo).
+static void DrawOverlayNumber(u8 row, u8 col, u32 value)
+{
+    s8 i;
+
+    if (value > 999999)
+        value = 999999;
+
+    for (i = 5; i >= 0; i--)
+    {
+        if (value != 0 || i == 5)
+            sOverlayMap[row * 32 + col + i] = GetGlyphTile('0' + value % 10);
+        else
+            sOverlayMap[row * 32 + col + i] = GetGlyphTile(' ');
+        value /= 10;
+    }
+}
+
+static void DrawOverlay(void)
+{
+    u8 zone;
+
+    CpuFill16(0, sOverlayMap, sizeof(sOverlayMap));
+    DrawOverlayText(0, 0, "       MIN    AVG    MAX");
+
+    for (zone = 0; zone < PROFILER_ZONE_COUNT; zone++)
+    {
+        const struct ProfilerZoneStats *stats = &gFrameProfile[zone];
+        u8 row = 1 + zone;
+
+        DrawOverlayText(row, 0, sZoneNames[zone][1]);
+        if (stats->samples == 0)
+        {
+            DrawOverlayText(row, 3, "      -      -      -");
+        }
+        else
+        {
+            DrawOverlayText(row, 3, " ");
+            DrawOverlayNumber(row, 4, stats->min);
+            DrawOverlayText(row, 10, " ");
+            DrawOverlayNumber(row, 11, stats->avg);
+            DrawOverlayText(row, 17, " ");
+            DrawOverlayNumber(row, 18, stats->max);
+        }
+    }
+}
+
+static void ToggleOverlay(void)
+{
+    u16 *pltt = (u16 *)PLTT;
+
+    if (!sOverlayShown)
+    {
+        CpuCopy32((void *)BG_CHAR_ADDR(OVERLAY_CHAR_BASE), sSavedTiles, sizeof(sSavedTiles));
+        CpuCopy16((void *)BG_SCREEN_ADDR(OVERLAY_MAP_BASE), sSavedMap, sizeof(sSavedMap));
+        LoadOverlayGlyphs();
+        DrawOverlay();
+        sOverlayShown = TRUE;
+    }
+    else
+    {
+        sOverlayShown = FALSE;
+        if (AreOverlayGlyphsLoaded())
+            CpuCopy32(sSavedTiles, (void *)BG_CHAR_ADDR(OVERLAY_CHAR_BASE), sizeof(sSavedTiles));
+        CpuCopy16(sSavedMap, (void *)BG_SCREEN_ADDR(OVERLAY_MAP_BASE), sizeof(sSavedMap));
+        // Los registros y la paleta vuelven a lo que la pantalla tiene en
+        // sus buffers.
+        REG_BG0CNT = GetGpuReg(REG_OFFSET_BG0CNT);
+        REG_BG0HOFS = GetGpuReg(REG_OFFSET_BG0HOFS);
+        REG_BG0VOFS = GetGpuReg(REG_OFFSET_BG0VOFS);
+        REG_DISPCNT = GetGpuReg(REG_OFFSET_DISPCNT);
+        pltt[BG_PLTT_ID(OVERLAY_PALETTE) + OVERLAY_COLOR_FG] = gPlttBufferFaded[BG_PLTT_ID(OVERLAY_PALETTE) + OVERLAY_COLOR_FG];
+        pltt[BG_PLTT_ID(OVERLAY_PALETTE) + OVERLAY_COLOR_BG] = gPlttBufferFaded[BG_PLTT_ID(OVERLAY_PALETTE) + OVERLAY_COLOR_BG];
+    }
+}
+
+#endif // PHANTOM_TEST
+
+// Llamado desde VBlankIntr despues de ProcessDma3Requests.
+void FrameProfiler_VBlank(void)
+{
+#ifndef PHANTOM_TEST
+    u16 *pltt = (u16 *)PLTT;
+
+    if (!sOverlayShown)
+        return;
+
+    DmaCopy16(3, sOverlayMap, BG_SCREEN_ADDR(OVERLAY_MAP_BASE), sizeof(sOverlayMap));
+    REG_BG0CNT = BGCNT_PRIORITY(0) | BGCNT_CHARBASE(OVERLAY_CHAR_BASE) | BGCNT_16COLOR
+               | BGCNT_SCREENBASE(OVERLAY_MAP_BASE) | BGCNT_TXT256x256;
+    REG_BG0HOFS = 0;
+    REG_BG0VOFS = 0;
+    REG_DISPCNT |= DISPCNT_BG0_ON;
+    pltt[BG_PLTT_ID(OVERLAY_PALETTE) + OVERLAY_COLOR_FG] = RGB_WHITE;
+    pltt[BG_PLTT_ID(OVERLAY_PALETTE) + OVERLAY_COLOR_BG] = RGB(4, 4, 6);
+#endif
+}
+
+#endif // FRAME_PROFILER
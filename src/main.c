@@ -24,6 +24,7 @@
 #include "main.h"
 #include "trainer_hill.h"
 #include "constants/rgb.h"
+#include "frame_profiler.h"
 #ifdef PHANTOM_TEST
 #include "phantom_test.h"
 #endif
@@ -115,6 +116,9 @@ void AgbMain(void)
     ResetBgs();
     SetDefaultFontsPointer();
     InitHeap(gHeap, HEAP_SIZE);
+#ifdef FRAME_PROFILER
+    FrameProfiler_Init();
+#endif
 
     gSoftResetDisabled = FALSE;
 
@@ -170,6 +174,9 @@ void AgbMain(void)
 
         PlayTimeCounter_Update();
         MapMusicMain();
+#ifdef FRAME_PROFILER
+        FrameProfiler_EndFrame();
+#endif
         WaitForVBlank();
     }
 }
@@ -193,15 +200,20 @@ static void InitMainCallbacks(void)
 
 static void CallCallbacks(void)
 {
+    PROFILER_BEGIN(PROFILER_ZONE_CALLBACKS);
+
     if (gMain.callback1)
         gMain.callback1();
 
     if (gMain.callback2)
         gMain.callback2();
+
+    PROFILER_END(PROFILER_ZONE_CALLBACKS);
 }
 
 void SetMainCallback2(MainCallback callback)
 {
+    ScreenArena_OnMainCallbackSwitch(gMain.callback2, callback);
     gMain.callback2 = callback;
     gMain.state = 0;
 }
@@ -356,12 +368,21 @@ static void VBlankIntr(void)
         (*gTrainerHillVBlankCounter)++;
 
     if (gMain.vblankCallback)
+    {
+        PROFILER_BEGIN(PROFILER_ZONE_VBLANK_CB);
         gMain.vblankCallback();
+        PROFILER_END(PROFILER_ZONE_VBLANK_CB);
+    }
 
     gMain.vblankCounter2++;
 
     CopyBufferedValuesToGpuRegs();
+    PROFILER_BEGIN(PROFILER_ZONE_DMA3_REQUESTS);
     ProcessDma3Requests();
+    PROFILER_END(PROFILER_ZONE_DMA3_REQUESTS);
+#ifdef FRAME_PROFILER
+    FrameProfiler_VBlank();
+#endif
 
     gPcmDmaCounter = gSoundInfo.pcmDmaCounter;
 
@@ -385,7 +406,11 @@ void InitFlashTimer(void)
 static void HBlankIntr(void)
 {
     if (gMain.hblankCallback)
+    {
+        PROFILER_BEGIN(PROFILER_ZONE_HBLANK_CB);
         gMain.hblankCallback();
+        PROFILER_END(PROFILER_ZONE_HBLANK_CB);
+    }
 
     INTR_CHECK |= INTR_FLAG_HBLANK;
     gMain.intrCheck |= INTR_FLAG_HBLANK;
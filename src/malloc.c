@@ -28,6 +28,164 @@ struct MemBlock {
     u8 data[0];
 };
 
+// Links of a free block, stored in its (otherwise unused) data area. This is
+// why every block's data is at least MIN_BLOCK_SIZE bytes.
+struct FreeLinks {
+    struct MemBlock *prevFree;
+    struct MemBlock *nextFree;
+};
+
+#define FREE_LINKS(block) ((struct FreeLinks *)(block)->data)
+
+// Free blocks are kept in segregated lists by size class. Sizes are rounded
+// up to BLOCK_ALIGN, so the small classes hold blocks of exactly one size and
+// any block in them satisfies a request of that class. Bigger blocks go into
+// power-of-two range classes, where only the requested class itself needs a
+// first-fit scan; every class above it is guaranteed to fit.
+//
+// Each list is sorted by address, so allocation still returns the
+// lowest-addressed block that fits, like the original first-fit walk. Some
+// code uses fixed offsets into gHeap without going through Alloc (e.g.
+// BATTLER_OFFSET, the contest and link buffers), and relies on long-lived
+// allocations staying at the bottom of the heap.
+#define BLOCK_ALIGN          8
+#define MIN_BLOCK_SIZE       sizeof(struct FreeLinks)
+#define NUM_SMALL_CLASSES    16
+#define SMALL_CLASS_MAX_SIZE (NUM_SMALL_CLASSES * BLOCK_ALIGN)
+#define NUM_SIZE_CLASSES     32
+
+static struct MemBlock *sFreeLists[NUM_SIZE_CLASSES];
+static u32 sFreeListBitmap;
+
+// Per-screen bump arena: one heap block carved up with no per-allocation
+// headers, freed as a whole when the screen's main callback is left.
+static struct {
+    u8 *start;
+    u32 size;
+    u32 used;
+    void (*owner)(void);
+} sScreenArena;
+
+#ifndef NDEBUG
+static u32 sHeapUsed;
+static u32 sHeapPeak;
+static u32 sHeapFailedAllocs;
+#endif
+
+static const u8 sDeBruijnBitPositions[32] =
+{
+     0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+    31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9,
+};
+
+// Index of the lowest set bit. bits must be non-zero.
+static u32 LowestSetBit(u32 bits)
+{
+    return sDeBruijnBitPositions[((bits & -bits) * 0x077CB531) >> 27];
+}
+
+static u32 GetSizeClass(u32 size)
+{
+    u32 sizeClass;
+
+    if (size <= SMALL_CLASS_MAX_SIZE)
+        return size / BLOCK_ALIGN - 1;
+
+    // One class per power of two above the small classes.
+    sizeClass = NUM_SMALL_CLASSES;
+    size >>= 8;
+    while (size != 0 && sizeClass < NUM_SIZE_CLASSES - 1)
+    {
+        sizeClass++;
+        size >>= 1;
+    }
+    return sizeClass;
+}
+
+static void InsertFreeBlock(struct MemBlock *block)
+{
+    u32 sizeClass = GetSizeClass(block->size);
+    struct MemBlock *prevFree = NULL;
+    struct MemBlock *nextFree = sFreeLists[sizeClass];
+
+    while (nextFree != NULL && nextFree < block)
+    {
+        prevFree = nextFree;
+        nextFree = FREE_LINKS(nextFree)->nextFree;
+    }
+
+    FREE_LINKS(block)->prevFree = prevFree;
+    FREE_LINKS(block)->nextFree = nextFree;
+    if (nextFree != NULL)
+        FREE_LINKS(nextFree)->prevFree = block;
+    if (prevFree != NULL)
+        FREE_LINKS(prevFree)->nextFree = block;
+    else
+        sFreeLists[sizeClass] = block;
+    sFreeListBitmap |= 1u << sizeClass;
+}
+
+static void RemoveFreeBlock(struct MemBlock *block)
+{
+    struct MemBlock *prevFree = FREE_LINKS(block)->prevFree;
+    struct MemBlock *nextFree = FREE_LINKS(block)->nextFree;
+
+    if (nextFree != NULL)
+        FREE_LINKS(nextFree)->prevFree = prevFree;
+
+    if (prevFree != NULL)
+    {
+        FREE_LINKS(prevFree)->nextFree = nextFree;
+    }
+    else
+    {
+        u32 sizeClass = GetSizeClass(block->size);
+
+        sFreeLists[sizeClass] = nextFree;
+        if (nextFree == NULL)
+            sFreeListBitmap &= ~(1u << sizeClass);
+    }
+}
+
+// Returns the lowest-addressed free block of at least `size` bytes. Since
+// the lists are sorted, that is the head of one of the classes that always
+// fit, or the first fitting block of the requested range class.
+static struct MemBlock *FindFreeBlock(u32 size)
+{
+    u32 sizeClass = GetSizeClass(size);
+    u32 bits;
+    struct MemBlock *best = NULL;
+    struct MemBlock *pos;
+
+    if (sizeClass >= NUM_SMALL_CLASSES)
+    {
+        // Blocks in a range class may still be too small for this request.
+        for (pos = sFreeLists[sizeClass]; pos != NULL; pos = FREE_LINKS(pos)->nextFree)
+        {
+            if (pos->size >= size)
+            {
+                best = pos;
+                break;
+            }
+        }
+        bits = sFreeListBitmap & (~1u << sizeClass);
+    }
+    else
+    {
+        bits = sFreeListBitmap & (~0u << sizeClass);
+    }
+
+    while (bits != 0)
+    {
+        pos = sFreeLists[LowestSetBit(bits)];
+        if (best == NULL || pos < best)
+            best = pos;
+        bits &= bits - 1;
+    }
+
+    return best;
+}
+
 void PutMemBlockHeader(void *block, struct MemBlock *prev, struct MemBlock *next, u32 size)
 {
     struct MemBlock *header = (struct MemBlock *)block;
@@ -46,60 +204,58 @@ void PutFirstMemBlockHeader(void *block, u32 size)
 
 void *AllocInternal(void *heapStart, u32 size)
 {
-    struct MemBlock *pos = (struct MemBlock *)heapStart;
-    struct MemBlock *head = pos;
+    struct MemBlock *head = (struct MemBlock *)heapStart;
+    struct MemBlock *pos;
     struct MemBlock *splitBlock;
     u32 foundBlockSize;
 
     // Alignment
-    if (size & 3)
-        size = 4 * ((size / 4) + 1);
+    if (size < MIN_BLOCK_SIZE)
+        size = MIN_BLOCK_SIZE;
+    if (size & (BLOCK_ALIGN - 1))
+        size = BLOCK_ALIGN * ((size / BLOCK_ALIGN) + 1);
 
-    for (;;)
+    pos = FindFreeBlock(size);
+    if (pos == NULL)
     {
-        // Loop through the blocks looking for unused block that's big enough.
+#ifndef NDEBUG
+        sHeapFailedAllocs++;
+#endif
+        return NULL;
+    }
 
-        if (!pos->flag)
-        {
-            foundBlockSize = pos->size;
+    RemoveFreeBlock(pos);
+    pos->flag = TRUE;
+    foundBlockSize = pos->size;
 
-            if (foundBlockSize >= size)
-            {
-                if (foundBlockSize - size < 2 * sizeof(struct MemBlock))
-                {
-                    // The block isn't much bigger than the requested size,
-                    // so just use it.
-                    pos->flag = TRUE;
-                }
-                else
-                {
-                    // The block is significantly bigger than the requested
-                    // size, so split the rest into a separate block.
-                    foundBlockSize -= sizeof(struct MemBlock);
-                    foundBlockSize -= size;
+    if (foundBlockSize - size >= 2 * sizeof(struct MemBlock))
+    {
+        // The block is significantly bigger than the requested
+        // size, so split the rest into a separate block.
+        foundBlockSize -= sizeof(struct MemBlock);
+        foundBlockSize -= size;
 
-                    splitBlock = (struct MemBlock *)(pos->data + size);
+        splitBlock = (struct MemBlock *)(pos->data + size);
 
-                    pos->flag = TRUE;
-                    pos->size = size;
+        pos->size = size;
 
-                    PutMemBlockHeader(splitBlock, pos, pos->next, foundBlockSize);
+        PutMemBlockHeader(splitBlock, pos, pos->next, foundBlockSize);
 
-                    pos->next = splitBlock;
+        pos->next = splitBlock;
 
-                    if (splitBlock->next != head)
-                        splitBlock->next->prev = splitBlock;
-                }
+        if (splitBlock->next != head)
+            splitBlock->next->prev = splitBlock;
 
-                return pos->data;
-            }
-        }
+        InsertFreeBlock(splitBlock);
+    }
 
-        if (pos->next == head)
-            return NULL;
+#ifndef NDEBUG
+    sHeapUsed += sizeof(struct MemBlock) + pos->size;
+    if (sHeapUsed > sHeapPeak)
+        sHeapPeak = sHeapUsed;
+#endif
 
-        pos = pos->next;
-    }
+    return pos->data;
 }
 
 void FreeInternal(void *heapStart, void *pointer)
@@ -108,14 +264,23 @@ void FreeInternal(void *heapStart, void *pointer)
     {
         struct MemBlock *head = (struct MemBlock *)heapStart;
         struct MemBlock *block = (struct MemBlock *)((u8 *)pointer - sizeof(struct MemBlock));
+
+        // A second Free of the same block would link it into a free list
+        // twice and corrupt the lists.
+        AGB_ASSERT(block->flag);
         block->flag = FALSE;
 
+#ifndef NDEBUG
+        sHeapUsed -= sizeof(struct MemBlock) + block->size;
+#endif
+
         // If the freed block isn't the last one, merge with the next block
         // if it's not in use.
         if (block->next != head)
         {
             if (!block->next->flag)
             {
+                RemoveFreeBlock(block->next);
                 block->size += sizeof(struct MemBlock) + block->next->size;
                 block->next->magic = 0;
                 block->next = block->next->next;
@@ -130,6 +295,7 @@ void FreeInternal(void *heapStart, void *pointer)
         {
             if (!block->prev->flag)
             {
+                RemoveFreeBlock(block->prev);
                 block->prev->next = block->next;
 
                 if (block->next != head)
@@ -137,8 +303,11 @@ void FreeInternal(void *heapStart, void *pointer)
 
                 block->magic = 0;
                 block->prev->size += sizeof(struct MemBlock) + block->size;
+                block = block->prev;
             }
         }
+
+        InsertFreeBlock(block);
     }
 }
 
@@ -185,9 +354,29 @@ bool32 CheckMemBlockInternal(void *heapStart, void *pointer)
 
 void InitHeap(void *heapStart, u32 heapSize)
 {
+    u32 i;
+
+    // Keep every block size a multiple of BLOCK_ALIGN.
+    heapSize &= ~(BLOCK_ALIGN - 1);
+
     sHeapStart = heapStart;
     sHeapSize = heapSize;
     PutFirstMemBlockHeader(heapStart, heapSize);
+
+    for (i = 0; i < NUM_SIZE_CLASSES; i++)
+        sFreeLists[i] = NULL;
+    sFreeListBitmap = 0;
+    InsertFreeBlock((struct MemBlock *)heapStart);
+
+    // Whatever the arena pointed at is gone with the old heap.
+    sScreenArena.start = NULL;
+    sScreenArena.owner = NULL;
+
+#ifndef NDEBUG
+    sHeapUsed = 0;
+    sHeapPeak = 0;
+    sHeapFailedAllocs = 0;
+#endif
 }
 
 void *Alloc(u32 size)
@@ -222,3 +411,113 @@ bool32 CheckHeap()
 
     return TRUE;
 }
+
+// Opens the screen arena as a single heap block of the given size. The arena
+// belongs to the screen whose main callback is `owner`: it survives the
+// SetMainCallback2 calls that lead into `owner` (init states, loaders) and is
+// released by the first one that switches away from it. Opening a new arena
+// releases any previous one, so a screen that was left without going through
+// its owner callback cannot leak its buffers.
+bool32 ScreenArena_Open(u32 size, void (*owner)(void))
+{
+    ScreenArena_Release();
+
+    sScreenArena.start = Alloc(size);
+    if (sScreenArena.start == NULL)
+        return FALSE;
+
+    sScreenArena.size = size;
+    sScreenArena.used = 0;
+    sScreenArena.owner = owner;
+    return TRUE;
+}
+
+void *ScreenArena_Alloc(u32 size)
+{
+    void *mem;
+
+    // Alignment
+    if (size & 3)
+        size = 4 * ((size / 4) + 1);
+
+    if (sScreenArena.start == NULL || sScreenArena.size - sScreenArena.used < size)
+        return NULL;
+
+    mem = sScreenArena.start + sScreenArena.used;
+    sScreenArena.used += size;
+    return mem;
+}
+
+void *ScreenArena_AllocZeroed(u32 size)
+{
+    void *mem = ScreenArena_Alloc(size);
+
+    if (mem != NULL)
+    {
+        if (size & 3)
+            size = 4 * ((size / 4) + 1);
+
+        CpuFill32(0, mem, size);
+    }
+
+    return mem;
+}
+
+void ScreenArena_Release(void)
+{
+    if (sScreenArena.start != NULL)
+    {
+        Free(sScreenArena.start);
+        sScreenArena.start = NULL;
+        sScreenArena.owner = NULL;
+    }
+}
+
+// Called by SetMainCallback2 before it switches callbacks.
+void ScreenArena_OnMainCallbackSwitch(void (*from)(void), void (*to)(void))
+{
+    if (sScreenArena.start != NULL && from == sScreenArena.owner && to != sScreenArena.owner)
+        ScreenArena_Release();
+}
+
+#ifndef NDEBUG
+void GetHeapStats(struct HeapStats *stats)
+{
+    struct MemBlock *pos = (struct MemBlock *)sHeapStart;
+
+    stats->size = sHeapSize;
+    stats->used = sHeapUsed;
+    stats->peak = sHeapPeak;
+    stats->failedAllocs = sHeapFailedAllocs;
+    stats->totalFree = 0;
+    stats->largestFree = 0;
+    stats->freeBlocks = 0;
+
+    do {
+        if (!pos->flag)
+        {
+            stats->totalFree += pos->size;
+            stats->freeBlocks++;
+            if (pos->size > stats->largestFree)
+                stats->largestFree = pos->size;
+        }
+        pos = pos->next;
+    } while (pos != (struct MemBlock *)sHeapStart);
+
+    // 0 when all free memory is one block, approaching 1000 as it splinters.
+    if (stats->totalFree != 0)
+        stats->fragmentation = 1000 - (stats->largestFree * 1000) / stats->totalFree;
+    else
+        stats->fragmentation = 0;
+}
+
+void DebugPrintHeapStats(void)
+{
+    struct HeapStats stats;
+
+    GetHeapStats(&stats);
+    DebugPrintf(":P HEAP used=%d peak=%d size=%d", stats.used, stats.peak, stats.size);
+    DebugPrintf(":P HEAP free=%d blocks=%d largest=%d frag=%d/1000 failed=%d",
+                stats.totalFree, stats.freeBlocks, stats.largestFree, stats.fragmentation, stats.failedAllocs);
+}
+#endif // NDEBUG
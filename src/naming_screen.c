@@ -394,7 +394,13 @@ static bool8 IsWideLetter(u8);
 
 void DoNamingScreen(u8 templateNum, u8 *destBuffer, u16 monSpecies, u16 monGender, u32 monPersonality, MainCallback returnCallback)
 {
-    sNamingScreen = Alloc(sizeof(struct NamingScreenData));
+    // The screen's data lives in a screen arena owned by CB2_NamingScreen, so
+    // it is released when the screen hands control back to returnCallback.
+    if (ScreenArena_Open(sizeof(struct NamingScreenData), CB2_NamingScreen))
+        sNamingScreen = ScreenArena_Alloc(sizeof(struct NamingScreenData));
+    else
+        sNamingScreen = NULL;
+
     if (!sNamingScreen)
     {
         SetMainCallback2(returnCallback);
@@ -702,7 +708,8 @@ static bool8 MainState_Exit(void)
         SetMainCallback2(sNamingScreen->returnCallback);
         DestroyTask(FindTaskIdByFunc(Task_NamingScreen));
         FreeAllWindowBuffers();
-        FREE_AND_SET_NULL(sNamingScreen);
+        // Already released along with the screen arena by SetMainCallback2.
+        sNamingScreen = NULL;
     }
     return FALSE;
 }
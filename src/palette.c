@@ -5,6 +5,7 @@
 #include "gpu_regs.h"
 #include "task.h"
 #include "constants/rgb.h"
+#include "frame_profiler.h"
 
 enum
 {
@@ -121,6 +122,8 @@ u8 UpdatePaletteFade(void)
     if (sPlttBufferTransferPending)
         return PALETTE_FADE_STATUS_LOADING;
 
+    PROFILER_BEGIN(PROFILER_ZONE_PALETTE_FADE);
+
     if (gPaletteFade.mode == NORMAL_FADE)
         result = UpdateNormalPaletteFade();
     else if (gPaletteFade.mode == FAST_FADE)
@@ -130,6 +133,8 @@ u8 UpdatePaletteFade(void)
 
     sPlttBufferTransferPending = gPaletteFade.multipurpose1 | dummy;
 
+    PROFILER_END(PROFILER_ZONE_PALETTE_FADE);
+
     return result;
 }
 
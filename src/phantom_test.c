@@ -15,6 +15,12 @@
 #include "wild_encounter.h"
 #include "sima_rooms.h"
 #include "sima.h"
+#include "sprite.h"
+#include "random.h"
+#include "malloc.h"
+#include "task.h"
+#include "cycle_counter.h"
+#include "frame_profiler.h"
 
 u8 gPhantomTestFailed = 0;
 
@@ -503,6 +509,244 @@ static void Test_SimaHorizInput(void)
     PHANTOM_ASSERT(result == SIMA_HORIZ_INPUT_WALK, "sima-horiz-walk-keeps-walking");
 }
 
+// Benchmark (no es un test: solo informa, salvo el orden del OAM): coste por
+// frame de BuildOamBuffer con los 64 sprites en uso, medido en ciclos de CPU
+// con TM2+TM3 en cascada (32 bits; a esta altura del arranque no hay link ni
+// nada más usando esos timers). Tres escenas: nada se mueve, se mueven unos
+// pocos sprites (overworld) y se mueven todos (animación de batalla). Cada
+// sprite lleva su índice en x para poder comprobar en el OAM que el orden
+// de dibujado es el de SortSprites: prioridad ascendente y, a igual
+// prioridad, de abajo arriba.
+#define BENCH_FRAMES 60
+
+enum
+{
+    BENCH_SPRITES_STATIC,
+    BENCH_SPRITES_FIELD,
+    BENCH_SPRITES_BATTLE,
+};
+
+static u32 sBenchStartCycles;
+
+static void StartCycleTimer(void)
+{
+    CycleCounter_Start();
+    sBenchStartCycles = CycleCounter_Read();
+}
+
+static u32 StopCycleTimer(void)
+{
+    return CycleCounter_Read() - sBenchStartCycles;
+}
+
+static bool8 IsOamInSpriteOrder(u8 *spriteIds)
+{
+    u8 i;
+    s16 prevY = 0;
+    u16 prevPriority = 0;
+
+    for (i = 0; i < MAX_SPRITES; i++)
+    {
+        struct Sprite *sprite = &gSprites[spriteIds[(gMain.oamBuffer[i].x - gSprites[spriteIds[0]].centerToCornerVecX - 16) / 2]];
+        u16 priority = sprite->subpriority | (sprite->oam.priority << 8);
+        s16 y = gMain.oamBuffer[i].y;
+
+        if (y >= DISPLAY_HEIGHT)
+            y -= 256;
+        if (i > 0 && (priority < prevPriority || (priority == prevPriority && y > prevY)))
+            return FALSE;
+        prevPriority = priority;
+        prevY = y;
+    }
+    return TRUE;
+}
+
+static void Bench_SpriteScene(u8 scene, const char *name)
+{
+    u8 i;
+    u16 frame;
+    u8 spriteIds[MAX_SPRITES];
+    u32 total = 0;
+    u32 max = 0;
+    bool8 sorted = TRUE;
+
+    ResetSpriteData();
+    for (i = 0; i < MAX_SPRITES; i++)
+    {
+        spriteIds[i] = CreateSprite(&gDummySpriteTemplate, 16 + i * 2, Random() % 256, Random() % 4);
+        gSprites[spriteIds[i]].oam.priority = Random() % 2;
+    }
+    BuildOamBuffer();
+
+    for (frame = 0; frame < BENCH_FRAMES; frame++)
+    {
+        u32 cycles;
+
+        if (scene == BENCH_SPRITES_FIELD)
+        {
+            for (i = 0; i < 4; i++)
+                gSprites[spriteIds[Random() % MAX_SPRITES]].y += (frame & 1) ? 1 : -1;
+        }
+        else if (scene == BENCH_SPRITES_BATTLE)
+        {
+            for (i = 0; i < MAX_SPRITES; i++)
+                gSprites[spriteIds[i]].y2 = (frame + i) % 8;
+        }
+
+        StartCycleTimer();
+        BuildOamBuffer();
+        cycles = StopCycleTimer();
+
+        total += cycles;
+        if (cycles > max)
+            max = cycles;
+        if (!IsOamInSpriteOrder(spriteIds))
+            sorted = FALSE;
+    }
+
+    DebugPrintf(":P BENCH %s avg=%d max=%d cycles", name, total / BENCH_FRAMES, max);
+    PHANTOM_ASSERT(sorted, "sprite-order-sorted");
+    ResetSpriteData();
+}
+
+static void Bench_SpriteOrder(void)
+{
+    Bench_SpriteScene(BENCH_SPRITES_STATIC, "sprite-order-static");
+    Bench_SpriteScene(BENCH_SPRITES_FIELD, "sprite-order-field");
+    Bench_SpriteScene(BENCH_SPRITES_BATTLE, "sprite-order-battle");
+}
+
+// Allocator del heap: un bloque liberado vuelve a su clase de tamaño y el
+// siguiente Alloc del mismo tamaño lo reutiliza sin recorrer el heap; entre
+// dos huecos de la misma clase gana el de dirección más baja, como en el
+// first-fit original (hay código que usa offsets fijos de gHeap); al
+// liberarlo todo, la coalescencia deja el bloque libre más grande igual que
+// antes del test. Reporta la telemetría del heap por el canal :P.
+#define BENCH_HEAP_BLOCKS 32
+
+static void Test_HeapAllocator(void)
+{
+    struct HeapStats before, after;
+    void *blocks[BENCH_HEAP_BLOCKS];
+    void *reused, *low, *high;
+    u32 total = 0, max = 0, cycles;
+    u8 i;
+
+    GetHeapStats(&before);
+
+    for (i = 0; i < BENCH_HEAP_BLOCKS; i++)
+        blocks[i] = Alloc(8 + (i % 8) * 12);
+    Free(blocks[5]);
+    reused = Alloc(8 + 5 * 12);
+    PHANTOM_ASSERT(reused == blocks[5], "heap-size-class-reuse");
+    blocks[5] = reused;
+
+    // Se libera primero el hueco bajo: una lista LIFO devolvería el alto.
+    low = blocks[9];
+    high = blocks[17];
+    Free(low);
+    Free(high);
+    blocks[9] = Alloc(8 + (9 % 8) * 12);
+    blocks[17] = Alloc(8 + (17 % 8) * 12);
+    PHANTOM_ASSERT(blocks[9] == low && blocks[17] == high, "heap-lowest-address-fit");
+
+    for (i = 0; i < BENCH_HEAP_BLOCKS; i += 2)
+        Free(blocks[i]);
+    for (i = 0; i < BENCH_HEAP_BLOCKS; i += 2)
+    {
+        StartCycleTimer();
+        blocks[i] = Alloc(8 + (i % 8) * 12);
+        cycles = StopCycleTimer();
+        total += cycles;
+        if (cycles > max)
+            max = cycles;
+    }
+    DebugPrintf(":P BENCH heap-alloc-small avg=%d max=%d cycles", total / (BENCH_HEAP_BLOCKS / 2), max);
+    DebugPrintHeapStats();
+
+    for (i = 0; i < BENCH_HEAP_BLOCKS; i++)
+        Free(blocks[i]);
+
+    GetHeapStats(&after);
+    PHANTOM_ASSERT(after.largestFree == before.largestFree, "heap-coalesce-on-free");
+    PHANTOM_ASSERT(after.used == before.used, "heap-used-restored");
+}
+
+// Scheduler de tasks: el orden de ejecución es por prioridad y, dentro de
+// una prioridad, por orden de creación, también para tasks creados o
+// destruidos a mitad de RunTasks. Reporta el coste en ciclos de cada task.
+static u8 sTaskRunOrder[NUM_TASKS];
+static u8 sTaskRunCount;
+
+static void Task_RecordRun(u8 taskId)
+{
+    if (sTaskRunCount < NUM_TASKS)
+        sTaskRunOrder[sTaskRunCount++] = gTasks[taskId].data[0];
+}
+
+static void Task_RecordRunAndDestroy(u8 taskId)
+{
+    Task_RecordRun(taskId);
+    DestroyTask(gTasks[taskId].data[1]);
+}
+
+static u8 CreateLabeledTask(TaskFunc func, u8 priority, u8 label)
+{
+    u8 taskId = CreateTask(func, priority);
+
+    gTasks[taskId].data[0] = label;
+    return taskId;
+}
+
+static void Test_TaskScheduler(void)
+{
+    // La etiqueta de cada task es su posición esperada en la ejecución; el
+    // 3 lo destruye el 1 antes de que le toque.
+    static const u8 sExpectedOrder[] = {0, 1, 2, 4, 5};
+    u8 destroyer, victim;
+    u8 i;
+    bool8 inOrder;
+
+    ResetTasks();
+    CreateLabeledTask(Task_RecordRun, 7, 4);
+    CreateLabeledTask(Task_RecordRun, 0, 0);
+    destroyer = CreateLabeledTask(Task_RecordRunAndDestroy, 3, 1);
+    CreateLabeledTask(Task_RecordRun, 3, 2);
+    victim = CreateLabeledTask(Task_RecordRun, 3, 3);
+    CreateLabeledTask(Task_RecordRun, 200, 5);
+    gTasks[destroyer].data[1] = victim;
+
+    sTaskRunCount = 0;
+    RunTasks();
+
+    inOrder = (sTaskRunCount == ARRAY_COUNT(sExpectedOrder));
+    for (i = 0; inOrder && i < sTaskRunCount; i++)
+        if (sTaskRunOrder[i] != sExpectedOrder[i])
+            inOrder = FALSE;
+    PHANTOM_ASSERT(inOrder, "task-priority-order");
+    PHANTOM_ASSERT(!gTasks[victim].isActive, "task-destroyed-mid-run");
+
+    DebugPrintTaskCycles();
+    ResetTasks();
+}
+
+// Profiler de frame: los benches de arriba ya pasaron por BuildOamBuffer y
+// RunTasks, así que al cerrar la ventana esas zonas tienen muestras
+// coherentes. El cierre reporta todas las zonas por el canal :P. Sin
+// FRAME_PROFILER (make PHANTOM_TEST=1 FRAME_PROFILER=0) no hay nada que
+// comprobar.
+static void Test_FrameProfiler(void)
+{
+#ifdef FRAME_PROFILER
+    const struct ProfilerZoneStats *oam = &gFrameProfile[PROFILER_ZONE_BUILD_OAM];
+
+    FrameProfiler_Latch();
+    PHANTOM_ASSERT(oam->samples != 0, "profiler-build-oam-sampled");
+    PHANTOM_ASSERT(oam->min <= oam->avg && oam->avg <= oam->max, "profiler-min-avg-max");
+    PHANTOM_ASSERT(gFrameProfile[PROFILER_ZONE_RUN_TASKS].samples != 0, "profiler-run-tasks-sampled");
+#endif
+}
+
 void PhantomTest_Run(void)
 {
     PHANTOM_CHECKPOINT("suite-start");
@@ -528,6 +772,10 @@ void PhantomTest_Run(void)
     Test_SimaEnemyShouldChase();
     Test_SimaAnimFrames();
     Test_SimaHorizInput();
+    Bench_SpriteOrder();
+    Test_HeapAllocator();
+    Test_TaskScheduler();
+    Test_FrameProfiler();
     PHANTOM_CHECKPOINT("suite-end");
     PhantomTest_Finish(gPhantomTestFailed);
 }
@@ -351,6 +351,21 @@ static void PlaceCell(u8 bg, u8 destCol, u8 destRow, u16 sheetTilesWide,
     CopyToBgTilemapBufferRect(bg, entries, destCol * 2, destRow * 2, 2, 2);
 }
 
+// Celda de arte que va en (x, y) de la sala de `floor`. Tarea 6, cambio de
+// diseño: la escalera no se pinta como tal mientras quede algún enemigo vivo
+// en el piso -- se dibuja como suelo llano y no hace nada al pisarla (ver
+// CheckStairs). SimaActors_StairsUnlocked es la ÚNICA función que decide
+// esto; aquí solo se recibe su resultado.
+static u16 GetRoomCellGfx(u8 floor, s8 x, s8 y, bool8 stairsUnlocked)
+{
+    s8 stx, sty;
+
+    SimaRoom_GetStairs(floor, &stx, &sty);
+    if (x == stx && y == sty && !stairsUnlocked)
+        return SimaRoom_GetHiddenStairsGfx(floor);
+    return SimaRoom_GetTileGfx(floor, x, y);
+}
+
 // Pinta en BG0 la sala real de `floor` leyendo SimaRoom_GetTileGfx
 // (src/sima_rooms.c) celda a celda -- el indice de la celda YA COMPUESTA
 // (fondo + objeto) en graphics/sima/tiles.png, no el SimaTile de colision
@@ -360,48 +375,37 @@ static void PlaceCell(u8 bg, u8 destCol, u8 destRow, u16 sheetTilesWide,
 static void DrawRoom(u8 floor)
 {
     s8 x, y;
-    s8 stx, sty;
     u16 sheetTilesWide = SimaRoom_GetSheetTilesWide();
-    // Tarea 6, cambio de diseño: la escalera no se pinta como tal mientras
-    // quede algún enemigo vivo en el piso -- se dibuja como suelo llano y no
-    // hace nada al pisarla (ver CheckStairs). SimaActors_StairsUnlocked es
-    // la ÚNICA función que decide esto; aquí solo se lee su resultado.
     bool8 stairsUnlocked = SimaActors_StairsUnlocked(SimaActors_GetAliveEnemyCount());
 
-    SimaRoom_GetStairs(floor, &stx, &sty);
-
     for (y = 0; y < SIMA_ROOM_H; y++)
     {
         for (x = 0; x < SIMA_ROOM_W; x++)
-        {
-            u16 tileGfx;
-            if (x == stx && y == sty && !stairsUnlocked)
-                tileGfx = SimaRoom_GetHiddenStairsGfx(floor);
-            else
-                tileGfx = SimaRoom_GetTileGfx(floor, x, y);
-            PlaceCell(0, x, y, sheetTilesWide, 0, (u8)tileGfx, 0);
-        }
+            PlaceCell(0, x, y, sheetTilesWide, 0, (u8)GetRoomCellGfx(floor, x, y, stairsUnlocked), 0);
     }
 
     sStairsVisible = stairsUnlocked;
 }
 
 // Si el estado de "escalera abierta" cambió desde el último frame, repinta
-// la sala entera para que la escalera aparezca. Esto -- no una animación,
-// no un aviso previo -- es la decisión de diseño tomada: la escalera
-// APARECE DE GOLPE al morir el último enemigo. Reutiliza DrawRoom (que ya
-// recorre las 15x10 celdas al montar el modo o cambiar de piso) en vez de
-// repintar solo la celda de la escalera: mismo resultado, sin duplicar la
-// lógica de qué gfx corresponde a cada celda. Es barato porque solo pasa
-// UNA VEZ, en el frame exacto en que cae el último enemigo.
+// la celda de la escalera para que aparezca. Esto -- no una animación, no un
+// aviso previo -- es la decisión de diseño tomada: la escalera APARECE DE
+// GOLPE al morir el último enemigo. Es la única celda que cambia, así que se
+// repinta solo esa (GetRoomCellGfx, la misma lógica que usa DrawRoom) y
+// CopyDirtyBgTilemapBufferToVram sube a VRAM solo sus dos filas de tiles en
+// vez de los 2 KB del tilemap entero.
 static void UpdateStairsVisibility(void)
 {
     bool8 unlocked = SimaActors_StairsUnlocked(SimaActors_GetAliveEnemyCount());
+    s8 stx, sty;
 
     if (unlocked != sStairsVisible)
     {
-        DrawRoom(sCurrentFloor);
-        CopyBgTilemapBufferToVram(0);
+        SimaRoom_GetStairs(sCurrentFloor, &stx, &sty);
+        PlaceCell(0, stx, sty, SimaRoom_GetSheetTilesWide(), 0,
+                  (u8)GetRoomCellGfx(sCurrentFloor, stx, sty, unlocked), 0);
+        CopyDirtyBgTilemapBufferToVram(0);
+        sStairsVisible = unlocked;
     }
 }
 
@@ -442,15 +446,21 @@ static void DrawHud(void)
         u8 cell = (i < hp) ? HUD_HEART_FULL_CELL : HUD_HEART_EMPTY_CELL;
         PlaceCell(1, HUD_HEARTS_COL_START + i, 0, HUD_HEARTS_SHEET_TILES_WIDE, 0, cell, 0);
     }
-    CopyBgTilemapBufferToVram(1);
+    // Solo las dos filas de tiles de los corazones, no el tilemap entero.
+    CopyDirtyBgTilemapBufferToVram(1);
     sHudDrawnHP = hp;
 }
 
+// Todo lo que SIMA reserva al montarse: los tilemaps de BG0 y BG1.
+#define SIMA_ARENA_SIZE (2 * BG_SCREEN_SIZE)
+
 static void SetupGraphics(void)
 {
     InitBgsFromTemplates(0, sSimaBgTemplates, ARRAY_COUNT(sSimaBgTemplates));
-    SetBgTilemapBuffer(0, AllocZeroed(BG_SCREEN_SIZE));
-    SetBgTilemapBuffer(1, AllocZeroed(BG_SCREEN_SIZE));
+    // Los dos tilemaps salen de la arena del modo (ver CB2_InitSima): no hay
+    // Free que olvidar al salir, se van enteros con la arena.
+    SetBgTilemapBuffer(0, ScreenArena_AllocZeroed(BG_SCREEN_SIZE));
+    SetBgTilemapBuffer(1, ScreenArena_AllocZeroed(BG_SCREEN_SIZE));
 
     // Graficos sin comprimir (ver graphics/sima/gen.py): copia directa a
     // VRAM, sin LZ77UnCompVram. Solo las 12 celdas de tiles.4bpp (Tarea 3),
@@ -523,6 +533,12 @@ void CB2_InitSima(void)
         // Sin este orden, DrawRoom leería 0 enemigos vivos (el .bss arranca
         // en 0) y pintaría la escalera abierta desde el primer frame.
         SimaActors_InitEnemies(sCurrentFloor);
+        // Arena de pantalla (src/malloc.c) para los buffers de SIMA: se
+        // libera en O(1) cuando SetMainCallback2 salga de CB2_SimaMain. Antes
+        // cada reentrada en CB2_InitSima (p. ej. PHANTOM_DEBUG_SIMA) perdía
+        // los dos tilemaps del montaje anterior en gHeap; ScreenArena_Open
+        // suelta primero la arena vieja.
+        ScreenArena_Open(SIMA_ARENA_SIZE, CB2_SimaMain);
         SetupGraphics();
         // SimaActors_InitPlayer vive en src/sima_actors.c y coloca el sprite
         // del jugador en el '@' de la sala (SimaRoom_GetSpawn). Las escaleras
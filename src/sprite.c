@@ -2,6 +2,7 @@
 #include "sprite.h"
 #include "main.h"
 #include "palette.h"
+#include "frame_profiler.h"
 
 #define MAX_SPRITE_COPY_REQUESTS 64
 
@@ -47,7 +48,6 @@ struct OamDimensions
 };
 
 static void UpdateOamCoords(void);
-static void BuildSpritePriorities(void);
 static void SortSprites(void);
 static void CopyMatricesToOamBuffer(void);
 static void AddSpritesToOamBuffer(void);
@@ -278,8 +278,9 @@ COMMON_DATA u32 gOamMatrixAllocBitmap = 0;
 COMMON_DATA u8 gReservedSpritePaletteCount = 0;
 
 EWRAM_DATA struct Sprite gSprites[MAX_SPRITES + 1] = {0};
-EWRAM_DATA static u16 sSpritePriorities[MAX_SPRITES] = {0};
+EWRAM_DATA static u32 sSpriteSortKeys[MAX_SPRITES] = {0};
 EWRAM_DATA static u8 sSpriteOrder[MAX_SPRITES] = {0};
+EWRAM_DATA static bool8 sSpriteOrderSorted = FALSE;
 EWRAM_DATA static bool8 sShouldProcessSpriteCopyRequests = 0;
 EWRAM_DATA static u8 sSpriteCopyRequestCount = 0;
 EWRAM_DATA static struct SpriteCopyRequest sSpriteCopyRequests[MAX_SPRITES] = {0};
@@ -308,6 +309,7 @@ void ResetSpriteData(void)
 void AnimateSprites(void)
 {
     u8 i;
+    PROFILER_BEGIN(PROFILER_ZONE_ANIMATE_SPRITES);
     for (i = 0; i < MAX_SPRITES; i++)
     {
         struct Sprite *sprite = &gSprites[i];
@@ -320,13 +322,14 @@ void AnimateSprites(void)
                 AnimateSprite(sprite);
         }
     }
+    PROFILER_END(PROFILER_ZONE_ANIMATE_SPRITES);
 }
 
 void BuildOamBuffer(void)
 {
     u8 temp;
+    PROFILER_BEGIN(PROFILER_ZONE_BUILD_OAM);
     UpdateOamCoords();
-    BuildSpritePriorities();
     SortSprites();
     temp = gMain.oamLoadDisabled;
     gMain.oamLoadDisabled = TRUE;
@@ -334,6 +337,7 @@ void BuildOamBuffer(void)
     CopyMatricesToOamBuffer();
     gMain.oamLoadDisabled = temp;
     sShouldProcessSpriteCopyRequests = TRUE;
+    PROFILER_END(PROFILER_ZONE_BUILD_OAM);
 }
 
 void UpdateOamCoords(void)
@@ -358,110 +362,93 @@ void UpdateOamCoords(void)
     }
 }
 
-void BuildSpritePriorities(void)
+// The order in which sprites are drawn: by priority (subpriority and
+// oam.priority), then from the bottom of the screen up. Y wraps at the bottom
+// of the screen, and double-size affine sprites of size 3 wrap earlier.
+static u32 GetSpriteSortKey(struct Sprite *sprite)
 {
-    u16 i;
-    for (i = 0; i < MAX_SPRITES; i++)
+    u16 priority = sprite->subpriority | (sprite->oam.priority << 8);
+    s16 y = sprite->oam.y;
+
+    if (y >= DISPLAY_HEIGHT)
+        y = y - 256;
+
+    if (sprite->oam.affineMode == ST_OAM_AFFINE_DOUBLE
+     && sprite->oam.size == ST_OAM_SIZE_3)
     {
-        struct Sprite *sprite = &gSprites[i];
-        u16 priority = sprite->subpriority | (sprite->oam.priority << 8);
-        sSpritePriorities[i] = priority;
+        u32 shape = sprite->oam.shape;
+        if (shape == ST_OAM_SQUARE || shape == ST_OAM_V_RECTANGLE)
+        {
+            if (y > 128)
+                y = y - 256;
+        }
     }
+
+    return (priority << 16) | (u16)(0x8000 - y);
 }
 
+// sSpriteOrder is kept sorted by sSpriteSortKeys from one frame to the next,
+// so only the sprites whose key changed (moved, or had their priority
+// changed) are sorted again, then merged back into the others. Ties keep the
+// previous order, which gives the same result as re-running a stable
+// insertion sort over the whole array.
 void SortSprites(void)
 {
-    u8 i;
-    for (i = 1; i < MAX_SPRITES; i++)
+    u8 i, j, k;
+    u8 cleanCount = 0;
+    u8 dirtyCount = 0;
+    u8 clean[MAX_SPRITES];
+    u8 dirty[MAX_SPRITES];
+    u8 prevPos[MAX_SPRITES];
+
+    for (i = 0; i < MAX_SPRITES; i++)
     {
-        u8 j = i;
-        struct Sprite *sprite1 = &gSprites[sSpriteOrder[i - 1]];
-        struct Sprite *sprite2 = &gSprites[sSpriteOrder[i]];
-        u16 sprite1Priority = sSpritePriorities[sSpriteOrder[i - 1]];
-        u16 sprite2Priority = sSpritePriorities[sSpriteOrder[i]];
-        s16 sprite1Y = sprite1->oam.y;
-        s16 sprite2Y = sprite2->oam.y;
+        u8 index = sSpriteOrder[i];
+        u32 key = GetSpriteSortKey(&gSprites[index]);
 
-        if (sprite1Y >= DISPLAY_HEIGHT)
-            sprite1Y = sprite1Y - 256;
+        prevPos[index] = i;
+        if (sSpriteOrderSorted && key == sSpriteSortKeys[index])
+            clean[cleanCount++] = index;
+        else
+            dirty[dirtyCount++] = index;
+        sSpriteSortKeys[index] = key;
+    }
 
-        if (sprite2Y >= DISPLAY_HEIGHT)
-            sprite2Y = sprite2Y - 256;
+    sSpriteOrderSorted = TRUE;
+    if (dirtyCount == 0)
+        return;
 
-        if (sprite1->oam.affineMode == ST_OAM_AFFINE_DOUBLE
-         && sprite1->oam.size == ST_OAM_SIZE_3)
+    for (i = 1; i < dirtyCount; i++)
+    {
+        u8 index = dirty[i];
+        u32 key = sSpriteSortKeys[index];
+
+        for (j = i; j > 0 && sSpriteSortKeys[dirty[j - 1]] > key; j--)
+            dirty[j] = dirty[j - 1];
+        dirty[j] = index;
+    }
+
+    i = 0;
+    j = 0;
+    for (k = 0; k < MAX_SPRITES; k++)
+    {
+        if (j == dirtyCount)
         {
-            u32 shape = sprite1->oam.shape;
-            if (shape == ST_OAM_SQUARE || shape == ST_OAM_V_RECTANGLE)
-            {
-                if (sprite1Y > 128)
-                    sprite1Y = sprite1Y - 256;
-            }
+            sSpriteOrder[k] = clean[i++];
         }
-
-        if (sprite2->oam.affineMode == ST_OAM_AFFINE_DOUBLE
-         && sprite2->oam.size == ST_OAM_SIZE_3)
+        else if (i == cleanCount)
         {
-            u32 shape = sprite2->oam.shape;
-            if (shape == ST_OAM_SQUARE || shape == ST_OAM_V_RECTANGLE)
-            {
-                if (sprite2Y > 128)
-                    sprite2Y = sprite2Y - 256;
-            }
+            sSpriteOrder[k] = dirty[j++];
         }
-
-        while (j > 0
-            && ((sprite1Priority > sprite2Priority)
-             || (sprite1Priority == sprite2Priority && sprite1Y < sprite2Y)))
+        else
         {
-            u8 temp = sSpriteOrder[j];
-            sSpriteOrder[j] = sSpriteOrder[j - 1];
-            sSpriteOrder[j - 1] = temp;
-
-            // UB: If j equals 1, then j-- makes j equal 0.
-            // Then, sSpriteOrder[-1] gets accessed below.
-            // Although this doesn't result in a bug in the ROM,
-            // the behavior is undefined.
-            j--;
-#ifdef UBFIX
-            if (j == 0)
-                break;
-#endif
+            u32 cleanKey = sSpriteSortKeys[clean[i]];
+            u32 dirtyKey = sSpriteSortKeys[dirty[j]];
 
-            sprite1 = &gSprites[sSpriteOrder[j - 1]];
-            sprite2 = &gSprites[sSpriteOrder[j]];
-            sprite1Priority = sSpritePriorities[sSpriteOrder[j - 1]];
-            sprite2Priority = sSpritePriorities[sSpriteOrder[j]];
-            sprite1Y = sprite1->oam.y;
-            sprite2Y = sprite2->oam.y;
-
-            if (sprite1Y >= DISPLAY_HEIGHT)
-                sprite1Y = sprite1Y - 256;
-
-            if (sprite2Y >= DISPLAY_HEIGHT)
-                sprite2Y = sprite2Y - 256;
-
-            if (sprite1->oam.affineMode == ST_OAM_AFFINE_DOUBLE
-             && sprite1->oam.size == ST_OAM_SIZE_3)
-            {
-                u32 shape = sprite1->oam.shape;
-                if (shape == ST_OAM_SQUARE || shape == ST_OAM_V_RECTANGLE)
-                {
-                    if (sprite1Y > 128)
-                        sprite1Y = sprite1Y - 256;
-                }
-            }
-
-            if (sprite2->oam.affineMode == ST_OAM_AFFINE_DOUBLE
-             && sprite2->oam.size == ST_OAM_SIZE_3)
-            {
-                u32 shape = sprite2->oam.shape;
-                if (shape == ST_OAM_SQUARE || shape == ST_OAM_V_RECTANGLE)
-                {
-                    if (sprite2Y > 128)
-                        sprite2Y = sprite2Y - 256;
-                }
-            }
+            if (dirtyKey < cleanKey || (dirtyKey == cleanKey && prevPos[dirty[j]] < prevPos[clean[i]]))
+                sSpriteOrder[k] = dirty[j++];
+            else
+                sSpriteOrder[k] = clean[i++];
         }
     }
 }
@@ -856,6 +843,7 @@ void ResetAllSprites(void)
     }
 
     ResetSprite(&gSprites[i]);
+    sSpriteOrderSorted = FALSE;
 }
 
 void FreeSpriteTiles(struct Sprite *sprite)
@@ -1,10 +1,44 @@
 #include "global.h"
 #include "task.h"
+#include "cycle_counter.h"
+#include "frame_profiler.h"
 
 COMMON_DATA struct Task gTasks[NUM_TASKS] = {0};
 
+// The active tasks form a single list sorted by priority, in creation order
+// within a priority. sHeadTaskId is its first task, and for every priority in
+// use sPriorityTails holds the last task with that priority (the bucket's
+// tail), flagged in sPriorityBits. A new task goes right after the tail of the
+// closest bucket at or below its priority, so creating, destroying and
+// starting to run tasks never walks the list.
+static u8 sHeadTaskId;
+static u16 sActiveTaskBits;
+static u32 sPriorityBits[256 / 32];
+EWRAM_DATA static u8 sPriorityTails[256] = {0};
+
+#ifndef NDEBUG
+EWRAM_DATA static struct TaskCycleStats sTaskCycleStats[NUM_TASKS] = {0};
+#endif
+
 static void InsertTask(u8 newTaskId);
-static u8 FindFirstActiveTask(void);
+static void RemoveTask(u8 taskId);
+
+static const u8 sDeBruijnHighestBit[32] =
+{
+     0,  9,  1, 10, 13, 21,  2, 29, 11, 14, 16, 18, 22, 25,  3, 30,
+     8, 12, 20, 28, 15, 17, 24,  7, 19, 27, 23,  6, 26,  5,  4, 31,
+};
+
+// Index of the highest set bit. bits must be non-zero.
+static u32 HighestSetBit(u32 bits)
+{
+    bits |= bits >> 1;
+    bits |= bits >> 2;
+    bits |= bits >> 4;
+    bits |= bits >> 8;
+    bits |= bits >> 16;
+    return sDeBruijnHighestBit[(bits * 0x07C4ACDD) >> 27];
+}
 
 void ResetTasks(void)
 {
@@ -22,62 +56,114 @@ void ResetTasks(void)
 
     gTasks[0].prev = HEAD_SENTINEL;
     gTasks[NUM_TASKS - 1].next = TAIL_SENTINEL;
+
+    sHeadTaskId = TAIL_SENTINEL;
+    sActiveTaskBits = 0;
+    for (i = 0; i < ARRAY_COUNT(sPriorityBits); i++)
+        sPriorityBits[i] = 0;
+
+#ifndef NDEBUG
+    CycleCounter_Start();
+#endif
 }
 
 u8 CreateTask(TaskFunc func, u8 priority)
 {
+    u32 freeBits = ~sActiveTaskBits & ((1 << NUM_TASKS) - 1);
     u8 i;
 
-    for (i = 0; i < NUM_TASKS; i++)
+    if (freeBits == 0)
+        return 0;
+
+    // The lowest free slot, as before.
+    i = HighestSetBit(freeBits & -freeBits);
+
+    gTasks[i].func = func;
+    gTasks[i].priority = priority;
+    InsertTask(i);
+    memset(gTasks[i].data, 0, sizeof(gTasks[i].data));
+    gTasks[i].isActive = TRUE;
+    sActiveTaskBits |= 1 << i;
+
+#ifndef NDEBUG
+    memset(&sTaskCycleStats[i], 0, sizeof(sTaskCycleStats[i]));
+#endif
+
+    return i;
+}
+
+// Returns the last task whose priority value is at most the given one, or
+// TAIL_SENTINEL if there is none.
+static u8 FindPriorityTail(u8 priority)
+{
+    s32 word = priority / 32;
+    u32 bits = sPriorityBits[word] & (0xFFFFFFFF >> (31 - priority % 32));
+
+    while (bits == 0)
     {
-        if (!gTasks[i].isActive)
-        {
-            gTasks[i].func = func;
-            gTasks[i].priority = priority;
-            InsertTask(i);
-            memset(gTasks[i].data, 0, sizeof(gTasks[i].data));
-            gTasks[i].isActive = TRUE;
-            return i;
-        }
+        if (--word < 0)
+            return TAIL_SENTINEL;
+        bits = sPriorityBits[word];
     }
 
-    return 0;
+    return sPriorityTails[word * 32 + HighestSetBit(bits)];
 }
 
 static void InsertTask(u8 newTaskId)
 {
-    u8 taskId = FindFirstActiveTask();
+    u8 priority = gTasks[newTaskId].priority;
+    u8 taskId = FindPriorityTail(priority);
 
-    if (taskId == NUM_TASKS)
+    if (taskId == TAIL_SENTINEL)
     {
-        // The new task is the only task.
+        // Every other task has a higher priority value (or there are
+        // none), so the new task becomes the head.
         gTasks[newTaskId].prev = HEAD_SENTINEL;
-        gTasks[newTaskId].next = TAIL_SENTINEL;
-        return;
+        gTasks[newTaskId].next = sHeadTaskId;
+        if (sHeadTaskId != TAIL_SENTINEL)
+            gTasks[sHeadTaskId].prev = newTaskId;
+        sHeadTaskId = newTaskId;
+    }
+    else
+    {
+        gTasks[newTaskId].prev = taskId;
+        gTasks[newTaskId].next = gTasks[taskId].next;
+        if (gTasks[taskId].next != TAIL_SENTINEL)
+            gTasks[gTasks[taskId].next].prev = newTaskId;
+        gTasks[taskId].next = newTaskId;
     }
 
-    while (1)
+    sPriorityTails[priority] = newTaskId;
+    sPriorityBits[priority / 32] |= 1 << (priority % 32);
+}
+
+static void RemoveTask(u8 taskId)
+{
+    u8 priority = gTasks[taskId].priority;
+    u8 prev = gTasks[taskId].prev;
+    u8 next = gTasks[taskId].next;
+
+    if (sPriorityTails[priority] == taskId)
     {
-        if (gTasks[newTaskId].priority < gTasks[taskId].priority)
-        {
-            // We've found a task with a higher priority value,
-            // so we insert the new task before it.
-            gTasks[newTaskId].prev = gTasks[taskId].prev;
-            gTasks[newTaskId].next = taskId;
-            if (gTasks[taskId].prev != HEAD_SENTINEL)
-                gTasks[gTasks[taskId].prev].next = newTaskId;
-            gTasks[taskId].prev = newTaskId;
-            return;
-        }
-        if (gTasks[taskId].next == TAIL_SENTINEL)
-        {
-            // We've reached the end.
-            gTasks[newTaskId].prev = taskId;
-            gTasks[newTaskId].next = gTasks[taskId].next;
-            gTasks[taskId].next = newTaskId;
-            return;
-        }
-        taskId = gTasks[taskId].next;
+        if (prev != HEAD_SENTINEL && gTasks[prev].priority == priority)
+            sPriorityTails[priority] = prev;
+        else
+            sPriorityBits[priority / 32] &= ~(1 << (priority % 32));
+    }
+
+    // The removed task keeps its next link, so a RunTasks loop that is
+    // currently running it carries on with the following task.
+    if (prev == HEAD_SENTINEL)
+    {
+        sHeadTaskId = next;
+        if (next != TAIL_SENTINEL)
+            gTasks[next].prev = HEAD_SENTINEL;
+    }
+    else
+    {
+        gTasks[prev].next = next;
+        if (next != TAIL_SENTINEL)
+            gTasks[next].prev = prev;
     }
 }
 
@@ -86,50 +172,55 @@ void DestroyTask(u8 taskId)
     if (gTasks[taskId].isActive)
     {
         gTasks[taskId].isActive = FALSE;
+        sActiveTaskBits &= ~(1 << taskId);
+        RemoveTask(taskId);
+    }
+}
 
-        if (gTasks[taskId].prev == HEAD_SENTINEL)
-        {
-            if (gTasks[taskId].next != TAIL_SENTINEL)
-                gTasks[gTasks[taskId].next].prev = HEAD_SENTINEL;
-        }
-        else
-        {
-            if (gTasks[taskId].next == TAIL_SENTINEL)
-            {
-                gTasks[gTasks[taskId].prev].next = TAIL_SENTINEL;
-            }
-            else
-            {
-                gTasks[gTasks[taskId].prev].next = gTasks[taskId].next;
-                gTasks[gTasks[taskId].next].prev = gTasks[taskId].prev;
-            }
-        }
+#ifndef NDEBUG
+static void RunTaskTimed(u8 taskId)
+{
+    struct TaskCycleStats *stats = &sTaskCycleStats[taskId];
+    TaskFunc func = gTasks[taskId].func;
+    u32 start = CycleCounter_Read();
+    u32 cycles;
+
+    func(taskId);
+    cycles = CycleCounter_Read() - start;
+
+    stats->last = cycles;
+    stats->total += cycles;
+    stats->runs++;
+    if (cycles > stats->max)
+    {
+        stats->max = cycles;
+        stats->maxFunc = func;
     }
 }
+#endif
 
 void RunTasks(void)
 {
-    u8 taskId = FindFirstActiveTask();
+    u8 taskId = sHeadTaskId;
+
+    PROFILER_BEGIN(PROFILER_ZONE_RUN_TASKS);
 
-    if (taskId != NUM_TASKS)
+    // Before the first ResetTasks the head is not set up, but no task is
+    // active either.
+    if (taskId != TAIL_SENTINEL && gTasks[taskId].isActive)
     {
         do
         {
+#ifndef NDEBUG
+            RunTaskTimed(taskId);
+#else
             gTasks[taskId].func(taskId);
+#endif
             taskId = gTasks[taskId].next;
         } while (taskId != TAIL_SENTINEL);
     }
-}
-
-static u8 FindFirstActiveTask(void)
-{
-    u8 taskId;
 
-    for (taskId = 0; taskId < NUM_TASKS; taskId++)
-        if (gTasks[taskId].isActive == TRUE && gTasks[taskId].prev == HEAD_SENTINEL)
-            break;
-
-    return taskId;
+    PROFILER_END(PROFILER_ZONE_RUN_TASKS);
 }
 
 void TaskDummy(u8 taskId)
@@ -202,3 +293,29 @@ u32 GetWordTaskArg(u8 taskId, u8 dataElem)
     else
         return 0;
 }
+
+#ifndef NDEBUG
+const struct TaskCycleStats *GetTaskCycleStats(u8 taskId)
+{
+    return &sTaskCycleStats[taskId];
+}
+
+// Reports the cycle cost of every active task over the phantom debug print
+// channel, to find the one that blows the frame budget.
+void DebugPrintTaskCycles(void)
+{
+    u8 taskId;
+
+    for (taskId = 0; taskId < NUM_TASKS; taskId++)
+    {
+        const struct TaskCycleStats *stats = &sTaskCycleStats[taskId];
+
+        if (!gTasks[taskId].isActive || stats->runs == 0)
+            continue;
+
+        DebugPrintf(":P TASK %d func=%x last=%d avg=%d max=%d maxFunc=%x runs=%d",
+                    taskId, (u32)gTasks[taskId].func, stats->last, stats->total / stats->runs,
+                    stats->max, (u32)stats->maxFunc, stats->runs);
+    }
+}
+#endif // NDEBUG
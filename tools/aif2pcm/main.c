@@ -18,12 +18,20 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#ifndef _MSC_VER
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
+#include <math.h>
 
 /* extended.c */
 void ieee754_write_extended (double, uint8_t*);
@@ -106,6 +114,31 @@ void write_bytearray(const char *filename, struct Bytes *bytes)
 	fclose(f);
 }
 
+// Leaves the file (and its mtime) alone if it already holds these bytes.
+void write_bytearray_if_changed(const char *filename, struct Bytes *bytes)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f)
+	{
+		bool same = false;
+		fseek(f, 0, SEEK_END);
+		if ((unsigned long)ftell(f) == bytes->length)
+		{
+			uint8_t *existing = malloc(bytes->length + 1);
+			fseek(f, 0, SEEK_SET);
+			same = fread(existing, 1, bytes->length, f) == bytes->length
+				&& memcmp(existing, bytes->data, bytes->length) == 0;
+			free(existing);
+		}
+		fclose(f);
+		if (same)
+		{
+			return;
+		}
+	}
+	write_bytearray(filename, bytes);
+}
+
 void free_bytearray(struct Bytes *bytes)
 {
 	free(bytes->data);
@@ -482,6 +515,22 @@ int get_delta_index(uint8_t sample, uint8_t prev_sample)
 	return best_index;
 }
 
+// get_delta_index for every (prev_sample, sample) pair. Each encoded sample
+// depends on the one decoded before it, so the encoder can't work on several
+// samples at once; instead every search becomes one table load.
+static uint8_t s_delta_index_table[256][256];
+
+void init_delta_index_table(void)
+{
+	for (int prev_sample = 0; prev_sample < 256; prev_sample++)
+	{
+		for (int sample = 0; sample < 256; sample++)
+		{
+			s_delta_index_table[prev_sample][sample] = get_delta_index(sample, prev_sample);
+		}
+	}
+}
+
 struct Bytes *delta_compress(struct Bytes *pcm)
 {
 	struct Bytes *delta = malloc(sizeof(struct Bytes));
@@ -522,7 +571,7 @@ struct Bytes *delta_compress(struct Bytes *pcm)
 		{
 			break;
 		}
-		delta_index = get_delta_index(pcm->data[i++], base);
+		delta_index = s_delta_index_table[base][pcm->data[i++]];
 		base += gDeltaEncodingTable[delta_index];
 		delta->data[j++] = delta_index;
 
@@ -532,7 +581,7 @@ struct Bytes *delta_compress(struct Bytes *pcm)
 			{
 				break;
 			}
-			delta_index = get_delta_index(pcm->data[i++], base);
+			delta_index = s_delta_index_table[base][pcm->data[i++]];
 			base += gDeltaEncodingTable[delta_index];
 			delta->data[j] = (delta_index << 4);
 
@@ -540,7 +589,7 @@ struct Bytes *delta_compress(struct Bytes *pcm)
 			{
 				break;
 			}
-			delta_index = get_delta_index(pcm->data[i++], base);
+			delta_index = s_delta_index_table[base][pcm->data[i++]];
 			base += gDeltaEncodingTable[delta_index];
 			delta->data[j++] |= delta_index;
 		}
@@ -567,8 +616,62 @@ do { \
 	(var) |= (*((src) + 3) << 24); \
 } while (0)
 
+// Decodes a .bin produced by aif2pcm the way pcm2aif would and compares it
+// with the source samples. DPCM is lossy, so for compressed data this only
+// reports how far off the samples are. delta_compress drops the last sample
+// when a block ends on a high nibble, so that is reported but tolerated; any
+// other length mismatch, or any difference in uncompressed data, is fatal.
+void verify_bin(const char *pcm_filename, struct Bytes *output, const uint8_t *samples, unsigned long num_samples)
+{
+	uint32_t flags;
+	LOAD_U32_LE(flags, output->data);
+	bool compressed = flags & 1;
+
+	struct Bytes payload = { output->length - 0x10, output->data + 0x10 };
+	struct Bytes *decoded = compressed ? delta_decompress(&payload, num_samples) : &payload;
+
+	bool dropped_last = compressed && decoded->length + 1 == num_samples && (num_samples % 64) > 2 && (num_samples % 64) % 2 == 1;
+	if (decoded->length != num_samples && !dropped_last)
+	{
+		FATAL_ERROR("%s: decoded %lu samples, but the source has %lu!\n", pcm_filename, decoded->length, num_samples);
+	}
+
+	unsigned long num_differing = 0;
+	int max_error = 0;
+	double error_squares = 0;
+	for (unsigned long i = 0; i < decoded->length; i++)
+	{
+		int error = ABS(U8_TO_S8(decoded->data[i]) - U8_TO_S8(samples[i]));
+		if (error)
+		{
+			num_differing++;
+			error_squares += (double)error * error;
+			if (error > max_error)
+			{
+				max_error = error;
+			}
+		}
+	}
+
+	if (!compressed && num_differing)
+	{
+		FATAL_ERROR("%s: %lu samples differ from the source!\n", pcm_filename, num_differing);
+	}
+
+	printf("%s: %lu samples%s, %lu differ, max error %d, rms %.2f\n",
+		pcm_filename, num_samples, dropped_last ? " (last one dropped)" : "", num_differing, max_error,
+		decoded->length ? sqrt(error_squares / decoded->length) : 0.0);
+
+	if (compressed)
+	{
+		free(decoded->data);
+		free(decoded);
+	}
+}
+
 // Reads an .aif file and produces a .pcm file containing an array of 8-bit samples.
-void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress)
+// only_if_changed keeps an existing, identical output untouched (--dir mode).
+void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress, bool verify, bool only_if_changed)
 {
 	struct Bytes *aif = read_bytearray(aif_filename);
 	AifData aif_data = {0};
@@ -619,7 +722,19 @@ void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress)
 	STORE_U32_LE(output.data + 8, loop_offset);
 	STORE_U32_LE(output.data + 12, adjusted_num_samples);
 	memcpy(&output.data[header_size], pcm->data, pcm->length);
-	write_bytearray(pcm_filename, &output);
+	if (only_if_changed)
+	{
+		write_bytearray_if_changed(pcm_filename, &output);
+	}
+	else
+	{
+		write_bytearray(pcm_filename, &output);
+	}
+
+	if (verify)
+	{
+		verify_bin(pcm_filename, &output, aif_data.samples8, aif_data.real_num_samples);
+	}
 
 	free(aif->data);
 	free(aif);
@@ -878,10 +993,217 @@ void pcm2aif(const char *pcm_filename, const char *aif_filename, uint32_t base_n
 	free(aif);
 }
 
+struct DirJob {
+	char *aif_filename;
+	char *pcm_filename;
+};
+
+struct DirOptions {
+	bool compress;
+	bool verify;
+};
+
+static void run_dir_job(struct DirJob *job, const struct DirOptions *options)
+{
+	aif2pcm(job->aif_filename, job->pcm_filename, options->compress, options->verify, true);
+}
+
+#ifdef _MSC_VER
+
+static int list_aif_files(const char *dir, struct DirJob **jobs)
+{
+	(void)dir;
+	(void)jobs;
+	FATAL_ERROR("--dir is not supported in this build.\n");
+}
+
+static void run_dir_jobs(struct DirJob *jobs, int job_count, int thread_count, const struct DirOptions *options)
+{
+	(void)thread_count;
+	for (int i = 0; i < job_count; i++)
+	{
+		run_dir_job(&jobs[i], options);
+	}
+}
+
+#else
+
+static int compare_dir_jobs(const void *a, const void *b)
+{
+	return strcmp(((const struct DirJob *)a)->aif_filename, ((const struct DirJob *)b)->aif_filename);
+}
+
+// Finds every .aif directly inside dir; each is converted to the .bin next to it.
+static int list_aif_files(const char *dir, struct DirJob **jobs)
+{
+	DIR *d = opendir(dir);
+	if (!d)
+	{
+		FATAL_ERROR("Failed to open directory '%s'!\n", dir);
+	}
+
+	int job_count = 0;
+	int capacity = 0;
+	struct dirent *entry;
+	*jobs = NULL;
+
+	while ((entry = readdir(d)) != NULL)
+	{
+		char *extension = get_file_extension(entry->d_name);
+		if (!extension || strcmp(extension, "aif") != 0)
+		{
+			continue;
+		}
+
+		if (job_count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			*jobs = realloc(*jobs, capacity * sizeof(struct DirJob));
+			if (!*jobs)
+			{
+				FATAL_ERROR("Failed to allocate memory for jobs!\n");
+			}
+		}
+
+		char *aif_filename = malloc(strlen(dir) + 1 + strlen(entry->d_name) + 1);
+		sprintf(aif_filename, "%s/%s", dir, entry->d_name);
+		(*jobs)[job_count].aif_filename = aif_filename;
+		(*jobs)[job_count].pcm_filename = new_file_extension(aif_filename, "bin");
+		job_count++;
+	}
+
+	closedir(d);
+	qsort(*jobs, job_count, sizeof(struct DirJob), compare_dir_jobs);
+	return job_count;
+}
+
+struct DirQueue {
+	struct DirJob *jobs;
+	int job_count;
+	int next_job;
+	const struct DirOptions *options;
+	pthread_mutex_t lock;
+};
+
+static void *dir_worker(void *arg)
+{
+	struct DirQueue *queue = arg;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&queue->lock);
+		int job = queue->next_job++;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (job >= queue->job_count)
+		{
+			return NULL;
+		}
+
+		run_dir_job(&queue->jobs[job], queue->options);
+	}
+}
+
+static void run_dir_jobs(struct DirJob *jobs, int job_count, int thread_count, const struct DirOptions *options)
+{
+	struct DirQueue queue;
+	pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+
+	if (!threads)
+	{
+		FATAL_ERROR("Failed to allocate memory for threads!\n");
+	}
+
+	queue.jobs = jobs;
+	queue.job_count = job_count;
+	queue.next_job = 0;
+	queue.options = options;
+	pthread_mutex_init(&queue.lock, NULL);
+
+	for (int i = 0; i < thread_count; i++)
+	{
+		if (pthread_create(&threads[i], NULL, dir_worker, &queue) != 0)
+		{
+			FATAL_ERROR("Failed to create thread!\n");
+		}
+	}
+
+	for (int i = 0; i < thread_count; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&queue.lock);
+	free(threads);
+}
+
+#endif // _MSC_VER
+
 void usage(void)
 {
 	fprintf(stderr, "Usage: aif2pcm bin_file [aif_file]\n");
-	fprintf(stderr, "       aif2pcm aif_file [bin_file] [--compress]\n");
+	fprintf(stderr, "       aif2pcm aif_file [bin_file] [--compress] [--verify]\n");
+	fprintf(stderr, "       aif2pcm --dir dir [--compress] [--verify] [-j threads]\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "--verify decodes each .bin again and reports how it differs from the .aif.\n");
+	fprintf(stderr, "--dir converts every dir/*.aif to the .bin next to it on all cores,\n");
+	fprintf(stderr, "leaving .bin files that didn't change untouched.\n");
+}
+
+// aif2pcm --dir DIR [--compress] [--verify] [-j N]
+static void handle_dir_command(int argc, char **argv)
+{
+	struct DirOptions options = { false, false };
+	int thread_count = 0;
+
+	for (int i = 3; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--compress") == 0)
+		{
+			options.compress = true;
+		}
+		else if (strcmp(argv[i], "--verify") == 0)
+		{
+			options.verify = true;
+		}
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+		{
+			thread_count = atoi(argv[++i]);
+		}
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (thread_count <= 0)
+	{
+#ifdef _SC_NPROCESSORS_ONLN
+		thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (thread_count < 1)
+		{
+			thread_count = 1;
+		}
+	}
+
+	struct DirJob *jobs;
+	int job_count = list_aif_files(argv[2], &jobs);
+
+	if (thread_count > job_count)
+	{
+		thread_count = job_count ? job_count : 1;
+	}
+
+	run_dir_jobs(jobs, job_count, thread_count, &options);
+
+	for (int i = 0; i < job_count; i++)
+	{
+		free(jobs[i].aif_filename);
+		free(jobs[i].pcm_filename);
+	}
+	free(jobs);
 }
 
 int main(int argc, char **argv)
@@ -892,10 +1214,24 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	init_delta_index_table();
+
+	if (strcmp(argv[1], "--dir") == 0)
+	{
+		if (argc < 3)
+		{
+			usage();
+			exit(1);
+		}
+		handle_dir_command(argc, argv);
+		return 0;
+	}
+
 	char *input_file = argv[1];
 	char *extension = get_file_extension(input_file);
 	char *output_file;
 	bool compressed = false;
+	bool verify = false;
 
 	if (argc > 3)
 	{
@@ -905,20 +1241,23 @@ int main(int argc, char **argv)
 			{
 				compressed = true;
 			}
+			else if (strcmp(argv[i], "--verify") == 0)
+			{
+				verify = true;
+			}
 		}
 	}
-
 	if (strcmp(extension, "aif") == 0 || strcmp(extension, "aiff") == 0)
 	{
 		if (argc >= 3)
 		{
 			output_file = argv[2];
-			aif2pcm(input_file, output_file, compressed);
+			aif2pcm(input_file, output_file, compressed, verify, false);
 		}
 		else
 		{
 			output_file = new_file_extension(input_file, "bin");
-			aif2pcm(input_file, output_file, compressed);
+			aif2pcm(input_file, output_file, compressed, verify, false);
 			free(output_file);
 		}
 	}
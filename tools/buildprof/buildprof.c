@@ -0,0 +1,1363 @@
+// buildprof: build-time profiling for the asset/code pipeline.
+//
+//   buildprof run -- COMMAND [ARGS...]
+//       Runs COMMAND and appends one record to the trace named by
+//       $BUILDPROF_TRACE: start time, wall and CPU time, bytes read and
+//       written, the tool (basename of COMMAND) and the make target
+//       ($BUILDPROF_TARGET). The exit status of COMMAND is passed through.
+//
+//   buildprof summary TRACE [-n N] [-o OUT.json]
+//       Prints the N slowest targets and per-tool totals, and writes the
+//       trace in Chrome trace-event format (chrome://tracing, Perfetto).
+//
+//   buildprof graph DATABASE [-t TRACE] [-n N] [-o OUT.dot]
+//       Reads the target DAG from a `make -p` database ("-" for stdin),
+//       weights each target by its latest duration in TRACE (or by one per
+//       command without a trace), prints the critical path and the N headers
+//       that the most object files depend on, and writes the DAG as DOT.
+//
+// Bytes in/out are counted from the file arguments of the command (files
+// that existed before it ran are inputs, files it wrote are outputs) plus
+// whatever flows through stdin/stdout when they are pipes, which is how
+// cpp | preproc | cc1 | as pass data along.
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#include <sys/stat.h>
+#include <windows.h>
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FATAL_ERROR(format, ...)           \
+do {                                       \
+    fprintf(stderr, format, ##__VA_ARGS__); \
+    exit(1);                               \
+} while (0)
+
+struct Record
+{
+    int64_t start;  // microseconds since the epoch
+    int64_t wall;   // microseconds
+    int64_t cpu;    // microseconds, user + system
+    int64_t bytesIn;
+    int64_t bytesOut;
+    long pid;
+    char *tool;
+    char *target;
+};
+
+static int64_t NowMicros(void)
+{
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    int64_t t = ((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return t / 10 - 11644473600000000LL;
+#endif
+}
+
+static const char *BaseName(const char *path)
+{
+    const char *base = path;
+
+    for (const char *p = path; *p; p++)
+        if (*p == '/' || *p == '\\')
+            base = p + 1;
+
+    return base;
+}
+
+// ---------------------------------------------------------------------------
+// run
+// ---------------------------------------------------------------------------
+
+struct FileArg
+{
+    const char *path;
+    bool existed;
+    int64_t size;
+    int64_t mtime;
+};
+
+static bool StatRegular(const char *path, struct stat *st)
+{
+    return path[0] != 0 && path[0] != '-' && stat(path, st) == 0 && S_ISREG(st->st_mode);
+}
+
+static int64_t MTimeMicros(const struct stat *st)
+{
+#ifndef _WIN32
+    return (int64_t)st->st_mtim.tv_sec * 1000000 + st->st_mtim.tv_nsec / 1000;
+#else
+    return (int64_t)st->st_mtime * 1000000;
+#endif
+}
+
+// Snapshots every argument that names a regular file before the command runs.
+static struct FileArg *ScanFileArgs(char **args, int count)
+{
+    struct FileArg *files = calloc(count, sizeof(*files));
+
+    if (files == NULL)
+        FATAL_ERROR("error: out of memory\n");
+
+    for (int i = 0; i < count; i++)
+    {
+        struct stat st;
+        files[i].path = args[i];
+        files[i].existed = StatRegular(args[i], &st);
+        files[i].size = files[i].existed ? st.st_size : 0;
+        files[i].mtime = files[i].existed ? MTimeMicros(&st) : 0;
+    }
+
+    return files;
+}
+
+// Files the command created or modified count as output, everything else that
+// existed beforehand as input. The make target is always checked too, since
+// some rules write it without naming it as a plain argument.
+static void CountFileBytes(struct FileArg *files, int count, const char *target, int64_t start, int64_t *bytesIn, int64_t *bytesOut)
+{
+    bool targetSeen = false;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct stat st;
+        bool written = StatRegular(files[i].path, &st)
+            && (!files[i].existed || MTimeMicros(&st) != files[i].mtime || st.st_size != files[i].size);
+
+        // An up-to-date target left alone by the tool is neither.
+        if (target != NULL && strcmp(files[i].path, target) == 0)
+        {
+            if (targetSeen || !written)
+                continue;
+            targetSeen = true;
+        }
+
+        if (written)
+            *bytesOut += st.st_size;
+        else if (files[i].existed)
+            *bytesIn += files[i].size;
+    }
+
+    if (target != NULL && !targetSeen)
+    {
+        struct stat st;
+        if (StatRegular(target, &st) && MTimeMicros(&st) >= start)
+            *bytesOut += st.st_size;
+    }
+}
+
+static void AppendRecord(const char *tracePath, const struct Record *record)
+{
+    char line[4096];
+    int length = snprintf(line, sizeof(line), "%lld\t%lld\t%lld\t%lld\t%lld\t%ld\t%s\t%s\n",
+        (long long)record->start, (long long)record->wall, (long long)record->cpu,
+        (long long)record->bytesIn, (long long)record->bytesOut, record->pid,
+        record->tool, record->target);
+
+    if (length < 0 || (size_t)length >= sizeof(line))
+        return;
+
+    // Parallel make runs many wrappers at once; one O_APPEND write per record
+    // keeps their lines from interleaving.
+#ifndef _WIN32
+    int fd = open(tracePath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "buildprof: warning: can't open trace \"%s\": %s\n", tracePath, strerror(errno));
+        return;
+    }
+
+    if (write(fd, line, length) != length)
+        fprintf(stderr, "buildprof: warning: short write to \"%s\"\n", tracePath);
+
+    close(fd);
+#else
+    FILE *fp = fopen(tracePath, "ab");
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "buildprof: warning: can't open trace \"%s\"\n", tracePath);
+        return;
+    }
+
+    fwrite(line, 1, length, fp);
+    fclose(fp);
+#endif
+}
+
+#ifndef _WIN32
+
+struct Relay
+{
+    int from;
+    int to;
+    int64_t bytes;
+};
+
+static void *RelayThread(void *arg)
+{
+    struct Relay *relay = arg;
+    char buffer[65536];
+
+    for (;;)
+    {
+        ssize_t count = read(relay->from, buffer, sizeof(buffer));
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+
+        relay->bytes += count;
+
+        for (ssize_t done = 0; done < count;)
+        {
+            ssize_t written = write(relay->to, buffer + done, count - done);
+
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                goto out;
+            done += written;
+        }
+    }
+
+out:
+    close(relay->to);
+    return NULL;
+}
+
+static bool IsPipe(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+// Only commands told to read stdin ("-", or preproc's "-i"/"-ie") get it
+// relayed; anything else leaves make's stdin alone for whoever reads it.
+static bool ReadsStdin(char **args)
+{
+    for (int i = 1; args[i] != NULL; i++)
+        if (strcmp(args[i], "-") == 0 || strcmp(args[i], "-i") == 0 || strcmp(args[i], "-ie") == 0)
+            return true;
+
+    return false;
+}
+
+// Runs the command, relaying stdin/stdout through counting threads when they
+// are pipes. Returns the wait status.
+static int RunCommand(char **args, int64_t *pipeIn, int64_t *pipeOut, int64_t *cpu)
+{
+    bool relayIn = IsPipe(STDIN_FILENO) && ReadsStdin(args);
+    bool relayOut = IsPipe(STDOUT_FILENO);
+    int inPipe[2] = { -1, -1 };
+    int outPipe[2] = { -1, -1 };
+
+    if ((relayIn && pipe(inPipe) != 0) || (relayOut && pipe(outPipe) != 0))
+        FATAL_ERROR("buildprof: pipe failed: %s\n", strerror(errno));
+
+    fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid < 0)
+        FATAL_ERROR("buildprof: fork failed: %s\n", strerror(errno));
+
+    if (pid == 0)
+    {
+        if (relayIn)
+        {
+            dup2(inPipe[0], STDIN_FILENO);
+            close(inPipe[0]);
+            close(inPipe[1]);
+        }
+        if (relayOut)
+        {
+            dup2(outPipe[1], STDOUT_FILENO);
+            close(outPipe[0]);
+            close(outPipe[1]);
+        }
+        execvp(args[0], args);
+        fprintf(stderr, "buildprof: failed to run \"%s\": %s\n", args[0], strerror(errno));
+        _exit(127);
+    }
+
+    // A reader that goes away should end the relay, not the wrapper.
+    signal(SIGPIPE, SIG_IGN);
+
+    struct Relay inRelay = { STDIN_FILENO, inPipe[1], 0 };
+    struct Relay outRelay = { outPipe[0], STDOUT_FILENO, 0 };
+    pthread_t inThread;
+
+    if (relayIn)
+    {
+        close(inPipe[0]);
+        if (pthread_create(&inThread, NULL, RelayThread, &inRelay) != 0)
+            FATAL_ERROR("buildprof: failed to start relay thread\n");
+    }
+
+    if (relayOut)
+    {
+        close(outPipe[1]);
+        outRelay.to = dup(STDOUT_FILENO);
+        RelayThread(&outRelay);
+    }
+
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            FATAL_ERROR("buildprof: waitpid failed: %s\n", strerror(errno));
+    }
+
+    // The child is gone, so nothing reads what's left of our stdin; don't
+    // wait for its writer to finish.
+    if (relayIn)
+    {
+        pthread_cancel(inThread);
+        pthread_join(inThread, NULL);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    *cpu = (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    *pipeIn = inRelay.bytes;
+    *pipeOut = outRelay.bytes;
+    return status;
+}
+
+#else
+
+static int RunCommand(char **args, int64_t *pipeIn, int64_t *pipeOut, int64_t *cpu)
+{
+    *pipeIn = 0;
+    *pipeOut = 0;
+    *cpu = 0;
+
+    intptr_t result = _spawnvp(_P_WAIT, args[0], (const char *const *)args);
+
+    if (result < 0)
+        FATAL_ERROR("buildprof: failed to run \"%s\"\n", args[0]);
+
+    return (int)result << 8;
+}
+
+#endif
+
+static int Run(int argc, char **argv)
+{
+    int first = 2;
+
+    if (first < argc && strcmp(argv[first], "--") == 0)
+        first++;
+
+    if (first >= argc)
+        FATAL_ERROR("Usage: buildprof run -- COMMAND [ARGS...]\n");
+
+    char **args = argv + first;
+    int count = argc - first;
+    const char *tracePath = getenv("BUILDPROF_TRACE");
+    const char *target = getenv("BUILDPROF_TARGET");
+
+    if (target != NULL && target[0] == 0)
+        target = NULL;
+
+    struct FileArg *files = ScanFileArgs(args + 1, count - 1);
+    struct Record record;
+    int64_t pipeIn, pipeOut;
+
+    record.start = NowMicros();
+    int status = RunCommand(args, &pipeIn, &pipeOut, &record.cpu);
+    record.wall = NowMicros() - record.start;
+    record.bytesIn = pipeIn;
+    record.bytesOut = pipeOut;
+    CountFileBytes(files, count - 1, target, record.start, &record.bytesIn, &record.bytesOut);
+#ifndef _WIN32
+    record.pid = (long)getpid();
+#else
+    record.pid = (long)_getpid();
+#endif
+    record.tool = (char *)BaseName(args[0]);
+    // $(shell ...) calls during parsing have no target; name them after
+    // the last non-option argument instead.
+    record.target = (char *)target;
+    for (int i = count - 1; record.target == NULL && i > 0; i--)
+        if (args[i][0] != '-')
+            record.target = args[i];
+    if (record.target == NULL)
+        record.target = "(pipe)";
+
+    if (tracePath != NULL && tracePath[0] != 0)
+        AppendRecord(tracePath, &record);
+
+    free(files);
+
+#ifndef _WIN32
+    if (WIFSIGNALED(status))
+    {
+        signal(WTERMSIG(status), SIG_DFL);
+        raise(WTERMSIG(status));
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+#else
+    return status >> 8;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// summary
+// ---------------------------------------------------------------------------
+
+struct RecordList
+{
+    struct Record *items;
+    size_t count;
+    size_t capacity;
+};
+
+struct ToolTotal
+{
+    const char *tool;
+    int count;
+    int64_t wall;
+    int64_t cpu;
+    int64_t bytesIn;
+    int64_t bytesOut;
+};
+
+static char *Duplicate(const char *s, size_t length)
+{
+    char *copy = malloc(length + 1);
+
+    if (copy == NULL)
+        FATAL_ERROR("error: out of memory\n");
+
+    memcpy(copy, s, length);
+    copy[length] = 0;
+    return copy;
+}
+
+static bool ParseRecord(char *line, struct Record *record)
+{
+    char *fields[8];
+    int count = 0;
+    char *p = line;
+
+    fields[count++] = p;
+    while (*p && count < 8)
+    {
+        if (*p == '\t')
+        {
+            *p = 0;
+            fields[count++] = p + 1;
+        }
+        p++;
+    }
+
+    if (count != 8)
+        return false;
+
+    size_t length = strcspn(fields[7], "\r\n");
+    record->start = strtoll(fields[0], NULL, 10);
+    record->wall = strtoll(fields[1], NULL, 10);
+    record->cpu = strtoll(fields[2], NULL, 10);
+    record->bytesIn = strtoll(fields[3], NULL, 10);
+    record->bytesOut = strtoll(fields[4], NULL, 10);
+    record->pid = strtol(fields[5], NULL, 10);
+    record->tool = Duplicate(fields[6], strlen(fields[6]));
+    record->target = Duplicate(fields[7], length);
+    return true;
+}
+
+static void ReadTrace(const char *path, struct RecordList *list)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == NULL)
+        FATAL_ERROR("error: failed to open \"%s\" for reading\n", path);
+
+    char line[4096];
+    int lineNum = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        struct Record record;
+        lineNum++;
+
+        if (!ParseRecord(line, &record))
+        {
+            fprintf(stderr, "buildprof: warning: %s:%d: malformed record skipped\n", path, lineNum);
+            continue;
+        }
+
+        if (list->count == list->capacity)
+        {
+            list->capacity = list->capacity ? list->capacity * 2 : 1024;
+            list->items = realloc(list->items, list->capacity * sizeof(*list->items));
+            if (list->items == NULL)
+                FATAL_ERROR("error: out of memory\n");
+        }
+
+        list->items[list->count++] = record;
+    }
+
+    fclose(fp);
+}
+
+static int CompareWallDesc(const void *a, const void *b)
+{
+    const struct Record *ra = a;
+    const struct Record *rb = b;
+    return (ra->wall < rb->wall) - (ra->wall > rb->wall);
+}
+
+static int CompareStart(const void *a, const void *b)
+{
+    const struct Record *ra = a;
+    const struct Record *rb = b;
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+static int CompareToolWallDesc(const void *a, const void *b)
+{
+    const struct ToolTotal *ta = a;
+    const struct ToolTotal *tb = b;
+    return (ta->wall < tb->wall) - (ta->wall > tb->wall);
+}
+
+static void PrintJsonString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+
+    for (; *s; s++)
+    {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+
+    fputc('"', fp);
+}
+
+// Each record becomes a complete ("X") event. Records are packed onto the
+// fewest lanes (tids) that keep overlapping commands apart, so the viewer
+// shows how busy the parallel make jobs were at any moment.
+static void WriteChromeTrace(const char *path, struct RecordList *list)
+{
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL)
+        FATAL_ERROR("error: failed to open \"%s\" for writing\n", path);
+
+    qsort(list->items, list->count, sizeof(*list->items), CompareStart);
+
+    int64_t origin = list->count ? list->items[0].start : 0;
+    int64_t *laneEnds = NULL;
+    size_t laneCount = 0;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    for (size_t i = 0; i < list->count; i++)
+    {
+        const struct Record *r = &list->items[i];
+        size_t lane;
+
+        for (lane = 0; lane < laneCount; lane++)
+            if (laneEnds[lane] <= r->start)
+                break;
+
+        if (lane == laneCount)
+        {
+            laneEnds = realloc(laneEnds, ++laneCount * sizeof(*laneEnds));
+            if (laneEnds == NULL)
+                FATAL_ERROR("error: out of memory\n");
+        }
+
+        laneEnds[lane] = r->start + r->wall;
+
+        fprintf(fp, "{\"name\":");
+        PrintJsonString(fp, r->target);
+        fprintf(fp, ",\"cat\":");
+        PrintJsonString(fp, r->tool);
+        fprintf(fp, ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%zu,"
+                    "\"args\":{\"cpu_us\":%lld,\"bytes_in\":%lld,\"bytes_out\":%lld,\"os_pid\":%ld}},\n",
+            (long long)(r->start - origin), (long long)r->wall, lane,
+            (long long)r->cpu, (long long)r->bytesIn, (long long)r->bytesOut, r->pid);
+    }
+
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"make\"}}\n]}\n");
+    fclose(fp);
+    free(laneEnds);
+}
+
+static int Summary(int argc, char **argv)
+{
+    const char *tracePath = NULL;
+    const char *jsonPath = NULL;
+    int topCount = 20;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            topCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (tracePath == NULL && argv[i][0] != '-')
+            tracePath = argv[i];
+        else
+            FATAL_ERROR("error: unrecognized argument \"%s\"\n", argv[i]);
+    }
+
+    if (tracePath == NULL)
+        FATAL_ERROR("Usage: buildprof summary TRACE [-n N] [-o OUT.json]\n");
+
+    struct RecordList list = { NULL, 0, 0 };
+    ReadTrace(tracePath, &list);
+
+    if (list.count == 0)
+        FATAL_ERROR("error: no records in \"%s\"\n", tracePath);
+
+    // Per-tool totals.
+    struct ToolTotal *totals = calloc(list.count, sizeof(*totals));
+    size_t toolCount = 0;
+    int64_t first = INT64_MAX, last = 0, cpuTotal = 0;
+
+    if (totals == NULL)
+        FATAL_ERROR("error: out of memory\n");
+
+    for (size_t i = 0; i < list.count; i++)
+    {
+        const struct Record *r = &list.items[i];
+        size_t t;
+
+        for (t = 0; t < toolCount; t++)
+            if (strcmp(totals[t].tool, r->tool) == 0)
+                break;
+
+        if (t == toolCount)
+            totals[toolCount++].tool = r->tool;
+
+        totals[t].count++;
+        totals[t].wall += r->wall;
+        totals[t].cpu += r->cpu;
+        totals[t].bytesIn += r->bytesIn;
+        totals[t].bytesOut += r->bytesOut;
+
+        if (r->start < first)
+            first = r->start;
+        if (r->start + r->wall > last)
+            last = r->start + r->wall;
+        cpuTotal += r->cpu;
+    }
+
+    qsort(totals, toolCount, sizeof(*totals), CompareToolWallDesc);
+    qsort(list.items, list.count, sizeof(*list.items), CompareWallDesc);
+
+    printf("%zu commands, %.2f s elapsed, %.2f s CPU\n\n",
+        list.count, (last - first) / 1e6, cpuTotal / 1e6);
+
+    printf("Slowest %d targets:\n", topCount);
+    printf("%10s %10s %10s %10s  %-12s %s\n", "wall ms", "cpu ms", "in KiB", "out KiB", "tool", "target");
+
+    for (size_t i = 0; i < list.count && (int)i < topCount; i++)
+    {
+        const struct Record *r = &list.items[i];
+        printf("%10.1f %10.1f %10.1f %10.1f  %-12s %s\n",
+            r->wall / 1e3, r->cpu / 1e3, r->bytesIn / 1024.0, r->bytesOut / 1024.0, r->tool, r->target);
+    }
+
+    printf("\nPer tool:\n");
+    printf("%8s %10s %10s %10s %10s  %s\n", "runs", "wall ms", "cpu ms", "in KiB", "out KiB", "tool");
+
+    for (size_t t = 0; t < toolCount; t++)
+    {
+        printf("%8d %10.1f %10.1f %10.1f %10.1f  %s\n",
+            totals[t].count, totals[t].wall / 1e3, totals[t].cpu / 1e3,
+            totals[t].bytesIn / 1024.0, totals[t].bytesOut / 1024.0, totals[t].tool);
+    }
+
+    if (jsonPath != NULL)
+    {
+        WriteChromeTrace(jsonPath, &list);
+        printf("\nChrome trace written to %s\n", jsonPath);
+    }
+
+    for (size_t i = 0; i < list.count; i++)
+    {
+        free(list.items[i].tool);
+        free(list.items[i].target);
+    }
+    free(list.items);
+    free(totals);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// graph
+// ---------------------------------------------------------------------------
+
+struct GraphNode
+{
+    char *name;
+    int *prereqs;
+    int prereqCount;
+    int prereqCapacity;
+    bool hasRecipe;
+    bool phony;
+    bool measured;
+    bool critical;
+    int64_t duration;   // microseconds of the latest measured run
+    int64_t weight;     // duration, or one per command when nothing was measured
+    int64_t finish;     // longest weighted chain ending at this node
+    int longestPrereq;  // prerequisite on that chain, or -1
+    int state;          // 0 = not visited, 1 = on the DFS stack, 2 = done
+};
+
+struct Graph
+{
+    struct GraphNode *nodes;
+    int count;
+    int capacity;
+    int *buckets;       // node index + 1, 0 = empty
+    size_t bucketCount;
+};
+
+static uint64_t HashName(const char *s, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ (unsigned char)s[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
+static int FindNode(struct Graph *graph, const char *name, size_t length)
+{
+    if (graph->bucketCount == 0)
+        return -1;
+
+    size_t mask = graph->bucketCount - 1;
+
+    for (size_t b = HashName(name, length) & mask; graph->buckets[b] != 0; b = (b + 1) & mask)
+    {
+        const char *other = graph->nodes[graph->buckets[b] - 1].name;
+
+        if (strncmp(other, name, length) == 0 && other[length] == 0)
+            return graph->buckets[b] - 1;
+    }
+
+    return -1;
+}
+
+static int AddNode(struct Graph *graph, const char *name, size_t length)
+{
+    int index = FindNode(graph, name, length);
+
+    if (index >= 0)
+        return index;
+
+    if ((size_t)(graph->count + 1) * 2 > graph->bucketCount)
+    {
+        size_t bucketCount = graph->bucketCount ? graph->bucketCount * 2 : 4096;
+        int *buckets = calloc(bucketCount, sizeof(*buckets));
+
+        if (buckets == NULL)
+            FATAL_ERROR("error: out of memory\n");
+
+        for (int i = 0; i < graph->count; i++)
+        {
+            const char *s = graph->nodes[i].name;
+            size_t b = HashName(s, strlen(s)) & (bucketCount - 1);
+
+            while (buckets[b] != 0)
+                b = (b + 1) & (bucketCount - 1);
+            buckets[b] = i + 1;
+        }
+
+        free(graph->buckets);
+        graph->buckets = buckets;
+        graph->bucketCount = bucketCount;
+    }
+
+    if (graph->count == graph->capacity)
+    {
+        graph->capacity = graph->capacity ? graph->capacity * 2 : 4096;
+        graph->nodes = realloc(graph->nodes, graph->capacity * sizeof(*graph->nodes));
+        if (graph->nodes == NULL)
+            FATAL_ERROR("error: out of memory\n");
+    }
+
+    index = graph->count++;
+    memset(&graph->nodes[index], 0, sizeof(graph->nodes[index]));
+    graph->nodes[index].name = Duplicate(name, length);
+    graph->nodes[index].longestPrereq = -1;
+
+    size_t b = HashName(name, length) & (graph->bucketCount - 1);
+
+    while (graph->buckets[b] != 0)
+        b = (b + 1) & (graph->bucketCount - 1);
+    graph->buckets[b] = index + 1;
+
+    return index;
+}
+
+static void AddPrereq(struct Graph *graph, int target, int prereq)
+{
+    struct GraphNode *node = &graph->nodes[target];
+
+    if (node->prereqCount == node->prereqCapacity)
+    {
+        node->prereqCapacity = node->prereqCapacity ? node->prereqCapacity * 2 : 8;
+        node->prereqs = realloc(node->prereqs, node->prereqCapacity * sizeof(*node->prereqs));
+        if (node->prereqs == NULL)
+            FATAL_ERROR("error: out of memory\n");
+    }
+
+    node->prereqs[node->prereqCount++] = prereq;
+}
+
+static char *ReadAll(const char *path)
+{
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+
+    if (fp == NULL)
+        FATAL_ERROR("error: failed to open \"%s\" for reading\n", path);
+
+    size_t size = 0;
+    size_t capacity = 1 << 20;
+    char *text = malloc(capacity);
+
+    for (;;)
+    {
+        if (text == NULL)
+            FATAL_ERROR("error: out of memory\n");
+
+        size += fread(text + size, 1, capacity - size - 1, fp);
+
+        if (size < capacity - 1)
+            break;
+
+        capacity *= 2;
+        text = realloc(text, capacity);
+    }
+
+    text[size] = 0;
+
+    if (fp != stdin)
+        fclose(fp);
+
+    return text;
+}
+
+// Reads the "# Files" section of a `make -p` database. Every file entry is a
+// "target: prerequisites | order-only" line followed by "#" notes, and that
+// includes the prerequisites make got from scaninc's .d files and from the
+// pattern rules it matched. Only the last database counts, since sub-makes
+// run while parsing the Makefile print their own first.
+static void ParseMakeDatabase(char *text, struct Graph *graph)
+{
+    char *files = NULL;
+
+    for (char *p = strstr(text, "\n# Files\n"); p != NULL; p = strstr(p + 1, "\n# Files\n"))
+        files = p + strlen("\n# Files\n");
+
+    if (files == NULL)
+        FATAL_ERROR("error: no \"# Files\" section in the make database (run make with -p)\n");
+
+    char *end = strstr(files, "\n# files hash-table stats:");
+
+    if (end != NULL)
+        *end = 0;
+
+    bool notATarget = false;
+    int current = -1;
+
+    for (char *line = files; line != NULL && *line != 0; )
+    {
+        char *next = strchr(line, '\n');
+
+        if (next != NULL)
+            *next++ = 0;
+
+        if (line[0] == 0)
+        {
+            current = -1;
+        }
+        else if (line[0] == '#')
+        {
+            if (strncmp(line, "# Not a target:", 15) == 0)
+                notATarget = true;
+            else if (current >= 0 && strncmp(line, "#  recipe to execute", 20) == 0)
+                graph->nodes[current].hasRecipe = true;
+            else if (current >= 0 && strncmp(line, "#  Phony target", 15) == 0)
+                graph->nodes[current].phony = true;
+        }
+        else if (line[0] != '\t' && line[0] != ' ')
+        {
+            char *colon = strchr(line, ':');
+
+            if (colon != NULL && !notATarget && line[0] != '.' && memchr(line, '%', colon - line) == NULL)
+            {
+                current = AddNode(graph, line, colon - line);
+
+                for (char *p = colon + 1; ; )
+                {
+                    while (*p == ':' || *p == ' ')
+                        p++;
+
+                    if (*p == 0)
+                        break;
+
+                    char *start = p;
+
+                    while (*p != 0 && *p != ' ')
+                        p++;
+
+                    if (p - start != 1 || *start != '|')
+                        AddPrereq(graph, current, AddNode(graph, start, p - start));
+                }
+            }
+
+            notATarget = false;
+        }
+
+        line = next;
+    }
+}
+
+static int CompareTargetStart(const void *a, const void *b)
+{
+    const struct Record *ra = a;
+    const struct Record *rb = b;
+    int order = strcmp(ra->target, rb->target);
+
+    if (order != 0)
+        return order;
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+// A target's commands (cpp | preproc | cc1 | as) overlap in time; since the
+// trace accumulates across builds, only the last group of overlapping
+// commands of each target is taken as its duration.
+static int ApplyTrace(struct Graph *graph, struct RecordList *list)
+{
+    int measured = 0;
+
+    qsort(list->items, list->count, sizeof(*list->items), CompareTargetStart);
+
+    for (size_t i = 0; i < list->count; )
+    {
+        const char *target = list->items[i].target;
+        int64_t start = list->items[i].start;
+        int64_t end = start + list->items[i].wall;
+
+        for (i++; i < list->count && strcmp(list->items[i].target, target) == 0; i++)
+        {
+            const struct Record *r = &list->items[i];
+
+            if (r->start > end)
+            {
+                start = r->start;
+                end = r->start + r->wall;
+            }
+            else if (r->start + r->wall > end)
+            {
+                end = r->start + r->wall;
+            }
+        }
+
+        int index = FindNode(graph, target, strlen(target));
+
+        if (index >= 0)
+        {
+            graph->nodes[index].duration = end - start;
+            graph->nodes[index].measured = true;
+            measured++;
+        }
+    }
+
+    return measured;
+}
+
+// Longest weighted chain of prerequisites ending at each node.
+static void ComputeFinish(struct Graph *graph, int index)
+{
+    struct GraphNode *node = &graph->nodes[index];
+
+    if (node->state == 2)
+        return;
+
+    if (node->state == 1)
+    {
+        fprintf(stderr, "buildprof: warning: dependency cycle through \"%s\" ignored\n", node->name);
+        return;
+    }
+
+    node->state = 1;
+
+    int64_t longest = 0;
+
+    for (int i = 0; i < node->prereqCount; i++)
+    {
+        int prereq = node->prereqs[i];
+
+        ComputeFinish(graph, prereq);
+        node = &graph->nodes[index];
+
+        if (graph->nodes[prereq].state == 2 && graph->nodes[prereq].finish > longest)
+        {
+            longest = graph->nodes[prereq].finish;
+            node->longestPrereq = prereq;
+        }
+    }
+
+    node->finish = longest + node->weight;
+    node->state = 2;
+}
+
+static void PrintDotString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', fp);
+        fputc(*s, fp);
+    }
+
+    fputc('"', fp);
+}
+
+static void WriteDot(const char *path, struct Graph *graph)
+{
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL)
+        FATAL_ERROR("error: failed to open \"%s\" for writing\n", path);
+
+    fprintf(fp, "digraph build {\n    node [shape=box];\n");
+
+    for (int i = 0; i < graph->count; i++)
+    {
+        const struct GraphNode *node = &graph->nodes[i];
+
+        fprintf(fp, "    ");
+        PrintDotString(fp, node->name);
+
+        if (node->measured)
+            fprintf(fp, " [duration_ms=%.3f, finish_ms=%.3f", node->duration / 1e3, node->finish / 1e3);
+        else
+            fprintf(fp, " [finish=%lld", (long long)node->finish);
+
+        fprintf(fp, "%s%s];\n", node->hasRecipe ? "" : ", style=dashed", node->critical ? ", color=red" : "");
+    }
+
+    for (int i = 0; i < graph->count; i++)
+    {
+        const struct GraphNode *node = &graph->nodes[i];
+
+        for (int j = 0; j < node->prereqCount; j++)
+        {
+            fprintf(fp, "    ");
+            PrintDotString(fp, graph->nodes[node->prereqs[j]].name);
+            fprintf(fp, " -> ");
+            PrintDotString(fp, node->name);
+            fprintf(fp, "%s;\n", node->critical && node->longestPrereq == node->prereqs[j] ? " [color=red]" : "");
+        }
+    }
+
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
+
+struct HeaderFanOut
+{
+    int node;
+    int units;
+    int64_t cost;
+};
+
+static int CompareFanOutDesc(const void *a, const void *b)
+{
+    const struct HeaderFanOut *fa = a;
+    const struct HeaderFanOut *fb = b;
+
+    if (fa->cost != fb->cost)
+        return (fa->cost < fb->cost) - (fa->cost > fb->cost);
+    return (fa->units < fb->units) - (fa->units > fb->units);
+}
+
+static bool IsGenerated(const struct GraphNode *node)
+{
+    return node->hasRecipe || node->prereqCount > 0;
+}
+
+static bool HasSuffix(const char *s, const char *suffix)
+{
+    size_t length = strlen(s);
+    size_t suffixLength = strlen(suffix);
+
+    return length >= suffixLength && strcmp(s + length - suffixLength, suffix) == 0;
+}
+
+static void PrintFanOut(struct Graph *graph, struct HeaderFanOut *headers, int headerCount, bool generatedOnly, int topCount, bool measured)
+{
+    printf("%8s %12s %8s  %s\n", "TUs", measured ? "rebuild ms" : "rebuild", "inputs", "header");
+
+    for (int i = 0, shown = 0; i < headerCount && shown < topCount; i++)
+    {
+        const struct GraphNode *node = &graph->nodes[headers[i].node];
+
+        if (generatedOnly && !IsGenerated(node))
+            continue;
+
+        if (measured)
+            printf("%8d %12.1f ", headers[i].units, headers[i].cost / 1e3);
+        else
+            printf("%8d %12lld ", headers[i].units, (long long)headers[i].cost);
+
+        if (IsGenerated(node))
+            printf("%8d  %s\n", node->prereqCount, node->name);
+        else
+            printf("%8s  %s\n", "-", node->name);
+        shown++;
+    }
+}
+
+static int GraphCommand(int argc, char **argv)
+{
+    const char *databasePath = NULL;
+    const char *tracePath = NULL;
+    const char *dotPath = NULL;
+    int topCount = 20;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            topCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            dotPath = argv[++i];
+        else if (databasePath == NULL && (argv[i][0] != '-' || argv[i][1] == 0))
+            databasePath = argv[i];
+        else
+            FATAL_ERROR("error: unrecognized argument \"%s\"\n", argv[i]);
+    }
+
+    if (databasePath == NULL)
+        FATAL_ERROR("Usage: buildprof graph DATABASE [-t TRACE] [-n N] [-o OUT.dot]\n");
+
+    struct Graph graph = { NULL, 0, 0, NULL, 0 };
+    char *text = ReadAll(databasePath);
+
+    ParseMakeDatabase(text, &graph);
+    free(text);
+
+    struct RecordList list = { NULL, 0, 0 };
+    int measuredCount = 0;
+
+    if (tracePath != NULL)
+    {
+        ReadTrace(tracePath, &list);
+        measuredCount = ApplyTrace(&graph, &list);
+    }
+
+    // Without durations every command counts as one unit, so the critical
+    // path is the longest chain of commands.
+    bool measured = measuredCount > 0;
+    int64_t work = 0;
+    long long edgeCount = 0;
+    int recipeCount = 0;
+
+    for (int i = 0; i < graph.count; i++)
+    {
+        struct GraphNode *node = &graph.nodes[i];
+
+        if (measured)
+            node->weight = node->duration;
+        else
+            node->weight = node->hasRecipe && !node->phony;
+
+        work += node->weight;
+        edgeCount += node->prereqCount;
+        recipeCount += node->hasRecipe;
+    }
+
+    int last = -1;
+
+    for (int i = 0; i < graph.count; i++)
+    {
+        ComputeFinish(&graph, i);
+
+        if (last < 0 || graph.nodes[i].finish > graph.nodes[last].finish)
+            last = i;
+    }
+
+    int pathLength = 0;
+    int *path = malloc((graph.count + 1) * sizeof(*path));
+
+    if (path == NULL)
+        FATAL_ERROR("error: out of memory\n");
+
+    for (int i = last; i >= 0; i = graph.nodes[i].longestPrereq)
+    {
+        graph.nodes[i].critical = true;
+        path[pathLength++] = i;
+    }
+
+    int64_t critical = last >= 0 ? graph.nodes[last].finish : 0;
+
+    printf("%d targets, %lld edges, %d with recipes, %d measured\n",
+        graph.count, edgeCount, recipeCount, measuredCount);
+
+    if (measured)
+        printf("%.2f s of work, critical path %.2f s", work / 1e6, critical / 1e6);
+    else
+        printf("%lld commands, critical path %lld commands", (long long)work, (long long)critical);
+
+    printf(" (at most %.1fx from parallel jobs)\n\n", critical > 0 ? (double)work / critical : 0.0);
+
+    printf("Critical path:\n");
+    printf("%12s %12s  %s\n", measured ? "ms" : "commands", measured ? "finish ms" : "finish", "target");
+
+    for (int i = pathLength - 1; i >= 0; i--)
+    {
+        const struct GraphNode *node = &graph.nodes[path[i]];
+
+        if (node->weight == 0 && i != pathLength - 1)
+            continue;
+
+        if (measured)
+            printf("%12.1f %12.1f  %s\n", node->duration / 1e3, node->finish / 1e3, node->name);
+        else
+            printf("%12lld %12lld  %s\n", (long long)node->weight, (long long)node->finish, node->name);
+    }
+
+    // Header fan-out: the compiled objects that list each header among their
+    // prerequisites, which scaninc already flattens to every transitive
+    // include, and what rebuilding all of them costs.
+    struct HeaderFanOut *headers = calloc(graph.count + 1, sizeof(*headers));
+    int *headerSlot = malloc((graph.count + 1) * sizeof(*headerSlot));
+    int *lastUnit = malloc((graph.count + 1) * sizeof(*lastUnit));
+    int headerCount = 0;
+
+    if (headers == NULL || headerSlot == NULL || lastUnit == NULL)
+        FATAL_ERROR("error: out of memory\n");
+
+    for (int i = 0; i < graph.count; i++)
+    {
+        headerSlot[i] = -1;
+        lastUnit[i] = -1;
+
+        if (HasSuffix(graph.nodes[i].name, ".h"))
+        {
+            headerSlot[i] = headerCount;
+            headers[headerCount++].node = i;
+        }
+    }
+
+    for (int i = 0; i < graph.count; i++)
+    {
+        const struct GraphNode *unit = &graph.nodes[i];
+
+        if (!unit->hasRecipe || !HasSuffix(unit->name, ".o"))
+            continue;
+
+        for (int j = 0; j < unit->prereqCount; j++)
+        {
+            int prereq = unit->prereqs[j];
+
+            if (headerSlot[prereq] < 0 || lastUnit[prereq] == i)
+                continue;
+
+            lastUnit[prereq] = i;
+            headers[headerSlot[prereq]].units++;
+            headers[headerSlot[prereq]].cost += unit->weight;
+        }
+    }
+
+    qsort(headers, headerCount, sizeof(*headers), CompareFanOutDesc);
+
+    printf("\nHeaders by fan-out:\n");
+    PrintFanOut(&graph, headers, headerCount, false, topCount, measured);
+    printf("\nGenerated headers by fan-out (split candidates):\n");
+    PrintFanOut(&graph, headers, headerCount, true, topCount, measured);
+
+    if (dotPath != NULL)
+    {
+        WriteDot(dotPath, &graph);
+        printf("\nDependency graph written to %s\n", dotPath);
+    }
+
+    for (size_t i = 0; i < list.count; i++)
+    {
+        free(list.items[i].tool);
+        free(list.items[i].target);
+    }
+    for (int i = 0; i < graph.count; i++)
+    {
+        free(graph.nodes[i].name);
+        free(graph.nodes[i].prereqs);
+    }
+    free(list.items);
+    free(graph.nodes);
+    free(graph.buckets);
+    free(headers);
+    free(headerSlot);
+    free(lastUnit);
+    free(path);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "run") == 0)
+        return Run(argc, argv);
+
+    if (argc >= 2 && strcmp(argv[1], "summary") == 0)
+        return Summary(argc, argv);
+
+    if (argc >= 2 && strcmp(argv[1], "graph") == 0)
+        return GraphCommand(argc, argv);
+
+    fprintf(stderr,
+        "Usage: buildprof run -- COMMAND [ARGS...]\n"
+        "       buildprof summary TRACE [-n N] [-o OUT.json]\n"
+        "       buildprof graph DATABASE [-t TRACE] [-n N] [-o OUT.dot]\n");
+    return 1;
+}
@@ -1,6 +1,7 @@
 // Copyright (c) 2015 YamaArashi
 
 #include <stdio.h>
+#include <string.h>
 #include <setjmp.h>
 #include <png.h>
 #include "global.h"
@@ -76,41 +77,46 @@ static unsigned char *ConvertBitDepth(unsigned char *src, int srcBitDepth, int d
     return output;
 }
 
-void ReadPng(char *path, struct Image *image)
+void DecodePng(char *path, struct PngData *png)
 {
     png_structp png_ptr;
     png_infop info_ptr;
+    png_colorp colors;
+    int numColors;
 
     FILE *fp = PngReadOpen(path, &png_ptr, &info_ptr);
 
-    int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-
-    int color_type = png_get_color_type(png_ptr, info_ptr);
-
-    if (color_type != PNG_COLOR_TYPE_GRAY && color_type != PNG_COLOR_TYPE_PALETTE)
-        FATAL_ERROR("\"%s\" has an unsupported color type.\n", path);
-
-    // Check if the image has a palette so that we can tell if the colors need to be inverted later.
-    // Don't read the palette because it's not needed for now.
-    image->hasPalette = (color_type == PNG_COLOR_TYPE_PALETTE);
+    png->bitDepth = png_get_bit_depth(png_ptr, info_ptr);
+    png->colorType = png_get_color_type(png_ptr, info_ptr);
+    png->width = png_get_image_width(png_ptr, info_ptr);
+    png->height = png_get_image_height(png_ptr, info_ptr);
+    png->numColors = -1;
 
-    image->width = png_get_image_width(png_ptr, info_ptr);
-    image->height = png_get_image_height(png_ptr, info_ptr);
+    if (png->colorType == PNG_COLOR_TYPE_PALETTE
+     && png_get_PLTE(png_ptr, info_ptr, &colors, &numColors) == PNG_INFO_PLTE)
+    {
+        png->numColors = numColors;
+        for (int i = 0; i < numColors && i < 256; i++) {
+            png->colors[i].red = colors[i].red;
+            png->colors[i].green = colors[i].green;
+            png->colors[i].blue = colors[i].blue;
+        }
+    }
 
     int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
 
-    image->pixels = malloc(image->height * rowbytes);
+    png->pixels = malloc(png->height * rowbytes);
 
-    if (image->pixels == NULL)
+    if (png->pixels == NULL)
         FATAL_ERROR("Failed to allocate pixel buffer.\n");
 
-    png_bytepp row_pointers = malloc(image->height * sizeof(png_bytep));
+    png_bytepp row_pointers = malloc(png->height * sizeof(png_bytep));
 
     if (row_pointers == NULL)
         FATAL_ERROR("Failed to allocate row pointers.\n");
 
-    for (int i = 0; i < image->height; i++)
-        row_pointers[i] = (png_bytep)(image->pixels + (i * rowbytes));
+    for (int i = 0; i < png->height; i++)
+        row_pointers[i] = (png_bytep)(png->pixels + (i * rowbytes));
 
     if (setjmp(png_jmpbuf(png_ptr)))
         FATAL_ERROR("Error reading from \"%s\".\n", path);
@@ -121,18 +127,72 @@ void ReadPng(char *path, struct Image *image)
 
     free(row_pointers);
     fclose(fp);
+}
 
-    if (bit_depth != image->bitDepth && image->tilemap.data.affine == NULL)
-    {
-        unsigned char *src = image->pixels;
+void FreePngData(struct PngData *png)
+{
+    free(png->pixels);
+    png->pixels = NULL;
+}
+
+// Fills in image from an already decoded PNG, converting the pixels to
+// image->bitDepth. The PNG keeps its own pixels, so one decode can feed
+// several images.
+void GetPngImage(char *path, struct PngData *png, struct Image *image)
+{
+    if (png->colorType != PNG_COLOR_TYPE_GRAY && png->colorType != PNG_COLOR_TYPE_PALETTE)
+        FATAL_ERROR("\"%s\" has an unsupported color type.\n", path);
+
+    // Check if the image has a palette so that we can tell if the colors need to be inverted later.
+    // Don't read the palette because it's not needed for now.
+    image->hasPalette = (png->colorType == PNG_COLOR_TYPE_PALETTE);
+
+    image->width = png->width;
+    image->height = png->height;
 
-        if (bit_depth != 1 && bit_depth != 2 && bit_depth != 4 && bit_depth != 8)
+    if (png->bitDepth != image->bitDepth && image->tilemap.data.affine == NULL)
+    {
+        if (png->bitDepth != 1 && png->bitDepth != 2 && png->bitDepth != 4 && png->bitDepth != 8)
             FATAL_ERROR("Bit depth of image must be 1, 2, 4, or 8.\n");
-        image->pixels = ConvertBitDepth(image->pixels, bit_depth, image->bitDepth, image->width * image->height);
-        free(src);
+        image->pixels = ConvertBitDepth(png->pixels, png->bitDepth, image->bitDepth, image->width * image->height);
+    }
+    else
+    {
+        int size = png->height * ((png->width * png->bitDepth + 7) / 8);
+
+        image->pixels = malloc(size);
+
+        if (image->pixels == NULL)
+            FATAL_ERROR("Failed to allocate pixel buffer.\n");
+
+        memcpy(image->pixels, png->pixels, size);
     }
 }
 
+void GetPngPalette(char *path, struct PngData *png, struct Palette *palette)
+{
+    if (png->colorType != PNG_COLOR_TYPE_PALETTE)
+        FATAL_ERROR("The image \"%s\" does not contain a palette.\n", path);
+
+    if (png->numColors < 0)
+        FATAL_ERROR("Failed to retrieve palette from \"%s\".\n", path);
+
+    if (png->numColors > 256)
+        FATAL_ERROR("Images with more than 256 colors are not supported.\n");
+
+    palette->numColors = png->numColors;
+    memcpy(palette->colors, png->colors, png->numColors * sizeof(struct Color));
+}
+
+void ReadPng(char *path, struct Image *image)
+{
+    struct PngData png;
+
+    DecodePng(path, &png);
+    GetPngImage(path, &png, image);
+    FreePngData(&png);
+}
+
 void ReadPngPalette(char *path, struct Palette *palette)
 {
     png_structp png_ptr;
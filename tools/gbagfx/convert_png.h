@@ -5,6 +5,22 @@
 
 #include "gfx.h"
 
+// A PNG decoded once at its own bit depth, so that several outputs (tiles at
+// different depths, the palette) can be made from a single read.
+struct PngData {
+    int width;
+    int height;
+    int bitDepth;
+    int colorType;
+    unsigned char *pixels;
+    struct Color colors[256];
+    int numColors; // -1 if there is no usable palette
+};
+
+void DecodePng(char *path, struct PngData *png);
+void FreePngData(struct PngData *png);
+void GetPngImage(char *path, struct PngData *png, struct Image *image);
+void GetPngPalette(char *path, struct PngData *png, struct Palette *palette);
 void ReadPng(char *path, struct Image *image);
 void WritePng(char *path, struct Image *image);
 void ReadPngPalette(char *path, struct Palette *palette);
@@ -50,12 +50,20 @@ enum NumTilesMode {
     NUM_TILES_ERROR,
 };
 
+// Takes ownership of buffer, which holds size bytes of tile data.
+void ConvertFromTileData(unsigned char *buffer, int size, int tilesWidth, int metatileWidth, int metatileHeight, struct Image *image, bool invertColors);
 void ReadTileImage(char *path, int tilesWidth, int metatileWidth, int metatileHeight, struct Image *image, bool invertColors);
+unsigned char *ConvertToTileData(enum NumTilesMode numTilesMode, int numTiles, int metatileWidth, int metatileHeight, struct Image *image, bool invertColors, int *size);
 void WriteTileImage(char *path, enum NumTilesMode numTilesMode, int numTiles, int metatileWidth, int metatileHeight, struct Image *image, bool invertColors);
 void ReadPlainImage(char *path, int dataWidth, struct Image *image, bool invertColors);
+unsigned char *ConvertToPlainData(int dataWidth, struct Image *image, bool invertColors, int *size);
 void WritePlainImage(char *path, int dataWidth, struct Image *image, bool invertColors);
+// Picks the SIMD tile kernels (the default) or the scalar ones; returns
+// whether SIMD kernels are now in use, which is never when built without them.
+bool SetSimdTileKernels(bool enable);
 void FreeImage(struct Image *image);
 void ReadGbaPalette(char *path, struct Palette *palette);
+int EncodeGbaPalette(struct Palette *palette, unsigned char *dest);
 void WriteGbaPalette(char *path, struct Palette *palette);
 
 #endif // GFX_H
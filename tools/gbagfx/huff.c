@@ -7,152 +7,59 @@
 #include "huff.h"
 
 static int cmp_tree(const void * a0, const void * b0) {
-    return ((struct HuffData *)a0)->value - ((struct HuffData *)b0)->value;
-}
-
-typedef int (*cmpfun)(const void *, const void *);
-
-int msort_r(void * data, size_t count, size_t size, cmpfun cmp, void * buffer) {
-    /*
-     * Out-of-place mergesort (stable sort)
-     * Returns 1 on success, 0 on failure
-     */
-    void * leftPtr;
-    void * rightPtr;
-    void * leftEnd;
-    void * rightEnd;
-    int i;
-
-    switch (count) {
-    case 0:
-        // Should never be here
-        return 0;
-
-    case 1:
-        // Nothing to do here
-        break;
-
-    case 2:
-        // Swap the two entries if the right one compares higher.
-        if (cmp(data, data + size) > 0) {
-            memcpy(buffer, data, size);
-            memcpy(data, data + size, size);
-            memcpy(data + size, buffer, size);
-        }
-        break;
-    default:
-        // Merge sort out-of-place.
-        leftPtr = data;
-        leftEnd = rightPtr = data + count / 2 * size;
-        rightEnd = data + count * size;
-
-        // Sort the left half
-        if (!msort_r(leftPtr, count / 2, size, cmp, buffer))
-            return 0;
-
-        // Sort the right half
-        if (!msort_r(rightPtr, count / 2 + (count & 1), size, cmp, buffer))
-            return 0;
-
-        // Merge the sorted halves out of place
-        i = 0;
-        do {
-            if (cmp(leftPtr, rightPtr) <= 0) {
-                memcpy(buffer + i * size, leftPtr, size);
-                leftPtr += size;
-            } else {
-                memcpy(buffer + i * size, rightPtr, size);
-                rightPtr += size;
-            }
-
-        } while (++i < count && leftPtr < leftEnd && rightPtr < rightEnd);
-
-        // Copy the remainder
-        if (i < count) {
-            if (leftPtr < leftEnd) {
-                memcpy(buffer + i * size, leftPtr, leftEnd - leftPtr);
-            }
-            else {
-                memcpy(buffer + i * size, rightPtr, rightEnd - rightPtr);
-            }
-        }
-
-        // Copy the merged data back
-        memcpy(data, buffer, count * size);
-        break;
-    }
+    const HuffNode_t * a = a0;
+    const HuffNode_t * b = b0;
 
-    return 1;
-}
-
-int msort(void * data, size_t count, size_t size, cmpfun cmp) {
-    void * buffer = malloc(count * size);
-    if (buffer == NULL) return 0;
-    int result = msort_r(data, count, size, cmp, buffer);
-    free(buffer);
-    return result;
+    // Ties are broken by key so that the order matches a stable sort.
+    if (a->header.value != b->header.value)
+        return a->header.value < b->header.value ? -1 : 1;
+    return a->leaf.key - b->leaf.key;
 }
 
 static void write_tree(unsigned char * dest, HuffNode_t * tree, int nitems, struct BitEncoding * encoding) {
     /*
      * The example used to guide this function encodes the tree in a
-     * breadth-first manner.  We attempt to emulate that here.
+     * breadth-first manner.  We emulate that here, visiting the left child
+     * of each node before the right one.
      */
 
-    int i, j, k;
+    int i, n;
 
     // There are (2 * nitems - 1) nodes in the binary tree.  Allocate that.
     HuffNode_t * traversal = calloc(2 * nitems - 1, sizeof(HuffNode_t));
-    if (traversal == NULL)
+    struct BitEncoding * paths = calloc(2 * nitems - 1, sizeof(struct BitEncoding));
+    if (traversal == NULL || paths == NULL)
         FATAL_ERROR("Fatal error while compressing Huff file.\n");
 
-    // The first node is the root of the tree.
+    // The first node is the root of the tree.  The traversal array doubles
+    // as the BFS queue: node i's children are appended at n and n + 1.
     traversal[0] = *tree;
-    i = 1;
-
-    // Copy the tree into a breadth-first ordering using brute force.
-    for (int depth = 1; i < 2 * nitems - 1; depth++) {
-        // Consider every possible path up to the current depth.
-        for (j = 0; i < 2 * nitems - 1 && j < 1 << depth; j++) {
-            // The index of the path is used to encode the path itself.
-            // Start from the most significant relevant bit and work our way down.
-            // Keep track of the current and previous nodes.
-            HuffNode_t * currNode = traversal;
-            HuffNode_t * parent = NULL;
-            for (k = 0; k < depth; k++) {
-                if (currNode->header.isLeaf)
-                    break;
-                parent = currNode;
-                if ((j >> (depth - k - 1)) & 1)
-                    currNode = currNode->branch.right;
-                else
-                    currNode = currNode->branch.left;
-            }
-            // Check that the length of the current path equals the current depth.
-            if (k == depth) {
-                // Make sure we can encode the current branch.
-                // Bail here if we cannot.
-                // This is only applicable for 8-bit encodings.
-                if (traversal + i - parent > 128)
-                    FATAL_ERROR("Fatal error while compressing Huff file: unable to encode binary tree.\n");
-                // Copy the current node, and update its parent.
-                traversal[i] = *currNode;
-                if (parent != NULL) {
-                    if ((j & 1) == 1)
-                        parent->branch.right = traversal + i;
-                    else
-                        parent->branch.left = traversal + i;
-                }
-                // Encode the path through the tree in the lookup table
-                if (traversal[i].header.isLeaf) {
-                    encoding[traversal[i].leaf.key].nbits = depth;
-                    encoding[traversal[i].leaf.key].bitstring = j;
-                }
-                i++;
-            }
+    n = 1;
+
+    for (i = 0; i < n; i++) {
+        HuffNode_t * currNode = traversal + i;
+        if (currNode->header.isLeaf) {
+            // Encode the path through the tree in the lookup table
+            encoding[currNode->leaf.key] = paths[i];
+            continue;
         }
+        // Make sure we can encode the current branch.
+        // Bail here if we cannot.
+        // This is only applicable for 8-bit encodings.
+        if (n + 1 - i > 128)
+            FATAL_ERROR("Fatal error while compressing Huff file: unable to encode binary tree.\n");
+        traversal[n] = *currNode->branch.left;
+        traversal[n + 1] = *currNode->branch.right;
+        paths[n].nbits = paths[n + 1].nbits = paths[i].nbits + 1;
+        paths[n].bitstring = paths[i].bitstring << 1;
+        paths[n + 1].bitstring = (paths[i].bitstring << 1) | 1;
+        currNode->branch.left = traversal + n;
+        currNode->branch.right = traversal + n + 1;
+        n += 2;
     }
 
+    free(paths);
+
     // Encode the size of the tree.
     // This is used by the decompressor to skip the tree.
     dest[4] = nitems - 1;
@@ -201,7 +108,7 @@ static void write_bits(unsigned char * dest, int * destPos, struct BitEncoding *
         int diff = *buffBits + nbits - 32;
         *buff <<= nbits - diff;
         *buff |= bitstring >> diff;
-        bitstring &= ~(1 << diff);
+        bitstring &= (1u << diff) - 1;
         nbits = diff;
         write_32_le(dest, destPos, buff, buffBits);
     }
@@ -224,7 +131,7 @@ unsigned char * HuffCompress(unsigned char * src, int srcSize, int * compressedS
 
     int worstCaseDestSize = 4 + (2 << bitDepth) + srcSize * 3;
 
-    unsigned char *dest = malloc(worstCaseDestSize);
+    unsigned char *dest = calloc(worstCaseDestSize, 1);
     if (dest == NULL)
         goto fail;
 
@@ -262,52 +169,54 @@ unsigned char * HuffCompress(unsigned char * src, int srcSize, int * compressedS
 #endif // DEBUG
 
     // Sort the frequency table.
-    if (!msort(freqs, nitems, sizeof(HuffNode_t), cmp_tree))
-        goto fail;
+    qsort(freqs, nitems, sizeof(HuffNode_t), cmp_tree);
 
-    // Prune zero-frequency values.
-    for (int i = 0; i < nitems; i++) {
-        if (freqs[i].header.value != 0) {
+    // Prune zero-frequency values.  At least two leaves are kept, since
+    // the format can't encode a tree whose root is a leaf.
+    if (freqs[nitems - 1].header.value == 0)
+        goto fail;
+    for (int i = 0; i < nitems - 1; i++) {
+        if (freqs[i].header.value != 0 || i == nitems - 2) {
             if (i > 0) {
-                for (int j = i; j < nitems; j++) {
-                    freqs[j - i] = freqs[j];
-                }
+                memmove(freqs, freqs + i, (nitems - i) * sizeof(HuffNode_t));
                 nitems -= i;
             }
             break;
         }
-        // This should never happen:
-        if (i == nitems - 1)
-            goto fail;
     }
 
-    HuffNode_t * tree = calloc(nitems * 2 - 1, sizeof(HuffNode_t));
-    if (tree == NULL)
+    HuffNode_t * branches = calloc(nitems, sizeof(HuffNode_t));
+    if (branches == NULL)
         goto fail;
 
-    // Iteratively collapse the two least frequent nodes.
-    HuffNode_t * endptr = freqs + nitems - 2;
+    // Iteratively collapse the two least frequent nodes.  Merged nodes are
+    // created in non-decreasing order of frequency, so they form a second
+    // sorted queue next to the leaves and the minimum is always at the head
+    // of one of the two.  On a tie the leaf is taken first, as is the older
+    // of two merged nodes, which is the order a stable re-sort would give.
+    HuffNode_t * root = freqs;
+    int leafHead = 0;
+    int branchHead = 0;
 
     for (int i = 0; i < nitems - 1; i++) {
-        HuffNode_t * left = freqs;
-        HuffNode_t * right = freqs + 1;
-        tree[i * 2] = *right;
-        tree[i * 2 + 1] = *left;
-        for (int j = 0; j < nitems - i - 2; j++)
-            freqs[j] = freqs[j + 2];
-        endptr->header.isLeaf = 0;
-        endptr->header.value = tree[i * 2].header.value + tree[i * 2 + 1].header.value;
-        endptr->branch.left = tree + i * 2;
-        endptr->branch.right = tree + i * 2 + 1;
-        endptr--;
-        if (i < nitems - 2 && !msort(freqs, nitems - i - 1, sizeof(HuffNode_t), cmp_tree))
-            goto fail;
+        HuffNode_t * pair[2];
+        for (int j = 0; j < 2; j++) {
+            if (leafHead < nitems && (branchHead == i || freqs[leafHead].header.value <= branches[branchHead].header.value))
+                pair[j] = freqs + leafHead++;
+            else
+                pair[j] = branches + branchHead++;
+        }
+        root = branches + i;
+        root->header.isLeaf = 0;
+        root->header.value = pair[0]->header.value + pair[1]->header.value;
+        root->branch.left = pair[1];
+        root->branch.right = pair[0];
     }
 
     // Write the tree breadth-first, and create the path lookup table.
-    write_tree(dest, freqs, nitems, encoding);
+    write_tree(dest, root, nitems, encoding);
 
-    free(tree);
+    free(branches);
     free(freqs);
 
     // Encode the data itself.
@@ -324,7 +233,10 @@ unsigned char * HuffCompress(unsigned char * src, int srcSize, int * compressedS
         }
     }
 
+    // The decoder reads each word from the top bit down, so the last
+    // partial word has to be left-aligned.
     if (destBitPos != 0) {
+        destBuf <<= 32 - destBitPos;
         write_32_le(dest, &destPos, &destBuf, &destBitPos);
     }
 
@@ -342,8 +254,61 @@ fail:
     FATAL_ERROR("Fatal error while compressing Huff file.\n");
 }
 
+/*
+ * The decoder resolves up to HUFF_TABLE_BITS bits per lookup.  Each table
+ * entry holds either the symbol reached by that bit prefix and the number
+ * of bits its code uses, or, for codes longer than the table, the tree node
+ * reached after HUFF_TABLE_BITS bits, from which decoding continues bit by
+ * bit.
+ */
+#define HUFF_TABLE_BITS 10
+
+struct HuffTableEntry {
+    unsigned short value; // symbol, or tree position if nbits == 0
+    unsigned char nbits;
+};
+
+// Follows one bit from the internal node at treePos.  Returns the position
+// of the child; *isLeaf tells whether it holds a symbol or another node.
+static inline int huff_step(unsigned char * src, int treePos, int treeEnd, int bit, bool * isLeaf) {
+    unsigned char treeView = src[treePos];
+    *isLeaf = ((treeView << bit) & 0x80) != 0;
+    treePos = (treePos & ~1) + ((treeView & 0x3F) + 1) * 2 + bit;
+    if (treePos >= treeEnd)
+        FATAL_ERROR("Fatal error while decompressing Huff file: invalid tree.\n");
+    return treePos;
+}
+
+static void build_decode_table(unsigned char * src, int treeEnd, struct HuffTableEntry * table) {
+    for (int prefix = 0; prefix < 1 << HUFF_TABLE_BITS; prefix++) {
+        int treePos = 5;
+        bool isLeaf = false;
+        int nbits = 0;
+        while (!isLeaf && nbits < HUFF_TABLE_BITS) {
+            int bit = (prefix >> (HUFF_TABLE_BITS - 1 - nbits)) & 1;
+            treePos = huff_step(src, treePos, treeEnd, bit, &isLeaf);
+            nbits++;
+        }
+        if (isLeaf) {
+            table[prefix].value = src[treePos];
+            table[prefix].nbits = nbits;
+        } else {
+            table[prefix].value = treePos;
+            table[prefix].nbits = 0;
+        }
+    }
+}
+
+static inline void refill_window(unsigned char * src, int srcSize, int * srcPos, uint64_t * window, int * windowBits) {
+    uint32_t word = 0;
+    if (*srcPos + 4 <= srcSize)
+        read_32_le(src, srcPos, &word);
+    *window |= (uint64_t)word << (32 - *windowBits);
+    *windowBits += 32;
+}
+
 unsigned char * HuffDecompress(unsigned char * src, int srcSize, int * uncompressedSize_p) {
-    if (srcSize < 4)
+    if (srcSize < 5)
         goto fail;
 
     int bitDepth = *src & 15;
@@ -352,47 +317,74 @@ unsigned char * HuffDecompress(unsigned char * src, int srcSize, int * uncompres
 
     int destSize = (src[3] << 16) | (src[2] << 8) | src[1];
 
-    unsigned char *dest = malloc(destSize);
+    int treeSize = (src[4] + 1) * 2;
+    int srcPos = 4 + treeSize;
+    if (srcPos > srcSize)
+        goto fail;
+
+    struct HuffTableEntry table[1 << HUFF_TABLE_BITS];
+    build_decode_table(src, srcPos, table);
+
+    // Round up so that a trailing partial word can be written whole.
+    unsigned char *dest = malloc((destSize + 3) & ~3);
 
     if (dest == NULL)
         goto fail;
 
-    int treePos = 5;
-    int treeSize = (src[4] + 1) * 2;
-    int srcPos = 4 + treeSize;
+    // Bits are consumed from the top of the window, which is refilled a
+    // 32-bit little-endian word at a time.  Past the end of the input the
+    // window is padded with zeros, which is only an error if a code ends
+    // beyond the real bits.
+    uint64_t window = 0;
+    int windowBits = 0;
+    long long bitsLeft = (long long)(srcSize - srcPos) * 8;
     int destPos = 0;
     int curValPos = 0;
     uint32_t destTmp = 0;
-    uint32_t window;
 
-    for (;;)
-    {
-        if (srcPos >= srcSize)
-            goto fail;
-        read_32_le(src, &srcPos, &window);
-        for (int i = 0; i < 32; i++) {
-            int curBit = (window >> 31) & 1;
-            unsigned char treeView = src[treePos];
-            bool isLeaf = ((treeView << curBit) & 0x80) != 0;
-            treePos &= ~1; // align
-            treePos += ((treeView & 0x3F) + 1) * 2 + curBit;
-            if (isLeaf) {
-                destTmp >>= bitDepth;
-                destTmp |= (src[treePos] << (32 - bitDepth));
-                curValPos++;
-                if (curValPos == 32 / bitDepth) {
-                    write_32_le(dest, &destPos, &destTmp, &curValPos);
-                    if (destPos == destSize) {
-                        *uncompressedSize_p = destSize;
-                        return dest;
-                    }
-                }
-                treePos = 5;
+    while (destPos < destSize) {
+        if (windowBits <= 32)
+            refill_window(src, srcSize, &srcPos, &window, &windowBits);
+
+        struct HuffTableEntry entry = table[window >> (64 - HUFF_TABLE_BITS)];
+        int value = entry.value;
+        int nbits = entry.nbits;
+
+        if (nbits == 0) {
+            // Code longer than the table: walk the rest of the tree.
+            int treePos = value;
+            bool isLeaf = false;
+            window <<= HUFF_TABLE_BITS;
+            windowBits -= HUFF_TABLE_BITS;
+            bitsLeft -= HUFF_TABLE_BITS;
+            while (!isLeaf) {
+                if (windowBits == 0)
+                    refill_window(src, srcSize, &srcPos, &window, &windowBits);
+                treePos = huff_step(src, treePos, 4 + treeSize, window >> 63, &isLeaf);
+                window <<= 1;
+                windowBits--;
+                bitsLeft--;
             }
-            window <<= 1;
+            value = src[treePos];
+        } else {
+            window <<= nbits;
+            windowBits -= nbits;
+            bitsLeft -= nbits;
         }
+
+        if (bitsLeft < 0)
+            goto fail;
+
+        destTmp >>= bitDepth;
+        destTmp |= (uint32_t)value << (32 - bitDepth);
+        curValPos++;
+        if (curValPos == 32 / bitDepth)
+            write_32_le(dest, &destPos, &destTmp, &curValPos);
     }
 
+    *uncompressedSize_p = destSize;
+    return dest;
+
 fail:
     FATAL_ERROR("Fatal error while decompressing Huff file.\n");
 }
@@ -69,11 +69,112 @@ fail:
 	FATAL_ERROR("Fatal error while decompressing LZ file.\n");
 }
 
-unsigned char *LZCompress(unsigned char *src, int srcSize, int *compressedSize, const int minDistance)
+#define LZ_MIN_MATCH    3
+#define LZ_MAX_MATCH    18
+#define LZ_MAX_DISTANCE 0x1000
+#define LZ_HASH_BITS    15
+#define LZ_HASH_SIZE    (1 << LZ_HASH_BITS)
+
+// Hash chains over every 3-byte prefix of the input. Walking a chain from its
+// head visits earlier positions with the same prefix hash in order of
+// increasing distance, which lets FindLongestMatch pick the same match as an
+// exhaustive scan of every distance (longest, then closest) while only
+// looking at candidates that can actually match.
+struct LZMatchFinder {
+	unsigned char *src;
+	int srcSize;
+	int minDistance;
+	int *head;
+	int *prev;
+	int inserted;
+};
+
+static int LZHash(unsigned char *p)
 {
-	if (srcSize <= 0)
-		goto fail;
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static bool InitMatchFinder(struct LZMatchFinder *mf, unsigned char *src, int srcSize, int minDistance)
+{
+	mf->src = src;
+	mf->srcSize = srcSize;
+	mf->minDistance = minDistance;
+	mf->head = malloc(LZ_HASH_SIZE * sizeof(int));
+	mf->prev = malloc(srcSize * sizeof(int));
+	mf->inserted = 0;
+
+	if (mf->head == NULL || mf->prev == NULL)
+		return false;
+
+	for (int i = 0; i < LZ_HASH_SIZE; i++)
+		mf->head[i] = -1;
+
+	return true;
+}
+
+static void FreeMatchFinder(struct LZMatchFinder *mf)
+{
+	free(mf->head);
+	free(mf->prev);
+}
+
+// Returns the length of the longest match for the data at pos (0 if shorter
+// than LZ_MIN_MATCH) and its distance. Positions must be queried in
+// increasing order.
+static int FindLongestMatch(struct LZMatchFinder *mf, int pos, int *bestDistance)
+{
+	unsigned char *src = mf->src;
+
+	while (mf->inserted < pos) {
+		int p = mf->inserted++;
+
+		if (p + LZ_MIN_MATCH <= mf->srcSize) {
+			int hash = LZHash(&src[p]);
+			mf->prev[p] = mf->head[hash];
+			mf->head[hash] = p;
+		}
+	}
+
+	int maxSize = mf->srcSize - pos;
+
+	if (maxSize > LZ_MAX_MATCH)
+		maxSize = LZ_MAX_MATCH;
 
+	if (maxSize < LZ_MIN_MATCH)
+		return 0;
+
+	int bestSize = 0;
+
+	for (int candidate = mf->head[LZHash(&src[pos])]; candidate >= 0; candidate = mf->prev[candidate]) {
+		int distance = pos - candidate;
+
+		if (distance > LZ_MAX_DISTANCE)
+			break;
+
+		if (distance < mf->minDistance)
+			continue;
+
+		int size = 0;
+
+		while (size < maxSize && src[candidate + size] == src[pos + size])
+			size++;
+
+		if (size > bestSize) {
+			bestSize = size;
+			*bestDistance = distance;
+
+			if (size == maxSize)
+				break;
+		}
+	}
+
+	return bestSize >= LZ_MIN_MATCH ? bestSize : 0;
+}
+
+// Writes the LZ stream for a parse given as the block size to use at each
+// position (0 for a literal) and the matching distances.
+static unsigned char *WriteLZStream(unsigned char *src, int srcSize, int *compressedSize, int *blockSizes, int *blockDistances)
+{
 	int worstCaseDestSize = 4 + srcSize + ((srcSize + 7) / 8);
 
 	// Round up to the next multiple of four.
@@ -82,7 +183,7 @@ unsigned char *LZCompress(unsigned char *src, int srcSize, int *compressedSize,
 	unsigned char *dest = malloc(worstCaseDestSize);
 
 	if (dest == NULL)
-		goto fail;
+		return NULL;
 
 	// header
 	dest[0] = 0x10; // LZ compression type
@@ -98,37 +199,16 @@ unsigned char *LZCompress(unsigned char *src, int srcSize, int *compressedSize,
 		*flags = 0;
 
 		for (int i = 0; i < 8; i++) {
-			int bestBlockDistance = 0;
-			int bestBlockSize = 0;
-			int blockDistance = minDistance;
-
-			while (blockDistance <= srcPos && blockDistance <= 0x1000) {
-				int blockStart = srcPos - blockDistance;
-				int blockSize = 0;
+			int blockSize = blockSizes[srcPos];
 
-				while (blockSize < 18
-				    && srcPos + blockSize < srcSize
-				    && src[blockStart + blockSize] == src[srcPos + blockSize])
-					blockSize++;
-
-				if (blockSize > bestBlockSize) {
-					bestBlockDistance = blockDistance;
-					bestBlockSize = blockSize;
-
-					if (blockSize == 18)
-						break;
-				}
-
-				blockDistance++;
-			}
+			if (blockSize >= LZ_MIN_MATCH) {
+				int blockDistance = blockDistances[srcPos] - 1;
 
-			if (bestBlockSize >= 3) {
 				*flags |= (0x80 >> i);
-				srcPos += bestBlockSize;
-				bestBlockSize -= 3;
-				bestBlockDistance--;
-				dest[destPos++] = (bestBlockSize << 4) | ((unsigned int)bestBlockDistance >> 8);
-				dest[destPos++] = (unsigned char)bestBlockDistance;
+				srcPos += blockSize;
+				blockSize -= LZ_MIN_MATCH;
+				dest[destPos++] = (blockSize << 4) | ((unsigned int)blockDistance >> 8);
+				dest[destPos++] = (unsigned char)blockDistance;
 			} else {
 				dest[destPos++] = src[srcPos++];
 			}
@@ -147,6 +227,91 @@ unsigned char *LZCompress(unsigned char *src, int srcSize, int *compressedSize,
 			}
 		}
 	}
+}
+
+unsigned char *LZCompress(unsigned char *src, int srcSize, int *compressedSize, const int minDistance)
+{
+	if (srcSize <= 0)
+		goto fail;
+
+	struct LZMatchFinder mf;
+	int *blockSizes = malloc(srcSize * sizeof(int));
+	int *blockDistances = malloc(srcSize * sizeof(int));
+
+	if (!InitMatchFinder(&mf, src, srcSize, minDistance) || blockSizes == NULL || blockDistances == NULL)
+		goto fail;
+
+	// Greedy parse: always take the longest match at the current position.
+	for (int srcPos = 0; srcPos < srcSize; ) {
+		int blockSize = FindLongestMatch(&mf, srcPos, &blockDistances[srcPos]);
+
+		blockSizes[srcPos] = blockSize;
+		srcPos += blockSize > 0 ? blockSize : 1;
+	}
+
+	unsigned char *dest = WriteLZStream(src, srcSize, compressedSize, blockSizes, blockDistances);
+
+	FreeMatchFinder(&mf);
+	free(blockSizes);
+	free(blockDistances);
+
+	if (dest == NULL)
+		goto fail;
+
+	return dest;
+
+fail:
+	FATAL_ERROR("Fatal error while compressing LZ file.\n");
+}
+
+unsigned char *LZCompressOptimal(unsigned char *src, int srcSize, int *compressedSize, const int minDistance)
+{
+	if (srcSize <= 0)
+		goto fail;
+
+	struct LZMatchFinder mf;
+	int *matchSizes = malloc(srcSize * sizeof(int));
+	int *blockSizes = malloc(srcSize * sizeof(int));
+	int *blockDistances = malloc(srcSize * sizeof(int));
+	int *cost = malloc((srcSize + 1) * sizeof(int));
+
+	if (!InitMatchFinder(&mf, src, srcSize, minDistance)
+	    || matchSizes == NULL || blockSizes == NULL || blockDistances == NULL || cost == NULL)
+		goto fail;
+
+	for (int srcPos = 0; srcPos < srcSize; srcPos++)
+		matchSizes[srcPos] = FindLongestMatch(&mf, srcPos, &blockDistances[srcPos]);
+
+	// Shortest path from each position to the end, in bits: a literal costs a
+	// flag bit and a byte, a block a flag bit and two bytes. Every prefix of
+	// the longest match is a match too, so all shorter block sizes at the same
+	// distance are candidates.
+	cost[srcSize] = 0;
+
+	for (int srcPos = srcSize - 1; srcPos >= 0; srcPos--) {
+		cost[srcPos] = 9 + cost[srcPos + 1];
+		blockSizes[srcPos] = 0;
+
+		for (int size = LZ_MIN_MATCH; size <= matchSizes[srcPos]; size++) {
+			if (17 + cost[srcPos + size] < cost[srcPos]) {
+				cost[srcPos] = 17 + cost[srcPos + size];
+				blockSizes[srcPos] = size;
+			}
+		}
+	}
+
+	unsigned char *dest = WriteLZStream(src, srcSize, compressedSize, blockSizes, blockDistances);
+
+	FreeMatchFinder(&mf);
+	free(matchSizes);
+	free(blockSizes);
+	free(blockDistances);
+	free(cost);
+
+	if (dest == NULL)
+		goto fail;
+
+	return dest;
 
 fail:
 	FATAL_ERROR("Fatal error while compressing LZ file.\n");
@@ -1,7 +1,14 @@
 // Copyright (c) 2015 YamaArashi
 
+#ifndef _MSC_VER
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <stdbool.h>
 #include "global.h"
 #include "util.h"
@@ -14,11 +21,19 @@
 #include "font.h"
 #include "huff.h"
 
+typedef void (*CommandFunction)(char *inputPath, char *outputPath, int argc, char **argv);
+
 struct CommandHandler
 {
     const char *inputFileExtension;
     const char *outputFileExtension;
-    void(*function)(char *inputPath, char *outputPath, int argc, char **argv);
+    CommandFunction function;
+};
+
+struct BatchJob
+{
+    int argc;
+    char **argv;
 };
 
 void ConvertGbaToPng(char *inputPath, char *outputPath, struct GbaToPngOptions *options)
@@ -201,19 +216,18 @@ void HandleGbaToPngCommand(char *inputPath, char *outputPath, int argc, char **a
     ConvertGbaToPng(inputPath, outputPath, &options);
 }
 
-void HandlePngToGbaCommand(char *inputPath, char *outputPath, int argc, char **argv)
+static void ParsePngToGbaOptions(char *outputPath, int argc, char **argv, struct PngToGbaOptions *options)
 {
     char *outputFileExtension = GetFileExtensionAfterDot(outputPath);
-    struct PngToGbaOptions options;
-    options.numTilesMode = NUM_TILES_IGNORE;
-    options.numTiles = 0;
-    options.bitDepth = outputFileExtension[0] - '0';
-    options.metatileWidth = 1;
-    options.metatileHeight = 1;
-    options.tilemapFilePath = NULL;
-    options.isAffineMap = false;
-    options.isTiled = true;
-    options.dataWidth = 1;
+    options->numTilesMode = NUM_TILES_IGNORE;
+    options->numTiles = 0;
+    options->bitDepth = outputFileExtension[0] - '0';
+    options->metatileWidth = 1;
+    options->metatileHeight = 1;
+    options->tilemapFilePath = NULL;
+    options->isAffineMap = false;
+    options->isTiled = true;
+    options->dataWidth = 1;
 
     for (int i = 3; i < argc; i++)
     {
@@ -226,17 +240,17 @@ void HandlePngToGbaCommand(char *inputPath, char *outputPath, int argc, char **a
 
             i++;
 
-            if (!ParseNumber(argv[i], NULL, 10, &options.numTiles))
+            if (!ParseNumber(argv[i], NULL, 10, &options->numTiles))
                 FATAL_ERROR("Failed to parse number of tiles.\n");
 
-            if (options.numTiles < 1)
+            if (options->numTiles < 1)
                 FATAL_ERROR("Number of tiles must be positive.\n");
         }
         else if (strcmp(option, "-Wnum_tiles") == 0) {
-            options.numTilesMode = NUM_TILES_WARN;
+            options->numTilesMode = NUM_TILES_WARN;
         }
         else if (strcmp(option, "-Werror=num_tiles") == 0) {
-            options.numTilesMode = NUM_TILES_ERROR;
+            options->numTilesMode = NUM_TILES_ERROR;
         }
         else if (strcmp(option, "-mwidth") == 0)
         {
@@ -245,10 +259,10 @@ void HandlePngToGbaCommand(char *inputPath, char *outputPath, int argc, char **a
 
             i++;
 
-            if (!ParseNumber(argv[i], NULL, 10, &options.metatileWidth))
+            if (!ParseNumber(argv[i], NULL, 10, &options->metatileWidth))
                 FATAL_ERROR("Failed to parse metatile width.\n");
 
-            if (options.metatileWidth < 1)
+            if (options->metatileWidth < 1)
                 FATAL_ERROR("metatile width must be positive.\n");
         }
         else if (strcmp(option, "-mheight") == 0)
@@ -258,15 +272,15 @@ void HandlePngToGbaCommand(char *inputPath, char *outputPath, int argc, char **a
 
             i++;
 
-            if (!ParseNumber(argv[i], NULL, 10, &options.metatileHeight))
+            if (!ParseNumber(argv[i], NULL, 10, &options->metatileHeight))
                 FATAL_ERROR("Failed to parse metatile height.\n");
 
-            if (options.metatileHeight < 1)
+            if (options->metatileHeight < 1)
                 FATAL_ERROR("metatile height must be positive.\n");
         }
         else if (strcmp(option, "-plain") == 0)
         {
-            options.isTiled = false;
+            options->isTiled = false;
         }
         else if (strcmp(option, "-data_width") == 0)
         {
@@ -274,10 +288,10 @@ void HandlePngToGbaCommand(char *inputPath, char *outputPath, int argc, char **a
                 FATAL_ERROR("No data width value following \"-data_width\".\n");
             i++;
 
-            if (!ParseNumber(argv[i], NULL, 10, &options.dataWidth))
+            if (!ParseNumber(argv[i], NULL, 10, &options->dataWidth))
                 FATAL_ERROR("Failed to parse data width.\n");
 
-            if (options.dataWidth < 1)
+            if (options->dataWidth < 1)
                 FATAL_ERROR("Data width must be positive.\n");
         }
         else
@@ -286,6 +300,13 @@ void HandlePngToGbaCommand(char *inputPath, char *outputPath, int argc, char **a
         }
     }
 
+}
+
+void HandlePngToGbaCommand(char *inputPath, char *outputPath, int argc, char **argv)
+{
+    struct PngToGbaOptions options;
+
+    ParsePngToGbaOptions(outputPath, argc, argv, &options);
     ConvertPngToGba(inputPath, outputPath, &options);
 }
 
@@ -313,7 +334,7 @@ void HandleGbaToJascPaletteCommand(char *inputPath, char *outputPath, int argc U
     WriteJascPalette(outputPath, &palette);
 }
 
-void HandleJascToGbaPaletteCommand(char *inputPath, char *outputPath, int argc, char **argv)
+static int ParseJascToGbaOptions(int argc, char **argv)
 {
     int numColors = 0;
 
@@ -343,6 +364,12 @@ void HandleJascToGbaPaletteCommand(char *inputPath, char *outputPath, int argc,
         }
     }
 
+    return numColors;
+}
+
+void HandleJascToGbaPaletteCommand(char *inputPath, char *outputPath, int argc, char **argv)
+{
+    int numColors = ParseJascToGbaOptions(argc, argv);
     struct Palette palette = {};
 
     ReadJascPalette(inputPath, &palette);
@@ -425,10 +452,11 @@ void HandlePngToFullwidthJapaneseFontCommand(char *inputPath, char *outputPath,
     FreeImage(&image);
 }
 
-void HandleLZCompressCommand(char *inputPath, char *outputPath, int argc, char **argv)
+static void ParseLZOptions(int argc, char **argv, struct LZOptions *options)
 {
-    int overflowSize = 0;
-    int minDistance = 2; // default, for compatibility with LZ77UnCompVram()
+    options->overflowSize = 0;
+    options->minDistance = 2; // default, for compatibility with LZ77UnCompVram()
+    options->optimal = false;
 
     for (int i = 3; i < argc; i++)
     {
@@ -441,10 +469,10 @@ void HandleLZCompressCommand(char *inputPath, char *outputPath, int argc, char *
 
             i++;
 
-            if (!ParseNumber(argv[i], NULL, 10, &overflowSize))
+            if (!ParseNumber(argv[i], NULL, 10, &options->overflowSize))
                 FATAL_ERROR("Failed to parse overflow size.\n");
 
-            if (overflowSize < 1)
+            if (options->overflowSize < 1)
                 FATAL_ERROR("Overflow size must be positive.\n");
         }
         else if (strcmp(option, "-search") == 0)
@@ -454,17 +482,44 @@ void HandleLZCompressCommand(char *inputPath, char *outputPath, int argc, char *
 
             i++;
 
-            if (!ParseNumber(argv[i], NULL, 10, &minDistance))
+            if (!ParseNumber(argv[i], NULL, 10, &options->minDistance))
                 FATAL_ERROR("Failed to parse LZ min search distance.\n");
 
-            if (minDistance < 1)
+            if (options->minDistance < 1)
                 FATAL_ERROR("LZ min search distance must be positive.\n");
         }
+        else if (strcmp(option, "-optimal") == 0)
+        {
+            // Smallest output instead of the historical greedy parse, so the
+            // bytes differ from what the original tools produce.
+            options->optimal = true;
+        }
         else
         {
             FATAL_ERROR("Unrecognized option \"%s\".\n", option);
         }
     }
+}
+
+// buffer holds size bytes of data followed by options->overflowSize zeros.
+static unsigned char *CompressLZ(unsigned char *buffer, int size, struct LZOptions *options, int *compressedSize)
+{
+    unsigned char *compressedData = options->optimal
+        ? LZCompressOptimal(buffer, size + options->overflowSize, compressedSize, options->minDistance)
+        : LZCompress(buffer, size + options->overflowSize, compressedSize, options->minDistance);
+
+    compressedData[1] = (unsigned char)size;
+    compressedData[2] = (unsigned char)(size >> 8);
+    compressedData[3] = (unsigned char)(size >> 16);
+
+    return compressedData;
+}
+
+void HandleLZCompressCommand(char *inputPath, char *outputPath, int argc, char **argv)
+{
+    struct LZOptions options;
+
+    ParseLZOptions(argc, argv, &options);
 
     // The overflow option allows a quirk in some of Ruby/Sapphire's tilesets
     // to be reproduced. It works by appending a number of zeros to the data
@@ -473,14 +528,10 @@ void HandleLZCompressCommand(char *inputPath, char *outputPath, int argc, char *
     // the data.
 
     int fileSize;
-    unsigned char *buffer = ReadWholeFileZeroPadded(inputPath, &fileSize, overflowSize);
+    unsigned char *buffer = ReadWholeFileZeroPadded(inputPath, &fileSize, options.overflowSize);
 
     int compressedSize;
-    unsigned char *compressedData = LZCompress(buffer, fileSize + overflowSize, &compressedSize, minDistance);
-
-    compressedData[1] = (unsigned char)fileSize;
-    compressedData[2] = (unsigned char)(fileSize >> 8);
-    compressedData[3] = (unsigned char)(fileSize >> 16);
+    unsigned char *compressedData = CompressLZ(buffer, fileSize, &options, &compressedSize);
 
     free(buffer);
 
@@ -534,9 +585,8 @@ void HandleRLDecompressCommand(char *inputPath, char *outputPath, int argc UNUSE
     free(uncompressedData);
 }
 
-void HandleHuffCompressCommand(char *inputPath, char *outputPath, int argc, char **argv)
+static int ParseHuffOptions(int argc, char **argv)
 {
-    int fileSize;
     int bitDepth = 4;
 
     for (int i = 3; i < argc; i++)
@@ -562,6 +612,13 @@ void HandleHuffCompressCommand(char *inputPath, char *outputPath, int argc, char
         }
     }
 
+    return bitDepth;
+}
+
+void HandleHuffCompressCommand(char *inputPath, char *outputPath, int argc, char **argv)
+{
+    int fileSize;
+    int bitDepth = ParseHuffOptions(argc, argv);
     unsigned char *buffer = ReadWholeFile(inputPath, &fileSize);
 
     int compressedSize;
@@ -589,39 +646,48 @@ void HandleHuffDecompressCommand(char *inputPath, char *outputPath, int argc UNU
     free(uncompressedData);
 }
 
-int main(int argc, char **argv)
+static const struct CommandHandler sHandlers[] =
 {
-    char converted = 0;
+    { "1bpp", "png", HandleGbaToPngCommand },
+    { "4bpp", "png", HandleGbaToPngCommand },
+    { "8bpp", "png", HandleGbaToPngCommand },
+    { "png", "1bpp", HandlePngToGbaCommand },
+    { "png", "4bpp", HandlePngToGbaCommand },
+    { "png", "8bpp", HandlePngToGbaCommand },
+    { "png", "gbapal", HandlePngToGbaPaletteCommand },
+    { "png", "pal", HandlePngToJascPaletteCommand },
+    { "gbapal", "pal", HandleGbaToJascPaletteCommand },
+    { "pal", "gbapal", HandleJascToGbaPaletteCommand },
+    { "latfont", "png", HandleLatinFontToPngCommand },
+    { "png", "latfont", HandlePngToLatinFontCommand },
+    { "hwjpnfont", "png", HandleHalfwidthJapaneseFontToPngCommand },
+    { "png", "hwjpnfont", HandlePngToHalfwidthJapaneseFontCommand },
+    { "fwjpnfont", "png", HandleFullwidthJapaneseFontToPngCommand },
+    { "png", "fwjpnfont", HandlePngToFullwidthJapaneseFontCommand },
+    { NULL, "huff", HandleHuffCompressCommand },
+    { NULL, "lz", HandleLZCompressCommand },
+    { "huff", NULL, HandleHuffDecompressCommand },
+    { "lz", NULL, HandleLZDecompressCommand },
+    { NULL, "rl", HandleRLCompressCommand },
+    { "rl", NULL, HandleRLDecompressCommand },
+    { NULL, NULL, NULL }
+};
 
-    if (argc < 3)
-        FATAL_ERROR("Usage: gbagfx INPUT_PATH OUTPUT_PATH [options...]\n");
-
-    struct CommandHandler handlers[] =
-    {
-        { "1bpp", "png", HandleGbaToPngCommand },
-        { "4bpp", "png", HandleGbaToPngCommand },
-        { "8bpp", "png", HandleGbaToPngCommand },
-        { "png", "1bpp", HandlePngToGbaCommand },
-        { "png", "4bpp", HandlePngToGbaCommand },
-        { "png", "8bpp", HandlePngToGbaCommand },
-        { "png", "gbapal", HandlePngToGbaPaletteCommand },
-        { "png", "pal", HandlePngToJascPaletteCommand },
-        { "gbapal", "pal", HandleGbaToJascPaletteCommand },
-        { "pal", "gbapal", HandleJascToGbaPaletteCommand },
-        { "latfont", "png", HandleLatinFontToPngCommand },
-        { "png", "latfont", HandlePngToLatinFontCommand },
-        { "hwjpnfont", "png", HandleHalfwidthJapaneseFontToPngCommand },
-        { "png", "hwjpnfont", HandlePngToHalfwidthJapaneseFontCommand },
-        { "fwjpnfont", "png", HandleFullwidthJapaneseFontToPngCommand },
-        { "png", "fwjpnfont", HandlePngToFullwidthJapaneseFontCommand },
-        { NULL, "huff", HandleHuffCompressCommand },
-        { NULL, "lz", HandleLZCompressCommand },
-        { "huff", NULL, HandleHuffDecompressCommand },
-        { "lz", NULL, HandleLZDecompressCommand },
-        { NULL, "rl", HandleRLCompressCommand },
-        { "rl", NULL, HandleRLDecompressCommand },
-        { NULL, NULL, NULL }
-    };
+static CommandFunction FindHandler(char *inputFileExtension, char *outputFileExtension)
+{
+    for (int i = 0; sHandlers[i].function != NULL; i++)
+    {
+        if ((sHandlers[i].inputFileExtension == NULL || strcmp(sHandlers[i].inputFileExtension, inputFileExtension) == 0)
+            && (sHandlers[i].outputFileExtension == NULL || strcmp(sHandlers[i].outputFileExtension, outputFileExtension) == 0))
+            return sHandlers[i].function;
+    }
+
+    return NULL;
+}
+
+static void RunCommand(int argc, char **argv)
+{
+    char converted = 0;
 
     char *inputPath = argv[1];
     char *outputPath = argv[2];
@@ -659,15 +725,12 @@ int main(int argc, char **argv)
         }
     }
 
-    for (int i = 0; handlers[i].function != NULL; i++)
+    CommandFunction function = FindHandler(inputFileExtension, outputFileExtension);
+
+    if (function != NULL)
     {
-        if ((handlers[i].inputFileExtension == NULL || strcmp(handlers[i].inputFileExtension, inputFileExtension) == 0)
-            && (handlers[i].outputFileExtension == NULL || strcmp(handlers[i].outputFileExtension, outputFileExtension) == 0))
-        {
-            handlers[i].function(inputPath, outputPath, argc, argv);
-            converted = 1;
-            break;
-        }
+        function(inputPath, outputPath, argc, argv);
+        converted = 1;
     }
 
     if (outputPath != argv[2])
@@ -675,6 +738,836 @@ int main(int argc, char **argv)
 
     if (!converted)
         FATAL_ERROR("Don't know how to convert \"%s\" to \"%s\".\n", argv[1], argv[2]);
+}
+
+#ifdef _MSC_VER
+
+// No pthreads here; work items simply run one after another.
+static void RunParallel(int count, int threadCount UNUSED, void (*work)(int index, void *context), void *context)
+{
+    for (int i = 0; i < count; i++)
+        work(i, context);
+}
+
+#else
+
+struct WorkQueue
+{
+    int count;
+    int next;
+    void (*work)(int index, void *context);
+    void *context;
+    pthread_mutex_t lock;
+};
+
+static void *WorkQueueThread(void *arg)
+{
+    struct WorkQueue *queue = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue->lock);
+        int index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (index >= queue->count)
+            return NULL;
+
+        queue->work(index, queue->context);
+    }
+}
+
+// Calls work(index, context) for every index in [0, count) on threadCount
+// threads.
+static void RunParallel(int count, int threadCount, void (*work)(int index, void *context), void *context)
+{
+    struct WorkQueue queue;
+
+    if (threadCount > count)
+        threadCount = count;
+
+    if (threadCount < 1)
+        return;
+
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+
+    if (threads == NULL)
+        FATAL_ERROR("Failed to allocate memory for threads.\n");
+
+    queue.count = count;
+    queue.next = 0;
+    queue.work = work;
+    queue.context = context;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    for (int i = 0; i < threadCount; i++)
+        if (pthread_create(&threads[i], NULL, WorkQueueThread, &queue) != 0)
+            FATAL_ERROR("Failed to create thread.\n");
+
+    for (int i = 0; i < threadCount; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&queue.lock);
+    free(threads);
+}
+
+#endif // _MSC_VER
+
+static char *CopyString(const char *s, size_t length)
+{
+    char *copy = malloc(length + 1);
+
+    if (copy == NULL)
+        FATAL_ERROR("Failed to allocate memory for batch job.\n");
+
+    memcpy(copy, s, length);
+    copy[length] = 0;
+    return copy;
+}
+
+// Parses "-threads N" from argv[3...]; defaults to one thread per online CPU.
+static int ParseThreadCount(int argc, char **argv)
+{
+    int threadCount = 0;
+
+    for (int i = 3; i < argc; i++)
+    {
+        char *option = argv[i];
+
+        if (strcmp(option, "-threads") == 0)
+        {
+            if (i + 1 >= argc)
+                FATAL_ERROR("No count following \"-threads\".\n");
+
+            i++;
+
+            if (!ParseNumber(argv[i], NULL, 10, &threadCount))
+                FATAL_ERROR("Failed to parse thread count.\n");
+
+            if (threadCount < 1)
+                FATAL_ERROR("Thread count must be positive.\n");
+        }
+        else
+        {
+            FATAL_ERROR("Unrecognized option \"%s\".\n", option);
+        }
+    }
+
+    if (threadCount == 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+        threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (threadCount < 1)
+            threadCount = 1;
+    }
+
+    return threadCount;
+}
+
+// Each non-empty line of a job file is "INPUT_PATH OUTPUT_PATH [options...]",
+// exactly like the arguments of a single invocation.
+static struct BatchJob *ReadJobFile(char *jobFilePath, int *jobCountOut)
+{
+    FILE *fp = fopen(jobFilePath, "r");
+
+    if (fp == NULL)
+        FATAL_ERROR("Failed to open \"%s\" for reading.\n", jobFilePath);
+
+    struct BatchJob *jobs = NULL;
+    int jobCount = 0;
+    int jobCapacity = 0;
+    char line[4096];
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *tokens[64];
+        int tokenCount = 1;
+        char *p = line;
+
+        tokens[0] = "gbagfx";
+
+        for (;;)
+        {
+            while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+                p++;
+
+            if (*p == 0)
+                break;
+
+            char *start = p;
+
+            while (*p != 0 && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                p++;
+
+            if (tokenCount == 64)
+                FATAL_ERROR("Too many arguments in batch job \"%s\".\n", line);
+
+            tokens[tokenCount++] = CopyString(start, p - start);
+        }
+
+        if (tokenCount == 1)
+            continue;
+
+        if (tokenCount < 3)
+            FATAL_ERROR("Batch job needs an input and an output path: \"%s\".\n", tokens[1]);
+
+        if (jobCount == jobCapacity)
+        {
+            jobCapacity = jobCapacity ? jobCapacity * 2 : 256;
+            jobs = realloc(jobs, jobCapacity * sizeof(struct BatchJob));
+
+            if (jobs == NULL)
+                FATAL_ERROR("Failed to allocate memory for batch jobs.\n");
+        }
+
+        jobs[jobCount].argc = tokenCount;
+        jobs[jobCount].argv = malloc(tokenCount * sizeof(char *));
+
+        if (jobs[jobCount].argv == NULL)
+            FATAL_ERROR("Failed to allocate memory for batch job.\n");
+
+        memcpy(jobs[jobCount].argv, tokens, tokenCount * sizeof(char *));
+        jobCount++;
+    }
+
+    fclose(fp);
+
+    *jobCountOut = jobCount;
+    return jobs;
+}
+
+static void FreeJobs(struct BatchJob *jobs, int jobCount)
+{
+    for (int i = 0; i < jobCount; i++)
+    {
+        for (int j = 1; j < jobs[i].argc; j++)
+            free(jobs[i].argv[j]);
+        free(jobs[i].argv);
+    }
+
+    free(jobs);
+}
+
+static void RunBatchJob(int index, void *context)
+{
+    struct BatchJob *jobs = context;
+
+    RunCommand(jobs[index].argc, jobs[index].argv);
+}
+
+// gbagfx -batch JOB_FILE [-threads N]
+// Runs every job of JOB_FILE on N threads (default: one per online CPU); any
+// failing job aborts the whole batch. Jobs are independent, so a job must
+// not read another job's output.
+static void HandleBatchCommand(int argc, char **argv)
+{
+    int threadCount = ParseThreadCount(argc, argv);
+    int jobCount;
+    struct BatchJob *jobs = ReadJobFile(argv[2], &jobCount);
+
+    RunParallel(jobCount, threadCount, RunBatchJob, jobs);
+
+    FreeJobs(jobs, jobCount);
+}
+
+// Manifest mode compiles a whole set of graphics outputs in one process.
+// Jobs are grouped by the file they read: every group is one work item, so a
+// PNG is decoded once for all of its .Nbpp and .gbapal outputs, and each
+// output is handed in memory to the jobs that read it (.4bpp -> .4bpp.lz).
+// Outputs are only rewritten when their bytes change; unchanged ones just get
+// their timestamp refreshed so make sees them as up to date.
+
+struct ManifestJob
+{
+    struct BatchJob args;
+    char *inputPath;
+    char *outputPath;
+    CommandFunction function;
+    int nextSibling;    // next job reading the same input, or -1
+    int firstConsumer;  // first job reading this job's output, or -1
+    bool ran;
+    bool written;
+};
+
+struct ManifestSource
+{
+    char *path;
+    int firstConsumer;
+};
+
+struct Manifest
+{
+    struct ManifestJob *jobs;
+    int jobCount;
+    struct ManifestSource *sources;
+    int sourceCount;
+};
+
+// An input as the jobs reading it see it: raw bytes and/or a decoded PNG,
+// each loaded the first time a job asks for it.
+struct ManifestInput
+{
+    char *path;
+    unsigned char *data;
+    int size;
+    bool pngDecoded;
+    struct PngData png;
+};
+
+static unsigned char *GetInputData(struct ManifestInput *input, int *size)
+{
+    if (input->data == NULL)
+        input->data = ReadWholeFile(input->path, &input->size);
+
+    *size = input->size;
+    return input->data;
+}
+
+static struct PngData *GetInputPng(struct ManifestInput *input)
+{
+    if (!input->pngDecoded)
+    {
+        DecodePng(input->path, &input->png);
+        input->pngDecoded = true;
+    }
+
+    return &input->png;
+}
+
+static void FreeInput(struct ManifestInput *input)
+{
+    free(input->data);
+
+    if (input->pngDecoded)
+        FreePngData(&input->png);
+}
+
+// Builds the output of a job in memory. Returns NULL for conversions that
+// only exist as file-to-file commands.
+static unsigned char *BuildJobOutput(struct ManifestJob *job, struct ManifestInput *input, int *size)
+{
+    int argc = job->args.argc;
+    char **argv = job->args.argv;
+    unsigned char *output = NULL;
+
+    if (job->function == HandlePngToGbaCommand)
+    {
+        struct PngToGbaOptions options;
+        struct Image image;
+
+        ParsePngToGbaOptions(job->outputPath, argc, argv, &options);
+        image.bitDepth = options.bitDepth;
+        image.tilemap.data.affine = NULL;
+        GetPngImage(input->path, GetInputPng(input), &image);
+
+        if (options.isTiled)
+            output = ConvertToTileData(options.numTilesMode, options.numTiles, options.metatileWidth, options.metatileHeight, &image, !image.hasPalette, size);
+        else
+            output = ConvertToPlainData(options.dataWidth, &image, !image.hasPalette, size);
+
+        FreeImage(&image);
+    }
+    else if (job->function == HandlePngToGbaPaletteCommand)
+    {
+        struct Palette palette = {};
+
+        GetPngPalette(input->path, GetInputPng(input), &palette);
+        output = malloc(sizeof(palette.colors) / sizeof(palette.colors[0]) * 2);
+
+        if (output == NULL)
+            FATAL_ERROR("Failed to allocate memory for palette.\n");
+
+        *size = EncodeGbaPalette(&palette, output);
+    }
+    else if (job->function == HandleJascToGbaPaletteCommand)
+    {
+        int numColors = ParseJascToGbaOptions(argc, argv);
+        struct Palette palette = {};
+
+        ReadJascPalette(input->path, &palette);
+
+        if (numColors != 0)
+            palette.numColors = numColors;
+
+        output = malloc(sizeof(palette.colors) / sizeof(palette.colors[0]) * 2);
+
+        if (output == NULL)
+            FATAL_ERROR("Failed to allocate memory for palette.\n");
+
+        *size = EncodeGbaPalette(&palette, output);
+    }
+    else if (job->function == HandleLZCompressCommand)
+    {
+        struct LZOptions options;
+        int dataSize;
+        unsigned char *data = GetInputData(input, &dataSize);
+
+        ParseLZOptions(argc, argv, &options);
+
+        unsigned char *buffer = calloc(dataSize + options.overflowSize + 1, 1);
+
+        if (buffer == NULL)
+            FATAL_ERROR("Failed to allocate memory for \"%s\".\n", input->path);
+
+        memcpy(buffer, data, dataSize);
+        output = CompressLZ(buffer, dataSize, &options, size);
+        free(buffer);
+    }
+    else if (job->function == HandleRLCompressCommand)
+    {
+        int dataSize;
+        unsigned char *data = GetInputData(input, &dataSize);
+
+        output = RLCompress(data, dataSize, size);
+    }
+    else if (job->function == HandleHuffCompressCommand)
+    {
+        int bitDepth = ParseHuffOptions(argc, argv);
+        int dataSize;
+        unsigned char *data = GetInputData(input, &dataSize);
+
+        output = HuffCompress(data, dataSize, size, bitDepth);
+    }
+
+    return output;
+}
+
+static void RunManifestJob(struct Manifest *manifest, int index, struct ManifestInput *input)
+{
+    struct ManifestJob *job = &manifest->jobs[index];
+    int size = 0;
+    unsigned char *output = BuildJobOutput(job, input, &size);
+
+    if (output != NULL)
+    {
+        job->written = WriteWholeFileIfChanged(job->outputPath, output, size);
+    }
+    else
+    {
+        // The input is already on disk: sources are files, and outputs are
+        // written before the jobs that read them run.
+        RunCommand(job->args.argc, job->args.argv);
+        job->written = true;
+    }
+
+    job->ran = true;
+
+    struct ManifestInput next = { .path = job->outputPath, .data = output, .size = size };
+
+    for (int consumer = job->firstConsumer; consumer != -1; consumer = manifest->jobs[consumer].nextSibling)
+        RunManifestJob(manifest, consumer, &next);
+
+    FreeInput(&next);
+}
+
+static void RunManifestSource(int index, void *context)
+{
+    struct Manifest *manifest = context;
+    struct ManifestSource *source = &manifest->sources[index];
+    struct ManifestInput input = { .path = source->path };
+
+    for (int job = source->firstConsumer; job != -1; job = manifest->jobs[job].nextSibling)
+        RunManifestJob(manifest, job, &input);
+
+    FreeInput(&input);
+}
+
+static struct ManifestJob *sSortJobs;
+
+static int CompareJobOutputs(const void *a, const void *b)
+{
+    return strcmp(sSortJobs[*(const int *)a].outputPath, sSortJobs[*(const int *)b].outputPath);
+}
+
+static int CompareJobInputs(const void *a, const void *b)
+{
+    int result = strcmp(sSortJobs[*(const int *)a].inputPath, sSortJobs[*(const int *)b].inputPath);
+
+    // Keep manifest order among jobs reading the same file.
+    return result != 0 ? result : *(const int *)a - *(const int *)b;
+}
+
+static int FindJobByOutput(struct ManifestJob *jobs, int *byOutput, int jobCount, char *path)
+{
+    int low = 0;
+    int high = jobCount - 1;
+
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        int result = strcmp(path, jobs[byOutput[mid]].outputPath);
+
+        if (result == 0)
+            return byOutput[mid];
+        if (result < 0)
+            high = mid - 1;
+        else
+            low = mid + 1;
+    }
+
+    return -1;
+}
+
+// Links every job either to the job producing its input or, when nothing in
+// the manifest produces it, to a source group for that file.
+static void BuildManifestGraph(struct Manifest *manifest)
+{
+    struct ManifestJob *jobs = manifest->jobs;
+    int jobCount = manifest->jobCount;
+    int *order = malloc((jobCount + 1) * sizeof(int));
+    int *byOutput = malloc((jobCount + 1) * sizeof(int));
+    int *lastConsumer = malloc((jobCount + 1) * sizeof(int));
+    int rootCount = 0;
+
+    if (order == NULL || byOutput == NULL || lastConsumer == NULL)
+        FATAL_ERROR("Failed to allocate memory for manifest.\n");
+
+    sSortJobs = jobs;
+
+    for (int i = 0; i < jobCount; i++)
+        byOutput[i] = i;
+
+    qsort(byOutput, jobCount, sizeof(int), CompareJobOutputs);
+
+    for (int i = 1; i < jobCount; i++)
+        if (strcmp(jobs[byOutput[i - 1]].outputPath, jobs[byOutput[i]].outputPath) == 0)
+            FATAL_ERROR("\"%s\" is the output of more than one manifest job.\n", jobs[byOutput[i]].outputPath);
+
+    for (int i = 0; i < jobCount; i++)
+    {
+        jobs[i].nextSibling = -1;
+        jobs[i].firstConsumer = -1;
+        lastConsumer[i] = -1;
+    }
+
+    for (int i = 0; i < jobCount; i++)
+    {
+        int producer = FindJobByOutput(jobs, byOutput, jobCount, jobs[i].inputPath);
+
+        if (producer == -1)
+        {
+            order[rootCount++] = i;
+        }
+        else
+        {
+            if (lastConsumer[producer] == -1)
+                jobs[producer].firstConsumer = i;
+            else
+                jobs[lastConsumer[producer]].nextSibling = i;
+            lastConsumer[producer] = i;
+        }
+    }
+
+    qsort(order, rootCount, sizeof(int), CompareJobInputs);
+
+    manifest->sources = malloc((rootCount + 1) * sizeof(struct ManifestSource));
+    manifest->sourceCount = 0;
+
+    if (manifest->sources == NULL)
+        FATAL_ERROR("Failed to allocate memory for manifest.\n");
+
+    for (int i = 0; i < rootCount; i++)
+    {
+        struct ManifestJob *job = &jobs[order[i]];
+
+        if (i > 0 && strcmp(jobs[order[i - 1]].inputPath, job->inputPath) == 0)
+        {
+            jobs[order[i - 1]].nextSibling = order[i];
+        }
+        else
+        {
+            struct ManifestSource *source = &manifest->sources[manifest->sourceCount++];
+            source->path = job->inputPath;
+            source->firstConsumer = order[i];
+        }
+    }
+
+    free(order);
+    free(byOutput);
+    free(lastConsumer);
+}
+
+// gbagfx -manifest JOB_FILE [-threads N]
+// Same job file format as -batch, but jobs may read each other's outputs and
+// outputs whose bytes don't change are left untouched.
+static void HandleManifestCommand(int argc, char **argv)
+{
+    int threadCount = ParseThreadCount(argc, argv);
+    struct Manifest manifest;
+    int jobCount;
+    struct BatchJob *args = ReadJobFile(argv[2], &jobCount);
+
+    manifest.jobCount = jobCount;
+    manifest.jobs = calloc(jobCount + 1, sizeof(struct ManifestJob));
+
+    if (manifest.jobs == NULL)
+        FATAL_ERROR("Failed to allocate memory for manifest.\n");
+
+    for (int i = 0; i < jobCount; i++)
+    {
+        struct ManifestJob *job = &manifest.jobs[i];
+
+        job->args = args[i];
+        job->inputPath = args[i].argv[1];
+        job->outputPath = args[i].argv[2];
+
+        char *inputFileExtension = GetFileExtensionAfterDot(job->inputPath);
+        char *outputFileExtension = GetFileExtensionAfterDot(job->outputPath);
+
+        if (inputFileExtension != NULL && outputFileExtension != NULL)
+            job->function = FindHandler(inputFileExtension, outputFileExtension);
+    }
+
+    BuildManifestGraph(&manifest);
+    RunParallel(manifest.sourceCount, threadCount, RunManifestSource, &manifest);
+
+    int written = 0;
+
+    for (int i = 0; i < jobCount; i++)
+    {
+        if (!manifest.jobs[i].ran)
+            FATAL_ERROR("Manifest job \"%s\" is part of a dependency cycle.\n", manifest.jobs[i].outputPath);
+
+        if (manifest.jobs[i].written)
+            written++;
+    }
+
+    printf("gbagfx: %d outputs, %d written, %d unchanged\n", jobCount, written, jobCount - written);
+
+    free(manifest.sources);
+    free(manifest.jobs);
+    FreeJobs(args, jobCount);
+}
+
+// gbagfx -tilebench JOB_FILE [-runs N]
+// Times the scalar and SIMD tile kernels on every PNG -> .1bpp/.4bpp/.8bpp job
+// of JOB_FILE and fails unless both produce the same bytes. Each image is
+// converted to tiles with its job's options, converted back (which must give
+// the original pixels) and decoded through a tilemap that uses every flip and
+// palette combination; PNG decoding and file I/O are not timed.
+
+enum TileBenchStage
+{
+    TILE_BENCH_TO_TILES,
+    TILE_BENCH_FROM_TILES,
+    TILE_BENCH_TILEMAP,
+    TILE_BENCH_STAGE_COUNT,
+};
+
+static const char *const sTileBenchStageNames[TILE_BENCH_STAGE_COUNT] = {
+    "to tiles",
+    "from tiles",
+    "tilemap",
+};
+
+struct TileBenchResult
+{
+    unsigned char *data;
+    int size;
+};
+
+// Runs one stage `runs` times with the given kernels, adds the elapsed time to
+// *seconds and returns the output of the last run.
+static struct TileBenchResult RunTileBenchStage(enum TileBenchStage stage, bool simd, int runs, struct Image *image, struct PngToGbaOptions *options, struct TileBenchResult *tiles, double *seconds)
+{
+    struct TileBenchResult result = { NULL, 0 };
+    bool invertColors = !image->hasPalette;
+    int tilesWidth = image->width / 8;
+
+    SetSimdTileKernels(simd);
+
+    for (int run = 0; run < runs; run++)
+    {
+        free(result.data);
+
+        struct Image decoded = *image;
+        unsigned char *buffer = NULL;
+        int metatileWidth = options->metatileWidth;
+        int metatileHeight = options->metatileHeight;
+
+        decoded.pixels = NULL;
+        decoded.tilemap.data.affine = NULL;
+
+        if (stage != TILE_BENCH_TO_TILES)
+        {
+            buffer = malloc(tiles->size);
+
+            if (buffer == NULL)
+                FATAL_ERROR("Failed to allocate memory for tile data.\n");
+
+            memcpy(buffer, tiles->data, tiles->size);
+        }
+
+        if (stage == TILE_BENCH_TILEMAP)
+        {
+            decoded.tilemap = image->tilemap;
+            decoded.isAffine = false;
+            metatileWidth = 1;
+            metatileHeight = 1;
+        }
+
+        clock_t start = clock();
+
+        if (stage == TILE_BENCH_TO_TILES)
+        {
+            result.data = ConvertToTileData(NUM_TILES_IGNORE, options->numTiles, metatileWidth, metatileHeight, image, invertColors, &result.size);
+        }
+        else
+        {
+            ConvertFromTileData(buffer, tiles->size, tilesWidth, metatileWidth, metatileHeight, &decoded, invertColors);
+            result.data = decoded.pixels;
+            result.size = decoded.width * decoded.height * decoded.bitDepth / 8;
+        }
+
+        *seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+    }
+
+    return result;
+}
+
+static void HandleTileBenchCommand(int argc, char **argv)
+{
+    int runs = 5;
+
+    for (int i = 3; i < argc; i++)
+    {
+        char *option = argv[i];
+
+        if (strcmp(option, "-runs") == 0)
+        {
+            if (i + 1 >= argc)
+                FATAL_ERROR("No count following \"-runs\".\n");
+
+            i++;
+
+            if (!ParseNumber(argv[i], NULL, 10, &runs))
+                FATAL_ERROR("Failed to parse run count.\n");
+
+            if (runs < 1)
+                FATAL_ERROR("Run count must be positive.\n");
+        }
+        else
+        {
+            FATAL_ERROR("Unrecognized option \"%s\".\n", option);
+        }
+    }
+
+    if (!SetSimdTileKernels(true))
+        printf("gbagfx: built without SIMD tile kernels, comparing scalar with scalar\n");
+
+    int jobCount;
+    struct BatchJob *jobs = ReadJobFile(argv[2], &jobCount);
+    double seconds[TILE_BENCH_STAGE_COUNT][2] = {};
+    long long pixelBytes = 0;
+    int imageCount = 0;
+
+    for (int i = 0; i < jobCount; i++)
+    {
+        char *inputPath = jobs[i].argv[1];
+        char *outputPath = jobs[i].argv[2];
+        char *inputFileExtension = GetFileExtensionAfterDot(inputPath);
+        char *outputFileExtension = GetFileExtensionAfterDot(outputPath);
+
+        if (inputFileExtension == NULL || outputFileExtension == NULL || strcmp(inputFileExtension, "png") != 0
+         || (strcmp(outputFileExtension, "1bpp") != 0 && strcmp(outputFileExtension, "4bpp") != 0 && strcmp(outputFileExtension, "8bpp") != 0))
+            continue;
+
+        struct PngToGbaOptions options;
+        struct Image image = {};
+
+        ParsePngToGbaOptions(outputPath, jobs[i].argc, jobs[i].argv, &options);
+
+        if (!options.isTiled)
+            continue;
+
+        image.bitDepth = options.bitDepth;
+        ReadPng(inputPath, &image);
+
+        // Untruncated tile data for the decoding stages, and a tilemap that
+        // walks those tiles with every hflip/vflip/palette combination.
+        struct TileBenchResult tiles;
+        SetSimdTileKernels(false);
+        tiles.data = ConvertToTileData(NUM_TILES_IGNORE, 0, options.metatileWidth, options.metatileHeight, &image, !image.hasPalette, &tiles.size);
+
+        int tileCount = tiles.size / (image.bitDepth * 8);
+        struct NonAffineTile *tilemap = malloc(tileCount * sizeof(struct NonAffineTile));
+
+        if (tilemap == NULL)
+            FATAL_ERROR("Failed to allocate memory for tilemap.\n");
+
+        for (int j = 0; j < tileCount; j++)
+        {
+            tilemap[j].index = (tileCount - 1 - j) % 1024;
+            tilemap[j].hflip = j & 1;
+            tilemap[j].vflip = (j >> 1) & 1;
+            tilemap[j].palno = (j >> 2) & 15;
+        }
+
+        image.tilemap.data.non_affine = tilemap;
+        image.tilemap.size = tileCount * sizeof(struct NonAffineTile);
+
+        // 4bpp tiles decode to 8bpp when the palette has more than 16 colors.
+        int tilemapPasses = image.bitDepth == 4 ? 2 : 1;
+        struct Palette palette = image.palette;
+
+        for (int stage = 0; stage < TILE_BENCH_STAGE_COUNT; stage++)
+        {
+            for (int pass = 0; pass < (stage == TILE_BENCH_TILEMAP ? tilemapPasses : 1); pass++)
+            {
+                image.palette.numColors = pass == 0 ? palette.numColors : 256;
+
+                struct TileBenchResult scalar = RunTileBenchStage(stage, false, runs, &image, &options, &tiles, &seconds[stage][0]);
+                struct TileBenchResult simd = RunTileBenchStage(stage, true, runs, &image, &options, &tiles, &seconds[stage][1]);
+
+                if (scalar.size != simd.size || memcmp(scalar.data, simd.data, scalar.size) != 0)
+                    FATAL_ERROR("%s: SIMD and scalar kernels differ (%s)\n", inputPath, sTileBenchStageNames[stage]);
+
+                if (stage == TILE_BENCH_FROM_TILES && memcmp(simd.data, image.pixels, simd.size) != 0)
+                    FATAL_ERROR("%s: tiles don't convert back to the original pixels\n", inputPath);
+
+                free(scalar.data);
+                free(simd.data);
+            }
+        }
+
+        image.palette = palette;
+        pixelBytes += tiles.size;
+        imageCount++;
+
+        free(tiles.data);
+        FreeImage(&image);
+    }
+
+    FreeJobs(jobs, jobCount);
+
+    printf("gbagfx -tilebench: %d images, %lld bytes of tiles, %d runs each\n", imageCount, pixelBytes, runs);
+
+    for (int stage = 0; stage < TILE_BENCH_STAGE_COUNT; stage++)
+    {
+        printf("  %-10s  scalar %9.3f ms  simd %9.3f ms  %6.2fx\n", sTileBenchStageNames[stage],
+               seconds[stage][0] * 1000 / runs, seconds[stage][1] * 1000 / runs,
+               seconds[stage][1] > 0 ? seconds[stage][0] / seconds[stage][1] : 0.0);
+    }
+
+    printf("  outputs identical\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "-batch") == 0)
+        HandleBatchCommand(argc, argv);
+    else if (argc >= 3 && strcmp(argv[1], "-manifest") == 0)
+        HandleManifestCommand(argc, argv);
+    else if (argc >= 3 && strcmp(argv[1], "-tilebench") == 0)
+        HandleTileBenchCommand(argc, argv);
+    else if (argc >= 3)
+        RunCommand(argc, argv);
+    else
+        FATAL_ERROR("Usage: gbagfx INPUT_PATH OUTPUT_PATH [options...]\n"
+                    "       gbagfx -batch JOB_FILE [-threads N]\n"
+                    "       gbagfx -manifest JOB_FILE [-threads N]\n"
+                    "       gbagfx -tilebench JOB_FILE [-runs N]\n");
 
     return 0;
 }
@@ -31,4 +31,10 @@ struct PngToGbaOptions {
     int dataWidth;
 };
 
+struct LZOptions {
+    int overflowSize;
+    int minDistance;
+    bool optimal;
+};
+
 #endif // OPTIONS_H
@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <limits.h>
+#include <utime.h>
 #include "global.h"
 #include "util.h"
 
@@ -129,3 +130,51 @@ void WriteWholeFile(char *path, void *buffer, int bufferSize)
 
 	fclose(fp);
 }
+
+// Skips the write when the file already holds exactly these bytes, but still
+// refreshes its timestamp: the outputs are make targets, and one left older
+// than its input would be rebuilt on every make. Returns whether it was
+// written.
+bool WriteWholeFileIfChanged(char *path, void *buffer, int bufferSize)
+{
+	FILE *fp = fopen(path, "rb");
+
+	if (fp != NULL)
+	{
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);
+		bool same = false;
+
+		if (size == bufferSize)
+		{
+			unsigned char *existing = malloc(size > 0 ? size : 1);
+
+			if (existing == NULL)
+				FATAL_ERROR("Failed to allocate memory for reading \"%s\".\n", path);
+
+			rewind(fp);
+			same = size == 0 || (fread(existing, size, 1, fp) == 1 && memcmp(existing, buffer, size) == 0);
+			free(existing);
+		}
+
+		fclose(fp);
+
+		if (same)
+		{
+			if (utime(path, NULL) != 0)
+				FATAL_ERROR("Failed to update the timestamp of \"%s\".\n", path);
+			return false;
+		}
+	}
+
+	fp = fopen(path, "wb");
+
+	if (fp == NULL)
+		FATAL_ERROR("Failed to open \"%s\" for writing.\n", path);
+
+	if (bufferSize > 0 && fwrite(buffer, bufferSize, 1, fp) != 1)
+		FATAL_ERROR("Failed to write to \"%s\".\n", path);
+
+	fclose(fp);
+	return true;
+}
@@ -11,5 +11,6 @@ char *GetFileExtensionAfterDot(char *path);
 unsigned char *ReadWholeFile(char *path, int *size);
 unsigned char *ReadWholeFileZeroPadded(char *path, int *size, int padAmount);
 void WriteWholeFile(char *path, void *buffer, int bufferSize);
+bool WriteWholeFileIfChanged(char *path, void *buffer, int bufferSize);
 
 #endif // UTIL_H
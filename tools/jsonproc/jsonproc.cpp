@@ -12,11 +12,30 @@ using std::string; using std::to_string;
 #include <algorithm>
 using std::replace_if;
 
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <vector>
+using std::vector;
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#include <utime.h>
+
 #include <inja.hpp>
 using namespace inja;
 using json = nlohmann::json;
 
-std::map<string, string> customVars;
+// setVar/getVar state and the paths doNotModifyHeader names belong to the
+// output being rendered. They are thread_local so that a manifest's outputs
+// can share one Environment (and its parsed templates) across threads.
+thread_local std::map<string, string> customVars;
+thread_local string currentJsonFilepath;
+thread_local string currentTemplateFilepath;
 
 void set_custom_var(string key, string value)
 {
@@ -28,21 +47,43 @@ string get_custom_var(string key)
     return customVars[key];
 }
 
-int main(int argc, char *argv[])
+// Writes text to filepath unless the file already holds exactly that text.
+// An unchanged file keeps its mtime only if touchUnchanged is false: that is
+// the manifest mode, which runs behind a stamp, so nothing that includes the
+// file is rebuilt. A single output is a direct make target and gets its mtime
+// bumped, or it would stay older than its inputs and be rendered on every make.
+void write_if_changed(const string &filepath, const string &text, bool touchUnchanged)
 {
-    if (argc != 4)
-        FATAL_ERROR("USAGE: jsonproc <json-filepath> <template-filepath> <output-filepath>\n");
+    std::ifstream in_file(filepath, std::ios::binary);
 
-    string jsonfilepath = argv[1];
-    string templateFilepath = argv[2];
-    string outputFilepath = argv[3];
+    if (in_file.is_open())
+    {
+        string old_text((std::istreambuf_iterator<char>(in_file)), std::istreambuf_iterator<char>());
+        if (old_text == text)
+        {
+            if (touchUnchanged && utime(filepath.c_str(), nullptr) != 0)
+                FATAL_ERROR("Cannot update the mtime of %s.\n", filepath.c_str());
+            return;
+        }
+        in_file.close();
+    }
 
-    Environment env;
-    env.set_trim_blocks(true);
+    std::ofstream out_file(filepath, std::ios::binary);
+
+    if (!out_file.is_open())
+        FATAL_ERROR("Cannot open file %s for writing.\n", filepath.c_str());
+
+    out_file << text;
+    out_file.close();
 
-    // Add custom command callbacks.
-    env.add_callback("doNotModifyHeader", 0, [jsonfilepath, templateFilepath](Arguments& args) {
-        return "//\n// DO NOT MODIFY THIS FILE! It is auto-generated from " + jsonfilepath +" and Inja template " + templateFilepath + "\n//\n";
+    if (out_file.fail())
+        FATAL_ERROR("Failed to write %s.\n", filepath.c_str());
+}
+
+void add_callbacks(Environment &env)
+{
+    env.add_callback("doNotModifyHeader", 0, [](Arguments& args) {
+        return "//\n// DO NOT MODIFY THIS FILE! It is auto-generated from " + currentJsonFilepath +" and Inja template " + currentTemplateFilepath + "\n//\n";
     });
 
     env.add_callback("subtract", 2, [](Arguments& args) {
@@ -119,10 +160,175 @@ int main(int argc, char *argv[])
         }
         return str;
     });
+}
+
+struct ManifestEntry
+{
+    string jsonFilepath;
+    string templateFilepath;
+    string outputFilepath;
+    double renderMs;
+    string error;
+};
+
+// Runs job(0) .. job(count - 1) on numThreads threads.
+void run_parallel(size_t count, unsigned numThreads, const std::function<void(size_t)> &job)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+            job(i);
+    };
+
+    if (numThreads > count)
+        numThreads = count;
+
+    vector<std::thread> threads;
+    for (unsigned i = 1; i < numThreads; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread &t : threads)
+        t.join();
+}
+
+// jsonproc -m <manifest> [-j <threads>]: each manifest line is
+// "<json-filepath> <template-filepath> <output-filepath>".  Every distinct
+// JSON file and template is parsed once, the outputs are rendered in
+// parallel, and the render time of each output is reported.
+void process_manifest(const string &manifestFilepath, unsigned numThreads)
+{
+    std::ifstream manifest(manifestFilepath);
+
+    if (!manifest.is_open())
+        FATAL_ERROR("Cannot open manifest %s.\n", manifestFilepath.c_str());
+
+    vector<ManifestEntry> entries;
+    string line;
+
+    while (std::getline(manifest, line))
+    {
+        std::istringstream fields(line);
+        ManifestEntry entry;
+        string extra;
+
+        if (!(fields >> entry.jsonFilepath))
+            continue;
+        if (!(fields >> entry.templateFilepath >> entry.outputFilepath) || (fields >> extra))
+            FATAL_ERROR("%s: expected \"<json-filepath> <template-filepath> <output-filepath>\", got \"%s\".\n", manifestFilepath.c_str(), line.c_str());
+        entry.renderMs = 0;
+        entries.push_back(entry);
+    }
+
+    Environment env;
+    env.set_trim_blocks(true);
+    add_callbacks(env);
+
+    std::map<string, json> jsonData;
+    std::map<string, Template> templates;
+
+    for (const ManifestEntry &entry : entries)
+    {
+        jsonData[entry.jsonFilepath];
+        templates[entry.templateFilepath];
+    }
+
+    // JSON documents are independent, so they are parsed in parallel.
+    // Template parsing registers included templates in the Environment and
+    // has to stay on one thread.
+    vector<std::map<string, json>::iterator> jsonSlots;
+    for (auto it = jsonData.begin(); it != jsonData.end(); ++it)
+        jsonSlots.push_back(it);
+
+    vector<string> errors(jsonSlots.size());
+    run_parallel(jsonSlots.size(), numThreads, [&](size_t i) {
+        try
+        {
+            jsonSlots[i]->second = env.load_json(jsonSlots[i]->first);
+        }
+        catch (const std::exception& e)
+        {
+            errors[i] = e.what();
+        }
+    });
+    for (const string &error : errors)
+        if (!error.empty())
+            FATAL_ERROR("JSONPROC_ERROR: %s\n", error.c_str());
+
+    try
+    {
+        for (auto &it : templates)
+            it.second = env.parse_template(it.first);
+    }
+    catch (const std::exception& e)
+    {
+        FATAL_ERROR("JSONPROC_ERROR: %s\n", e.what());
+    }
+
+    run_parallel(entries.size(), numThreads, [&](size_t i) {
+        ManifestEntry &entry = entries[i];
+        auto start = std::chrono::steady_clock::now();
+
+        customVars.clear();
+        currentJsonFilepath = entry.jsonFilepath;
+        currentTemplateFilepath = entry.templateFilepath;
+
+        try
+        {
+            string output = env.render(templates.at(entry.templateFilepath), jsonData.at(entry.jsonFilepath));
+            write_if_changed(entry.outputFilepath, output, false);
+        }
+        catch (const std::exception& e)
+        {
+            entry.error = e.what();
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        entry.renderMs = elapsed.count();
+    });
+
+    for (const ManifestEntry &entry : entries)
+    {
+        if (!entry.error.empty())
+            FATAL_ERROR("JSONPROC_ERROR: %s: %s\n", entry.outputFilepath.c_str(), entry.error.c_str());
+        printf("jsonproc: %8.2f ms  %s\n", entry.renderMs, entry.outputFilepath.c_str());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && string(argv[1]) == "-m")
+    {
+        unsigned numThreads = std::thread::hardware_concurrency();
+
+        if (argc == 5 && string(argv[3]) == "-j")
+            numThreads = std::atoi(argv[4]);
+        else if (argc != 3)
+            FATAL_ERROR("USAGE: jsonproc -m <manifest-filepath> [-j <threads>]\n");
+        if (numThreads == 0)
+            numThreads = 1;
+
+        process_manifest(argv[2], numThreads);
+        return 0;
+    }
+
+    if (argc != 4)
+        FATAL_ERROR("USAGE: jsonproc <json-filepath> <template-filepath> <output-filepath>\n"
+                    "       jsonproc -m <manifest-filepath> [-j <threads>]\n");
+
+    string jsonfilepath = argv[1];
+    string templateFilepath = argv[2];
+    string outputFilepath = argv[3];
+
+    Environment env;
+    env.set_trim_blocks(true);
+    add_callbacks(env);
+
+    currentJsonFilepath = jsonfilepath;
+    currentTemplateFilepath = templateFilepath;
 
     try
     {
-        env.write_with_json_file(templateFilepath, jsonfilepath, outputFilepath);
+        write_if_changed(outputFilepath, env.render_file_with_json_file(templateFilepath, jsonfilepath), true);
     }
     catch (const std::exception& e)
     {
@@ -24,6 +24,14 @@ using std::ostringstream;
 #include <limits>
 using std::numeric_limits;
 
+#include <atomic>
+using std::atomic;
+
+#include <thread>
+using std::thread;
+
+#include <utime.h>
+
 #include "json11.h"
 using json11::Json;
 
@@ -32,6 +40,11 @@ using json11::Json;
 string version;
 // System directory separator
 string sep;
+// Whether an output that already holds the right text still gets its mtime
+// bumped. The per-file modes are direct make targets, which would otherwise
+// stay older than their inputs and be regenerated on every make; `all` runs
+// behind a stamp and leaves unchanged outputs alone.
+bool touch_unchanged = true;
 
 string read_text_file(string filepath) {
     ifstream in_file(filepath);
@@ -52,7 +65,27 @@ string read_text_file(string filepath) {
     return text;
 }
 
-void write_text_file(string filepath, string text) {
+// Doesn't rewrite the file if it already holds exactly this text. Unless
+// touch_unchanged is set, its mtime is left alone too, so make doesn't
+// rebuild what includes it.
+void write_text_file(string filepath, const string &text) {
+    ifstream in_file(filepath, std::ifstream::binary);
+
+    if (in_file.is_open()) {
+        in_file.seekg(0, std::ios::end);
+        if (in_file.tellg() == static_cast<std::streamoff>(text.size())) {
+            string old_text(text.size(), '\0');
+            in_file.seekg(0, std::ios::beg);
+            in_file.read(&old_text[0], old_text.size());
+            if (in_file && old_text == text) {
+                if (touch_unchanged && utime(filepath.c_str(), nullptr) != 0)
+                    FATAL_ERROR("Cannot update the mtime of %s.\n", filepath.c_str());
+                return;
+            }
+        }
+        in_file.close();
+    }
+
     ofstream out_file(filepath, std::ofstream::binary);
 
     if (!out_file.is_open())
@@ -63,6 +96,14 @@ void write_text_file(string filepath, string text) {
     out_file.close();
 }
 
+Json read_json_file(const string &filepath) {
+    string err;
+    Json data = Json::parse(read_text_file(filepath), err);
+    if (data == Json())
+        FATAL_ERROR("%s: %s\n", filepath.c_str(), err.c_str());
+    return data;
+}
+
 
 string json_to_string(const Json &data, const string &field = "", bool silent = false) {
     const Json value = !field.empty() ? data[field] : data;
@@ -119,20 +160,28 @@ string get_include_guard_end(const string &name) {
     return guard.str();
 }
 
-string generate_map_header_text(Json map_data, Json layouts_data) {
-    string map_layout_id = json_to_string(map_data, "layout");
+// Layouts from layouts.json by id.  An id that maps to anything but exactly
+// one layout is an error once a map refers to it.
+typedef map<string, vector<Json>> LayoutIndex;
 
-    vector<Json> matched;
+LayoutIndex index_layouts(const Json &layouts_data) {
+    LayoutIndex index;
 
-    for (auto &layout : layouts_data["layouts"].array_items()) {
-        if (map_layout_id == json_to_string(layout, "id", true))
-            matched.push_back(layout);
-    }
+    for (auto &layout : layouts_data["layouts"].array_items())
+        index[json_to_string(layout, "id", true)].push_back(layout);
+
+    return index;
+}
+
+string generate_map_header_text(Json map_data, const LayoutIndex &layouts) {
+    string map_layout_id = json_to_string(map_data, "layout");
 
-    if (matched.size() != 1)
+    auto matched = layouts.find(map_layout_id);
+
+    if (matched == layouts.end() || matched->second.size() != 1)
         FATAL_ERROR("Failed to find matching layout for %s.\n", map_layout_id.c_str());
 
-    Json layout = matched[0];
+    const Json &layout = matched->second[0];
 
     ostringstream text;
 
@@ -367,6 +416,14 @@ string file_parent(string filename){
     return filename.substr(0, dir_pos + 1);
 }
 
+// Name of the directory holding a map.json, which is also the map's name.
+string map_dir_name(const string &map_filepath) {
+    string dir = file_parent(map_filepath);
+    dir = dir.substr(0, dir.find_last_not_of("/\\") + 1);
+    size_t dir_pos = dir.find_last_of("/\\");
+    return dir_pos == string::npos ? dir : dir.substr(dir_pos + 1);
+}
+
 void process_map(string map_filepath, string layouts_filepath, string output_dir) {
     string mapdata_err, layouts_err;
 
@@ -381,7 +438,7 @@ void process_map(string map_filepath, string layouts_filepath, string output_dir
     if (layouts_data == Json())
         FATAL_ERROR("%s\n", layouts_err.c_str());
 
-    string header_text = generate_map_header_text(map_data, layouts_data);
+    string header_text = generate_map_header_text(map_data, index_layouts(layouts_data));
     string events_text = generate_map_events_text(map_data);
     string connections_text = generate_map_connections_text(map_data);
 
@@ -391,20 +448,14 @@ void process_map(string map_filepath, string layouts_filepath, string output_dir
     write_text_file(out_dir + "connections.inc", connections_text);
 }
 
-void process_event_constants(const vector<string> &map_filepaths, string output_ids_file) {
+string generate_event_constants_text(const vector<Json> &maps_data) {
     string warning = get_generated_warning("data/maps/*/map.json", false);
 
     string guard_name = "CONSTANTS_MAP_EVENT_IDS";
     ostringstream ids_file_text;
     ids_file_text << get_include_guard_start(guard_name) << warning;
 
-    for (const string &filepath : map_filepaths) {
-        string err;
-        string map_json_text = read_text_file(filepath);
-        Json map_data = Json::parse(map_json_text, err);
-        if (map_data == Json())
-            FATAL_ERROR("Failed to read '%s' while generating map event constants: %s\n", filepath.c_str(), err.c_str());
-
+    for (const Json &map_data : maps_data) {
         string map_id = json_to_string(map_data, "id");
 
         // Get IDs from the object/clone events.
@@ -430,7 +481,22 @@ void process_event_constants(const vector<string> &map_filepaths, string output_
     }
 
     ids_file_text << get_include_guard_end(guard_name);
-    write_text_file(output_ids_file, ids_file_text.str());
+    return ids_file_text.str();
+}
+
+void process_event_constants(const vector<string> &map_filepaths, string output_ids_file) {
+    vector<Json> maps_data;
+
+    for (const string &filepath : map_filepaths) {
+        string err;
+        string map_json_text = read_text_file(filepath);
+        Json map_data = Json::parse(map_json_text, err);
+        if (map_data == Json())
+            FATAL_ERROR("Failed to read '%s' while generating map event constants: %s\n", filepath.c_str(), err.c_str());
+        maps_data.push_back(map_data);
+    }
+
+    write_text_file(output_ids_file, generate_event_constants_text(maps_data));
 }
 
 string generate_groups_text(Json groups_data) {
@@ -519,7 +585,10 @@ string generate_events_text(Json groups_data, string include_path) {
     return text.str();
 }
 
-string generate_map_constants_text(string groups_filepath, Json groups_data) {
+// Parsed map.json files by map name, so that `all` mode reads each one once.
+typedef map<string, Json> MapDataCache;
+
+string generate_map_constants_text(string groups_filepath, Json groups_data, const MapDataCache *maps_data = nullptr) {
     string file_dir = file_parent(groups_filepath) + sep;
 
     string guard_name = "CONSTANTS_MAP_GROUPS";
@@ -536,10 +605,12 @@ string generate_map_constants_text(string groups_filepath, Json groups_data) {
 
         for (auto &map_name : groups_data[groupName].array_items()) {
             string map_filepath = file_dir + json_to_string(map_name) + sep + "map.json";
-            string err_str;
-            Json map_data = Json::parse(read_text_file(map_filepath), err_str);
-            if (map_data == Json())
-                FATAL_ERROR("%s: %s\n", map_filepath.c_str(), err_str.c_str());
+            Json map_data;
+            auto cached = maps_data ? maps_data->find(json_to_string(map_name)) : MapDataCache::const_iterator();
+            if (maps_data && cached != maps_data->end())
+                map_data = cached->second;
+            else
+                map_data = read_json_file(map_filepath);
             string id = json_to_string(map_data, "id", true);
             map_ids.push_back(id);
             if (id.length() > max_length)
@@ -563,7 +634,7 @@ string generate_map_constants_text(string groups_filepath, Json groups_data) {
 }
 
 // Output paths are directories with trailing path separators
-void process_groups(string groups_filepath, string output_asm, string output_c) {
+void process_groups(string groups_filepath, string output_asm, string output_c, const MapDataCache *maps_data = nullptr) {
     output_asm = strip_trailing_separator(output_asm); // Remove separator if existing.
     output_c = strip_trailing_separator(output_c);
 
@@ -577,7 +648,7 @@ void process_groups(string groups_filepath, string output_asm, string output_c)
     string connections_text = generate_connections_text(groups_data, output_asm);
     string headers_text = generate_headers_text(groups_data, output_asm);
     string events_text = generate_events_text(groups_data, output_asm);
-    string map_header_text = generate_map_constants_text(groups_filepath, groups_data);
+    string map_header_text = generate_map_constants_text(groups_filepath, groups_data, maps_data);
 
     write_text_file(output_asm + sep + "groups.inc", groups_text);
     write_text_file(output_asm + sep + "connections.inc", connections_text);
@@ -653,16 +724,10 @@ string generate_layouts_constants_text(Json layouts_data) {
     return text.str();
 }
 
-void process_layouts(string layouts_filepath, string output_asm, string output_c) {
+void write_layouts(const Json &layouts_data, string output_asm, string output_c) {
     output_asm = strip_trailing_separator(output_asm).append(sep);
     output_c = strip_trailing_separator(output_c).append(sep);
 
-    string err;
-    Json layouts_data = Json::parse(read_text_file(layouts_filepath), err);
-
-    if (layouts_data == Json())
-        FATAL_ERROR("%s\n", err.c_str());
-
     string layout_headers_text = generate_layout_headers_text(layouts_data);
     string layouts_table_text = generate_layouts_table_text(layouts_data);
     string layouts_constants_text = generate_layouts_constants_text(layouts_data);
@@ -672,6 +737,61 @@ void process_layouts(string layouts_filepath, string output_asm, string output_c
     write_text_file(output_c + "layouts.h", layouts_constants_text);
 }
 
+void process_layouts(string layouts_filepath, string output_asm, string output_c) {
+    string err;
+    Json layouts_data = Json::parse(read_text_file(layouts_filepath), err);
+
+    if (layouts_data == Json())
+        FATAL_ERROR("%s\n", err.c_str());
+
+    write_layouts(layouts_data, output_asm, output_c);
+}
+
+// Does the work of `layouts`, `groups`, `event_constants` and `map` for every
+// map file in one process: layouts.json and each map.json are parsed once,
+// the per-map outputs are generated across num_threads threads (each map's
+// files go next to its map.json), and only outputs whose text changed are
+// written.
+void process_all(string groups_filepath, string layouts_filepath, const vector<string> &map_filepaths,
+                 string output_maps, string output_layouts, string output_c, unsigned num_threads) {
+    Json layouts_data = read_json_file(layouts_filepath);
+    LayoutIndex layouts = index_layouts(layouts_data);
+
+    vector<Json> maps_data(map_filepaths.size());
+    atomic<size_t> next_map(0);
+
+    auto worker = [&]() {
+        for (size_t i = next_map++; i < map_filepaths.size(); i = next_map++) {
+            const string &map_filepath = map_filepaths[i];
+            Json map_data = read_json_file(map_filepath);
+
+            string out_dir = file_parent(map_filepath);
+            write_text_file(out_dir + "header.inc", generate_map_header_text(map_data, layouts));
+            write_text_file(out_dir + "events.inc", generate_map_events_text(map_data));
+            write_text_file(out_dir + "connections.inc", generate_map_connections_text(map_data));
+            maps_data[i] = map_data;
+        }
+    };
+
+    if (num_threads > map_filepaths.size())
+        num_threads = map_filepaths.size();
+
+    vector<thread> threads;
+    for (unsigned i = 1; i < num_threads; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (thread &t : threads)
+        t.join();
+
+    MapDataCache maps_by_name;
+    for (size_t i = 0; i < map_filepaths.size(); i++)
+        maps_by_name[map_dir_name(map_filepaths[i])] = maps_data[i];
+
+    write_layouts(layouts_data, output_layouts, output_c);
+    process_groups(groups_filepath, output_maps, output_c, &maps_by_name);
+    write_text_file(strip_trailing_separator(output_c) + sep + "map_event_ids.h", generate_event_constants_text(maps_data));
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 3)
         FATAL_ERROR("USAGE: mapjson <mode> <game-version> [options]\n");
@@ -732,8 +852,33 @@ int main(int argc, char *argv[]) {
 
         process_event_constants(filepaths, output_ids_file);
     }
+    else if (mode == "all") {
+        const char *usage = "USAGE: mapjson all <game-version> [-j <threads>] <groups_file> <layouts_file> <output_maps_dir> <output_layouts_dir> <output_c_dir> <map_file> [additional_map_files]\n";
+        int arg = 3;
+        unsigned num_threads = thread::hardware_concurrency();
+
+        if (argc > arg + 1 && string(argv[arg]) == "-j") {
+            num_threads = std::atoi(argv[arg + 1]);
+            arg += 2;
+        }
+        if (argc < arg + 6)
+            FATAL_ERROR("%s", usage);
+        if (num_threads == 0)
+            num_threads = 1;
+
+        infer_separator(argv[arg]);
+        string groups_filepath(argv[arg]);
+        string layouts_filepath(argv[arg + 1]);
+        string output_maps(argv[arg + 2]);
+        string output_layouts(argv[arg + 3]);
+        string output_c(argv[arg + 4]);
+        vector<string> map_filepaths(argv + arg + 5, argv + argc);
+
+        touch_unchanged = false;
+        process_all(groups_filepath, layouts_filepath, map_filepaths, output_maps, output_layouts, output_c, num_threads);
+    }
     else {
-        FATAL_ERROR("ERROR: <mode> must be 'layouts', 'map', 'event_constants', or 'groups'.\n");
+        FATAL_ERROR("ERROR: <mode> must be 'layouts', 'map', 'event_constants', 'groups', or 'all'.\n");
     }
 
     return 0;
@@ -0,0 +1,151 @@
+// Copyright(c) 2016 YamaArashi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "main.h"
+#include "midi.h"
+
+// The whole state of one MIDI -> AGB conversion: the input cursor, the
+// per-track MIDI state and the printer state. The reading half lives in
+// midi.cpp and the printing half in agb.cpp. Converters share no state, so
+// several songs can be converted at once on different threads.
+// The stages of converting one track, timed by -T.
+enum class Stage
+{
+    Read,
+    Merge,
+    Sort,
+    Split,
+    Waits,
+    Compress,
+    Print,
+    Count,
+};
+
+class Converter
+{
+public:
+    Converter(const Options& options, std::vector<std::uint8_t> input);
+
+    // Returns the assembly text for the whole song.
+    std::string Convert();
+
+private:
+    // midi.cpp
+    void Seek(long offset);
+    void Skip(long offset);
+    std::string ReadSignature();
+    std::uint32_t ReadInt8();
+    std::uint32_t ReadInt16();
+    std::uint32_t ReadInt24();
+    std::uint32_t ReadInt32();
+    std::uint32_t ReadVLQ();
+    void ReadMidiFileHeader();
+    long ReadMidiTrackHeader(long offset);
+    void StartTrack();
+    void SkipEventData();
+    void DetermineEventCategory(MidiEventCategory& category, int& typeChan, int& size);
+    void MakeBlockEvent(Event& event, EventType type);
+    std::string ReadEventText();
+    bool ReadSeqEvent(Event& event);
+    void ReadSeqEvents();
+    bool CheckNoteEnd(Event& event);
+    void FindNoteEnd(Event& event);
+    bool ReadTrackEvent(Event& event);
+    void ReadTrackEvents();
+    void MergeEvents();
+    void ConvertTime(Event event);
+    void InsertTimingEvents(const Event& event);
+    void CreateTies(const Event& event);
+    void SortEvents();
+    void SplitTime();
+    void CalculateWaits(std::vector<Event>& events);
+    void EndStage(Stage stage, std::size_t eventCount);
+    void ReadMidiTracks();
+
+    // agb.cpp
+    void Printf(const char *format, ...);
+    void VPrintf(const char *format, std::va_list args);
+    void PrintAgbHeader();
+    void ResetTrackVars();
+    void PrintWait(int wait);
+    void PrintOp(int wait, std::string name, const char *format, ...);
+    void PrintByte(const char *format, ...);
+    void PrintWord(const char *format, ...);
+    void PrintNote(const Event& event);
+    void PrintEndOfTieOp(const Event& event);
+    void PrintSeqLoopLabel(const Event& event);
+    void PrintMemAcc(const Event& event);
+    void PrintExtendedOp(const Event& event);
+    void PrintControllerOp(const Event& event);
+    void PrintAgbTrack(std::vector<Event>& events);
+    void PrintAgbFooter();
+
+    const Options m_options;
+
+    std::vector<std::uint8_t> m_input;
+    long m_inputPos = 0;
+    std::string m_output;
+
+    MidiFormat m_midiFormat = MidiFormat::SingleTrack;
+    std::int_fast32_t m_midiTrackCount = 0;
+    std::int16_t m_midiTimeDiv = 0;
+    int m_midiChan = 0;
+    std::int32_t m_initialWait = 0;
+    long m_trackDataStart = 0;
+    std::vector<Event> m_seqEvents;
+    std::vector<Event> m_trackEvents;
+    std::vector<Event> m_events;
+    std::vector<Event> m_sortBuffer;
+    Event m_timingEvent = {};
+    std::int32_t m_absoluteTime = 0;
+    int m_blockCount = 0;
+    int m_minNote = 0;
+    int m_maxNote = 0;
+    int m_runningStatus = 0;
+
+    int m_agbTrack = 0;
+    std::string m_lastOpName;
+    int m_blockNum = 0;
+    bool m_keepLastOpName = false;
+    int m_lastNote = 0;
+    int m_lastVelocity = 0;
+    bool m_noteChanged = false;
+    bool m_velocityChanged = false;
+    bool m_inPattern = false;
+    int m_extendedCommand = 0;
+    int m_memaccOp = 0;
+    int m_memaccParam1 = 0;
+    int m_memaccParam2 = 0;
+
+    std::chrono::steady_clock::time_point m_stageStart;
+    double m_stageMs[(int)Stage::Count] = {};
+    std::string m_stageLine;
+};
+
+#endif // CONVERTER_H
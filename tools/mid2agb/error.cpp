@@ -21,6 +21,17 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <string>
+#include "error.h"
+
+// Prefixed to the diagnostics of the current thread (the song being
+// converted in batch mode).
+static thread_local std::string s_errorContext;
+
+void SetErrorContext(const std::string& context)
+{
+    s_errorContext = context;
+}
 
 // Reports an error diagnostic and terminates the program.
 [[noreturn]] void RaiseError(const char* format, ...)
@@ -30,7 +41,10 @@
     std::va_list args;
     va_start(args, format);
     std::vsnprintf(buffer, bufferSize, format, args);
-    std::fprintf(stderr, "error: %s\n", buffer);
+    if (s_errorContext.empty())
+        std::fprintf(stderr, "error: %s\n", buffer);
+    else
+        std::fprintf(stderr, "error: %s: %s\n", s_errorContext.c_str(), buffer);
     va_end(args);
     std::exit(1);
 }
@@ -21,6 +21,9 @@
 #ifndef ERROR_H
 #define ERROR_H
 
+#include <string>
+
 [[noreturn]] void RaiseError(const char* format, ...);
+void SetErrorContext(const std::string& context);
 
 #endif // ERROR_H
@@ -23,29 +23,23 @@
 #include <cstring>
 #include <cctype>
 #include <cassert>
+#include <cstdint>
 #include <string>
-#include <set>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 #include "main.h"
 #include "error.h"
-#include "midi.h"
-#include "agb.h"
-
-FILE* g_inputFile = nullptr;
-FILE* g_outputFile = nullptr;
-
-std::string g_asmLabel;
-int g_masterVolume = 127;
-std::string g_voiceGroup = "_dummy";
-int g_priority = 0;
-int g_reverb = -1;
-int g_clocksPerBeat = 1;
-bool g_exactGateTime = false;
-bool g_compressionEnabled = true;
+#include "converter.h"
 
 [[noreturn]] static void PrintUsage()
 {
     std::printf(
         "Usage: MID2AGB name [options]\n"
+        "       MID2AGB --batch midi.cfg [-j threads] [options]\n"
         "\n"
         "    input_file  filename(.mid) of MIDI file\n"
         "   output_file  filename(.s) for AGB file (default:input_file)\n"
@@ -58,6 +52,12 @@ bool g_compressionEnabled = true;
         "            -X  48 clocks/beat (default:24 clocks/beat)\n"
         "            -E  exact gate-time\n"
         "            -N  no compression\n"
+        "            -T  print per-stage times and event counts of every track\n"
+        "\n"
+        "--batch converts every \"name.mid: options\" line of midi.cfg,\n"
+        "reading name.mid and writing name.s next to midi.cfg. Outputs\n"
+        "whose contents didn't change are left untouched. Options after\n"
+        "the config apply to every song.\n"
     );
     std::exit(1);
 }
@@ -102,24 +102,23 @@ static std::string BaseName(std::string s)
     return s;
 }
 
-static const char *GetArgument(int argc, char **argv, int& index)
+static const char *GetArgument(const std::vector<std::string>& args, std::size_t& index)
 {
-    assert(index >= 0 && index < argc);
+    assert(index < args.size());
 
-    const char *option = argv[index];
+    const std::string& option = args[index];
 
-    assert(option != nullptr);
     assert(option[0] == '-');
 
     // If there is text following the letter, return that.
-    if (std::strlen(option) >= 3)
-        return option + 2;
+    if (option.size() >= 3)
+        return option.c_str() + 2;
 
     // Otherwise, try to get the next arg.
-    if (index + 1 < argc)
+    if (index + 1 < args.size())
     {
         index++;
-        return argv[index];
+        return args[index].c_str();
     }
     else
     {
@@ -127,14 +126,13 @@ static const char *GetArgument(int argc, char **argv, int& index)
     }
 }
 
-int main(int argc, char** argv)
+// Parses the arguments of one conversion: the command line, or the
+// "input output options..." built from a midi.cfg line in batch mode.
+static void ParseArguments(const std::vector<std::string>& args, Options& options, std::string& inputFilename, std::string& outputFilename)
 {
-    std::string inputFilename;
-    std::string outputFilename;
-
-    for (int i = 1; i < argc; i++)
+    for (std::size_t i = 0; i < args.size(); i++)
     {
-        const char *option = argv[i];
+        const std::string& option = args[i];
 
         if (option[0] == '-' && option[1] != '\0')
         {
@@ -143,43 +141,46 @@ int main(int argc, char** argv)
             switch (std::toupper(option[1]))
             {
             case 'E':
-                g_exactGateTime = true;
+                options.exactGateTime = true;
                 break;
             case 'G':
-                arg = GetArgument(argc, argv, i);
+                arg = GetArgument(args, i);
                 if (arg == nullptr)
                     PrintUsage();
-                g_voiceGroup = arg;
+                options.voiceGroup = arg;
                 break;
             case 'L':
-                arg = GetArgument(argc, argv, i);
+                arg = GetArgument(args, i);
                 if (arg == nullptr)
                     PrintUsage();
-                g_asmLabel = arg;
+                options.asmLabel = arg;
                 break;
             case 'N':
-                g_compressionEnabled = false;
+                options.compressionEnabled = false;
                 break;
             case 'P':
-                arg = GetArgument(argc, argv, i);
+                arg = GetArgument(args, i);
                 if (arg == nullptr)
                     PrintUsage();
-                g_priority = std::stoi(arg);
+                options.priority = std::stoi(arg);
                 break;
             case 'R':
-                arg = GetArgument(argc, argv, i);
+                arg = GetArgument(args, i);
                 if (arg == nullptr)
                     PrintUsage();
-                g_reverb = std::stoi(arg);
+                options.reverb = std::stoi(arg);
+                break;
+            case 'T':
+                options.printStageTimes = true;
                 break;
             case 'V':
-                arg = GetArgument(argc, argv, i);
+                arg = GetArgument(args, i);
                 if (arg == nullptr)
                     PrintUsage();
-                g_masterVolume = std::stoi(arg);
+                options.masterVolume = std::stoi(arg);
                 break;
             case 'X':
-                g_clocksPerBeat = 2;
+                options.clocksPerBeat = 2;
                 break;
             default:
                 PrintUsage();
@@ -188,9 +189,9 @@ int main(int argc, char** argv)
         else
         {
             if (inputFilename.empty())
-                inputFilename = argv[i];
+                inputFilename = option;
             else if (outputFilename.empty())
-                outputFilename = argv[i];
+                outputFilename = option;
             else
                 PrintUsage();
         }
@@ -208,26 +209,165 @@ int main(int argc, char** argv)
     if (GetExtension(outputFilename) != "s")
         RaiseError("output filename extension is not \"s\"");
 
-    if (g_asmLabel.empty())
-        g_asmLabel = BaseName(outputFilename);
+    if (options.asmLabel.empty())
+        options.asmLabel = BaseName(outputFilename);
+}
+
+static std::vector<std::uint8_t> ReadInputFile(const std::string& filename)
+{
+    FILE *fp = std::fopen(filename.c_str(), "rb");
+
+    if (fp == nullptr)
+        RaiseError("failed to open \"%s\" for reading", filename.c_str());
+
+    std::vector<std::uint8_t> data;
+    std::uint8_t buffer[65536];
+    std::size_t count;
+
+    while ((count = std::fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        data.insert(data.end(), buffer, buffer + count);
 
-    g_inputFile = std::fopen(inputFilename.c_str(), "rb");
+    if (std::ferror(fp))
+        RaiseError("failed to read \"%s\"", filename.c_str());
 
-    if (g_inputFile == nullptr)
-        RaiseError("failed to open \"%s\" for reading", inputFilename.c_str());
+    std::fclose(fp);
+
+    return data;
+}
+
+static bool FileContentsEqual(const std::string& filename, const std::string& text)
+{
+    FILE *fp = std::fopen(filename.c_str(), "r");
 
-    g_outputFile = std::fopen(outputFilename.c_str(), "w");
+    if (fp == nullptr)
+        return false;
 
-    if (g_outputFile == nullptr)
-        RaiseError("failed to open \"%s\" for writing", outputFilename.c_str());
+    std::string existing;
+    char buffer[65536];
+    std::size_t count;
 
-    ReadMidiFileHeader();
-    PrintAgbHeader();
-    ReadMidiTracks();
-    PrintAgbFooter();
+    while ((count = std::fread(buffer, 1, sizeof(buffer), fp)) > 0 && existing.size() <= text.size())
+        existing.append(buffer, count);
+
+    std::fclose(fp);
+
+    return existing == text;
+}
+
+// With onlyIfChanged, an output that already holds this text keeps its mtime,
+// so make doesn't reassemble it.
+static void WriteOutputFile(const std::string& filename, const std::string& text, bool onlyIfChanged)
+{
+    if (onlyIfChanged && FileContentsEqual(filename, text))
+        return;
+
+    FILE *fp = std::fopen(filename.c_str(), "w");
+
+    if (fp == nullptr)
+        RaiseError("failed to open \"%s\" for writing", filename.c_str());
+
+    if (std::fwrite(text.data(), 1, text.size(), fp) != text.size() || std::fclose(fp) != 0)
+        RaiseError("failed to write \"%s\"", filename.c_str());
+}
+
+static void ConvertSong(const std::vector<std::string>& args, bool onlyIfChanged)
+{
+    Options options;
+    std::string inputFilename;
+    std::string outputFilename;
+
+    ParseArguments(args, options, inputFilename, outputFilename);
+
+    Converter converter(options, ReadInputFile(inputFilename));
+
+    WriteOutputFile(outputFilename, converter.Convert(), onlyIfChanged);
+}
+
+// Converts every song listed in a midi.cfg, the same way the per-song
+// audio_rules.mk rules would ("$(MID) name.mid name.s options"), spread
+// across a pool of threads.
+static void ConvertBatch(const std::string& configFilename, unsigned numThreads, const std::vector<std::string>& extraOptions)
+{
+    std::ifstream config(configFilename);
+
+    if (!config.is_open())
+        RaiseError("failed to open \"%s\" for reading", configFilename.c_str());
+
+    std::size_t slashPos = configFilename.find_last_of("/\\");
+    std::string dir = slashPos == std::string::npos ? "" : configFilename.substr(0, slashPos + 1);
+
+    std::vector<std::vector<std::string>> songs;
+    std::string line;
+
+    while (std::getline(config, line))
+    {
+        std::istringstream tokens(line);
+        std::string name;
+
+        if (!(tokens >> name))
+            continue;
+
+        // "name.mid:" or "name:", as accepted by audio_rules.mk.
+        if (name.back() == ':')
+            name.pop_back();
+        name = StripExtension(name);
+
+        std::vector<std::string> args = { dir + name + ".mid", dir + name + ".s" };
+        std::string option;
+
+        while (tokens >> option)
+            args.push_back(option);
+
+        args.insert(args.end(), extraOptions.begin(), extraOptions.end());
+
+        songs.push_back(args);
+    }
+
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (numThreads > songs.size())
+        numThreads = std::max<std::size_t>(1, songs.size());
+
+    std::atomic<std::size_t> nextSong(0);
+
+    auto worker = [&]()
+    {
+        for (std::size_t i = nextSong++; i < songs.size(); i = nextSong++)
+        {
+            SetErrorContext(songs[i][0]);
+            ConvertSong(songs[i], true);
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 1; i < numThreads; i++)
+        threads.emplace_back(worker);
+
+    worker();
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 3 && std::strcmp(argv[1], "--batch") == 0)
+    {
+        unsigned numThreads = 0;
+        int i = 3;
+
+        if (argc >= 5 && std::strcmp(argv[3], "-j") == 0)
+        {
+            numThreads = std::stoi(argv[4]);
+            i = 5;
+        }
+
+        ConvertBatch(argv[2], numThreads, std::vector<std::string>(argv + i, argv + argc));
+        return 0;
+    }
 
-    std::fclose(g_inputFile);
-    std::fclose(g_outputFile);
+    ConvertSong(std::vector<std::string>(argv + 1, argv + argc), false);
 
     return 0;
 }
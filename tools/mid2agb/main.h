@@ -18,22 +18,25 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+
 #ifndef MAIN_H
 #define MAIN_H
 
-#include <cstdio>
 #include <string>
 
-extern FILE* g_inputFile;
-extern FILE* g_outputFile;
-
-extern std::string g_asmLabel;
-extern int g_masterVolume;
-extern std::string g_voiceGroup;
-extern int g_priority;
-extern int g_reverb;
-extern int g_clocksPerBeat;
-extern bool g_exactGateTime;
-extern bool g_compressionEnabled;
+// Settings for converting one song, given on the command line or after the
+// colon of a midi.cfg line.
+struct Options
+{
+    std::string asmLabel;
+    int masterVolume = 127;
+    std::string voiceGroup = "_dummy";
+    int priority = 0;
+    int reverb = -1;
+    int clocksPerBeat = 1;
+    bool exactGateTime = false;
+    bool compressionEnabled = true;
+    bool printStageTimes = false;
+};
 
 #endif // MAIN_H
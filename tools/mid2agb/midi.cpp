@@ -19,74 +19,60 @@
 // THE SOFTWARE.
 
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <memory>
+#include <unordered_map>
+#include <chrono>
 #include "midi.h"
-#include "main.h"
+#include "converter.h"
 #include "error.h"
-#include "agb.h"
 #include "tables.h"
 
-enum class MidiEventCategory
+Converter::Converter(const Options& options, std::vector<std::uint8_t> input)
+    : m_options(options), m_input(std::move(input))
 {
-    Control,
-    SysEx,
-    Meta,
-    Invalid,
-};
-
-MidiFormat g_midiFormat;
-std::int_fast32_t g_midiTrackCount;
-std::int16_t g_midiTimeDiv;
-
-int g_midiChan;
-std::int32_t g_initialWait;
-
-static long s_trackDataStart;
-static std::vector<Event> s_seqEvents;
-static std::vector<Event> s_trackEvents;
-static std::int32_t s_absoluteTime;
-static int s_blockCount = 0;
-static int s_minNote;
-static int s_maxNote;
-static int s_runningStatus;
+}
 
-void Seek(long offset)
+// The input is read from memory. Seeking past the end is allowed, as it was
+// with fseek; only the following read fails.
+void Converter::Seek(long offset)
 {
-    if (std::fseek(g_inputFile, offset, SEEK_SET) != 0)
-        RaiseError("failed to seek to %l", offset);
+    if (offset < 0)
+        RaiseError("failed to seek to %ld", offset);
+
+    m_inputPos = offset;
 }
 
-void Skip(long offset)
+void Converter::Skip(long offset)
 {
-    if (std::fseek(g_inputFile, offset, SEEK_CUR) != 0)
-        RaiseError("failed to skip %l bytes", offset);
+    if (m_inputPos + offset < 0)
+        RaiseError("failed to skip %ld bytes", offset);
+
+    m_inputPos += offset;
 }
 
-std::string ReadSignature()
+std::string Converter::ReadSignature()
 {
-    char signature[4];
-
-    if (std::fread(signature, 4, 1, g_inputFile) != 1)
+    if (m_inputPos + 4 > (long)m_input.size())
         RaiseError("failed to read signature");
 
-    return std::string(signature, 4);
+    std::string signature(reinterpret_cast<const char *>(&m_input[m_inputPos]), 4);
+    m_inputPos += 4;
+    return signature;
 }
 
-std::uint32_t ReadInt8()
+std::uint32_t Converter::ReadInt8()
 {
-    int c = std::fgetc(g_inputFile);
-
-    if (c < 0)
+    if (m_inputPos >= (long)m_input.size())
         RaiseError("unexpected EOF");
 
-    return c;
+    return m_input[m_inputPos++];
 }
 
-std::uint32_t ReadInt16()
+std::uint32_t Converter::ReadInt16()
 {
     std::uint32_t val = 0;
     val |= ReadInt8() << 8;
@@ -94,7 +80,7 @@ std::uint32_t ReadInt16()
     return val;
 }
 
-std::uint32_t ReadInt24()
+std::uint32_t Converter::ReadInt24()
 {
     std::uint32_t val = 0;
     val |= ReadInt8() << 16;
@@ -103,7 +89,7 @@ std::uint32_t ReadInt24()
     return val;
 }
 
-std::uint32_t ReadInt32()
+std::uint32_t Converter::ReadInt32()
 {
     std::uint32_t val = 0;
     val |= ReadInt8() << 24;
@@ -113,7 +99,7 @@ std::uint32_t ReadInt32()
     return val;
 }
 
-std::uint32_t ReadVLQ()
+std::uint32_t Converter::ReadVLQ()
 {
     std::uint32_t val = 0;
     std::uint32_t c;
@@ -128,7 +114,7 @@ std::uint32_t ReadVLQ()
     return val;
 }
 
-void ReadMidiFileHeader()
+void Converter::ReadMidiFileHeader()
 {
     Seek(0);
 
@@ -145,15 +131,15 @@ void ReadMidiFileHeader()
     if (midiFormat >= 2)
         RaiseError("unsupported MIDI format (%u)", midiFormat);
 
-    g_midiFormat = (MidiFormat)midiFormat;
-    g_midiTrackCount = ReadInt16();
-    g_midiTimeDiv = ReadInt16();
+    m_midiFormat = (MidiFormat)midiFormat;
+    m_midiTrackCount = ReadInt16();
+    m_midiTimeDiv = ReadInt16();
 
-    if (g_midiTimeDiv < 0)
-        RaiseError("unsupported MIDI time division (%d)", g_midiTimeDiv);
+    if (m_midiTimeDiv < 0)
+        RaiseError("unsupported MIDI time division (%d)", m_midiTimeDiv);
 }
 
-long ReadMidiTrackHeader(long offset)
+long Converter::ReadMidiTrackHeader(long offset)
 {
     Seek(offset);
 
@@ -162,45 +148,45 @@ long ReadMidiTrackHeader(long offset)
 
     long size = ReadInt32();
 
-    s_trackDataStart = std::ftell(g_inputFile);
+    m_trackDataStart = m_inputPos;
 
     return size + 8;
 }
 
-void StartTrack()
+void Converter::StartTrack()
 {
-    Seek(s_trackDataStart);
-    s_absoluteTime = 0;
-    s_runningStatus = 0;
+    Seek(m_trackDataStart);
+    m_absoluteTime = 0;
+    m_runningStatus = 0;
 }
 
-void SkipEventData()
+void Converter::SkipEventData()
 {
     Skip(ReadVLQ());
 }
 
-void DetermineEventCategory(MidiEventCategory& category, int& typeChan, int& size)
+void Converter::DetermineEventCategory(MidiEventCategory& category, int& typeChan, int& size)
 {
     typeChan = ReadInt8();
 
     if (typeChan < 0x80)
     {
         // If data byte was found, use the running status.
-        ungetc(typeChan, g_inputFile);
-        typeChan = s_runningStatus;
+        m_inputPos--;
+        typeChan = m_runningStatus;
     }
 
     if (typeChan == 0xFF)
     {
         category = MidiEventCategory::Meta;
         size = 0;
-        s_runningStatus = 0;
+        m_runningStatus = 0;
     }
     else if (typeChan >= 0xF0)
     {
         category = MidiEventCategory::SysEx;
         size = 0;
-        s_runningStatus = 0;
+        m_runningStatus = 0;
     }
     else if (typeChan >= 0x80)
     {
@@ -216,7 +202,7 @@ void DetermineEventCategory(MidiEventCategory& category, int& typeChan, int& siz
             size = 2;
             break;
         }
-        s_runningStatus = typeChan;
+        m_runningStatus = typeChan;
     }
     else
     {
@@ -224,22 +210,26 @@ void DetermineEventCategory(MidiEventCategory& category, int& typeChan, int& siz
     }
 }
 
-void MakeBlockEvent(Event& event, EventType type)
+void Converter::MakeBlockEvent(Event& event, EventType type)
 {
     event.type = type;
-    event.param1 = s_blockCount++;
+    event.param1 = m_blockCount++;
     event.param2 = 0;
 }
 
-std::string ReadEventText()
+std::string Converter::ReadEventText()
 {
     char buffer[2];
     std::uint32_t length = ReadVLQ();
 
     if (length <= 2)
     {
-        if (fread(buffer, length, 1, g_inputFile) != 1)
+        // Like the fread this replaces, an empty text event is an error.
+        if (length == 0 || m_inputPos + (long)length > (long)m_input.size())
             RaiseError("failed to read event text");
+
+        std::memcpy(buffer, &m_input[m_inputPos], length);
+        m_inputPos += length;
     }
     else
     {
@@ -250,10 +240,10 @@ std::string ReadEventText()
     return std::string(buffer, length);
 }
 
-bool ReadSeqEvent(Event& event)
+bool Converter::ReadSeqEvent(Event& event)
 {
-    s_absoluteTime += ReadVLQ();
-    event.time = s_absoluteTime;
+    m_absoluteTime += ReadVLQ();
+    event.time = m_absoluteTime;
 
     MidiEventCategory category;
     int typeChan;
@@ -326,7 +316,7 @@ bool ReadSeqEvent(Event& event)
 
             Skip(2); // ignore other values
 
-            int clockTicks = 96 * numerator * g_clocksPerBeat;
+            int clockTicks = 96 * numerator * m_options.clocksPerBeat;
             int denominator = 1 << denominatorExponent;
             int timeSig = clockTicks / denominator;
 
@@ -347,7 +337,7 @@ bool ReadSeqEvent(Event& event)
     return true;
 }
 
-void ReadSeqEvents()
+void Converter::ReadSeqEvents()
 {
     StartTrack();
 
@@ -357,7 +347,7 @@ void ReadSeqEvents()
 
         if (ReadSeqEvent(event))
         {
-            s_seqEvents.push_back(event);
+            m_seqEvents.push_back(event);
 
             if (event.type == EventType::EndOfTrack)
                 return;
@@ -365,7 +355,7 @@ void ReadSeqEvents()
     }
 }
 
-bool CheckNoteEnd(Event& event)
+bool Converter::CheckNoteEnd(Event& event)
 {
     event.param2 += ReadVLQ();
 
@@ -379,7 +369,7 @@ bool CheckNoteEnd(Event& event)
     {
         int chan = typeChan & 0xF;
 
-        if (chan != g_midiChan)
+        if (chan != m_midiChan)
         {
             Skip(size);
             return false;
@@ -431,12 +421,12 @@ bool CheckNoteEnd(Event& event)
     RaiseError("invalid event");
 }
 
-void FindNoteEnd(Event& event)
+void Converter::FindNoteEnd(Event& event)
 {
     // Save the current file position and running status
     // which get modified by CheckNoteEnd.
-    long startPos = ftell(g_inputFile);
-    int savedRunningStatus = s_runningStatus;
+    long startPos = m_inputPos;
+    int savedRunningStatus = m_runningStatus;
 
     event.param2 = 0;
 
@@ -444,13 +434,13 @@ void FindNoteEnd(Event& event)
         ;
 
     Seek(startPos);
-    s_runningStatus = savedRunningStatus;
+    m_runningStatus = savedRunningStatus;
 }
 
-bool ReadTrackEvent(Event& event)
+bool Converter::ReadTrackEvent(Event& event)
 {
-    s_absoluteTime += ReadVLQ();
-    event.time = s_absoluteTime;
+    m_absoluteTime += ReadVLQ();
+    event.time = m_absoluteTime;
 
     MidiEventCategory category;
     int typeChan;
@@ -462,7 +452,7 @@ bool ReadTrackEvent(Event& event)
     {
         int chan = typeChan & 0xF;
 
-        if (chan != g_midiChan)
+        if (chan != m_midiChan)
         {
             Skip(size);
             return false;
@@ -483,10 +473,10 @@ bool ReadTrackEvent(Event& event)
                 FindNoteEnd(event);
                 if (event.param2 > 0)
                 {
-                    if (note < s_minNote)
-                        s_minNote = note;
-                    if (note > s_maxNote)
-                        s_maxNote = note;
+                    if (note < m_minNote)
+                        m_minNote = note;
+                    if (note > m_maxNote)
+                        m_maxNote = note;
                 }
             }
             break;
@@ -539,14 +529,14 @@ bool ReadTrackEvent(Event& event)
     RaiseError("invalid event");
 }
 
-void ReadTrackEvents()
+void Converter::ReadTrackEvents()
 {
     StartTrack();
 
-    s_trackEvents.clear();
+    m_trackEvents.clear();
 
-    s_minNote = 0xFF;
-    s_maxNote = 0;
+    m_minNote = 0xFF;
+    m_maxNote = 0;
 
     for (;;)
     {
@@ -554,7 +544,7 @@ void ReadTrackEvents()
 
         if (ReadTrackEvent(event))
         {
-            s_trackEvents.push_back(event);
+            m_trackEvents.push_back(event);
 
             if (event.type == EventType::EndOfTrack)
                 return;
@@ -597,102 +587,153 @@ bool EventCompare(const Event& event1, const Event& event2)
     return false;
 }
 
-std::unique_ptr<std::vector<Event>> MergeEvents()
+// MergeEvents streams every merged event through ConvertTime,
+// InsertTimingEvents and CreateTies straight into m_events, so expanding a
+// track is a single pass. The event buffers live as long as the converter
+// and only grow, so after the largest track nothing is allocated.
+void Converter::MergeEvents()
 {
-    std::unique_ptr<std::vector<Event>> events(new std::vector<Event>());
+    m_events.clear();
+    m_events.reserve(2 * (m_trackEvents.size() + m_seqEvents.size()));
+
+    m_timingEvent = {};
+    m_timingEvent.time = 0;
+    m_timingEvent.type = EventType::TimeSignature;
+    m_timingEvent.param2 = 96 * m_options.clocksPerBeat;
 
     unsigned trackEventPos = 0;
     unsigned seqEventPos = 0;
 
-    while (s_trackEvents[trackEventPos].type != EventType::EndOfTrack
-        && s_seqEvents[seqEventPos].type != EventType::EndOfTrack)
+    while (m_trackEvents[trackEventPos].type != EventType::EndOfTrack
+        && m_seqEvents[seqEventPos].type != EventType::EndOfTrack)
     {
-        if (EventCompare(s_trackEvents[trackEventPos], s_seqEvents[seqEventPos]))
-            events->push_back(s_trackEvents[trackEventPos++]);
+        if (EventCompare(m_trackEvents[trackEventPos], m_seqEvents[seqEventPos]))
+            ConvertTime(m_trackEvents[trackEventPos++]);
         else
-            events->push_back(s_seqEvents[seqEventPos++]);
+            ConvertTime(m_seqEvents[seqEventPos++]);
     }
 
-    while (s_trackEvents[trackEventPos].type != EventType::EndOfTrack)
-        events->push_back(s_trackEvents[trackEventPos++]);
+    while (m_trackEvents[trackEventPos].type != EventType::EndOfTrack)
+        ConvertTime(m_trackEvents[trackEventPos++]);
 
-    while (s_seqEvents[seqEventPos].type != EventType::EndOfTrack)
-        events->push_back(s_seqEvents[seqEventPos++]);
+    while (m_seqEvents[seqEventPos].type != EventType::EndOfTrack)
+        ConvertTime(m_seqEvents[seqEventPos++]);
 
     // Push the EndOfTrack event with the larger time.
-    if (EventCompare(s_trackEvents[trackEventPos], s_seqEvents[seqEventPos]))
-        events->push_back(s_seqEvents[seqEventPos]);
+    if (EventCompare(m_trackEvents[trackEventPos], m_seqEvents[seqEventPos]))
+        ConvertTime(m_seqEvents[seqEventPos]);
     else
-        events->push_back(s_trackEvents[trackEventPos]);
-
-    return events;
+        ConvertTime(m_trackEvents[trackEventPos]);
 }
 
-void ConvertTimes(std::vector<Event>& events)
+void Converter::ConvertTime(Event event)
 {
-    for (Event& event : events)
+    event.time = (24 * m_options.clocksPerBeat * event.time) / m_midiTimeDiv;
+
+    if (event.type == EventType::Note)
     {
-        event.time = (24 * g_clocksPerBeat * event.time) / g_midiTimeDiv;
+        event.param1 = g_noteVelocityLUT[event.param1];
 
-        if (event.type == EventType::Note)
-        {
-            event.param1 = g_noteVelocityLUT[event.param1];
+        std::uint32_t duration = (24 * m_options.clocksPerBeat * event.param2) / m_midiTimeDiv;
 
-            std::uint32_t duration = (24 * g_clocksPerBeat * event.param2) / g_midiTimeDiv;
+        if (duration == 0)
+            duration = 1;
 
-            if (duration == 0)
-                duration = 1;
+        if (!m_options.exactGateTime && duration < 96)
+            duration = g_noteDurationLUT[duration];
 
-            if (!g_exactGateTime && duration < 96)
-                duration = g_noteDurationLUT[duration];
+        event.param2 = duration;
+    }
 
-            event.param2 = duration;
+    InsertTimingEvents(event);
+}
+
+void Converter::InsertTimingEvents(const Event& event)
+{
+    while (EventCompare(m_timingEvent, event))
+    {
+        CreateTies(m_timingEvent);
+        m_timingEvent.time += m_timingEvent.param2;
+    }
+
+    if (event.type == EventType::TimeSignature)
+    {
+        if (m_agbTrack == 1 && event.param2 != m_timingEvent.param2)
+        {
+            Event originalTimingEvent = event;
+            originalTimingEvent.type = EventType::OriginalTimeSignature;
+            CreateTies(originalTimingEvent);
         }
+        m_timingEvent.param2 = event.param2;
+        m_timingEvent.time = event.time + m_timingEvent.param2;
+    }
+
+    CreateTies(event);
+}
+
+void Converter::CreateTies(const Event& event)
+{
+    if (event.type == EventType::Note && event.param2 > 96)
+    {
+        Event tieEvent = event;
+        tieEvent.param2 = -1;
+        m_events.push_back(tieEvent);
+
+        Event eotEvent = {};
+        eotEvent.time = event.time + event.param2;
+        eotEvent.type = EventType::EndOfTie;
+        eotEvent.note = event.note;
+        m_events.push_back(eotEvent);
+    }
+    else
+    {
+        m_events.push_back(event);
     }
 }
 
-std::unique_ptr<std::vector<Event>> InsertTimingEvents(std::vector<Event>& inEvents)
+// Stable bottom-up merge sort through m_sortBuffer; std::stable_sort would
+// allocate a temporary buffer for every track. The events are nearly sorted
+// already (only the EndOfTie events are out of place), so most merges are
+// skipped.
+void Converter::SortEvents()
 {
-    std::unique_ptr<std::vector<Event>> outEvents(new std::vector<Event>());
+    std::size_t count = m_events.size();
+
+    m_sortBuffer.resize(count);
 
-    Event timingEvent = {};
-    timingEvent.time = 0;
-    timingEvent.type = EventType::TimeSignature;
-    timingEvent.param2 = 96 * g_clocksPerBeat;
+    std::vector<Event> *from = &m_events;
+    std::vector<Event> *to = &m_sortBuffer;
 
-    for (const Event& event : inEvents)
+    for (std::size_t width = 1; width < count; width *= 2)
     {
-        while (EventCompare(timingEvent, event))
+        for (std::size_t lo = 0; lo < count; lo += 2 * width)
         {
-            outEvents->push_back(timingEvent);
-            timingEvent.time += timingEvent.param2;
-        }
+            std::size_t mid = std::min(lo + width, count);
+            std::size_t hi = std::min(lo + 2 * width, count);
 
-        if (event.type == EventType::TimeSignature)
-        {
-            if (g_agbTrack == 1 && event.param2 != timingEvent.param2)
-            {
-                Event originalTimingEvent = event;
-                originalTimingEvent.type = EventType::OriginalTimeSignature;
-                outEvents->push_back(originalTimingEvent);
-            }
-            timingEvent.param2 = event.param2;
-            timingEvent.time = event.time + timingEvent.param2;
+            if (mid == hi || !EventCompare((*from)[mid], (*from)[mid - 1]))
+                std::copy(from->begin() + lo, from->begin() + hi, to->begin() + lo);
+            else
+                std::merge(from->begin() + lo, from->begin() + mid, from->begin() + mid, from->begin() + hi, to->begin() + lo, EventCompare);
         }
 
-        outEvents->push_back(event);
+        std::swap(from, to);
     }
 
-    return outEvents;
+    if (from != &m_events)
+        m_events.swap(m_sortBuffer);
 }
 
-std::unique_ptr<std::vector<Event>> SplitTime(std::vector<Event>& inEvents)
+// Inserts the TimeSplit events in place: the first pass counts them, the
+// second moves every event back to its final position, starting from the
+// end so nothing is overwritten before it has been read.
+void Converter::SplitTime()
 {
-    std::unique_ptr<std::vector<Event>> outEvents(new std::vector<Event>());
-
+    std::size_t count = m_events.size();
+    std::size_t splitCount = 0;
     std::int32_t time = 0;
 
-    for (const Event& event : inEvents)
+    for (const Event& event : m_events)
     {
         std::int32_t diff = event.time - time;
 
@@ -700,65 +741,58 @@ std::unique_ptr<std::vector<Event>> SplitTime(std::vector<Event>& inEvents)
         {
             int wholeNoteCount = (diff - 1) / 96;
             diff -= 96 * wholeNoteCount;
-
-            for (int i = 0; i < wholeNoteCount; i++)
-            {
-                time += 96;
-                Event timeSplitEvent = {};
-                timeSplitEvent.time = time;
-                timeSplitEvent.type = EventType::TimeSplit;
-                outEvents->push_back(timeSplitEvent);
-            }
+            splitCount += wholeNoteCount;
         }
 
-        std::int32_t lutValue = g_noteDurationLUT[diff];
-
-        if (lutValue != diff)
-        {
-            Event timeSplitEvent = {};
-            timeSplitEvent.time = time + lutValue;
-            timeSplitEvent.type = EventType::TimeSplit;
-            outEvents->push_back(timeSplitEvent);
-        }
+        if (g_noteDurationLUT[diff] != diff)
+            splitCount++;
 
         time = event.time;
-
-        outEvents->push_back(event);
     }
 
-    return outEvents;
-}
+    m_events.resize(count + splitCount);
 
-std::unique_ptr<std::vector<Event>> CreateTies(std::vector<Event>& inEvents)
-{
-    std::unique_ptr<std::vector<Event>> outEvents(new std::vector<Event>());
+    std::size_t out = count + splitCount;
 
-    for (const Event& event : inEvents)
+    for (std::size_t i = count; i-- > 0;)
     {
-        if (event.type == EventType::Note && event.param2 > 96)
+        Event event = m_events[i];
+        time = i > 0 ? m_events[i - 1].time : 0;
+
+        m_events[--out] = event;
+
+        std::int32_t diff = event.time - time;
+        int wholeNoteCount = 0;
+
+        if (diff > 96)
         {
-            Event tieEvent = event;
-            tieEvent.param2 = -1;
-            outEvents->push_back(tieEvent);
-
-            Event eotEvent = {};
-            eotEvent.time = event.time + event.param2;
-            eotEvent.type = EventType::EndOfTie;
-            eotEvent.note = event.note;
-            outEvents->push_back(eotEvent);
+            wholeNoteCount = (diff - 1) / 96;
+            diff -= 96 * wholeNoteCount;
         }
-        else
+
+        std::int32_t lutValue = g_noteDurationLUT[diff];
+
+        if (lutValue != diff)
         {
-            outEvents->push_back(event);
+            Event timeSplitEvent = {};
+            timeSplitEvent.time = time + 96 * wholeNoteCount + lutValue;
+            timeSplitEvent.type = EventType::TimeSplit;
+            m_events[--out] = timeSplitEvent;
         }
-    }
 
-    return outEvents;
+        for (int j = wholeNoteCount; j > 0; j--)
+        {
+            Event timeSplitEvent = {};
+            timeSplitEvent.time = time + 96 * j;
+            timeSplitEvent.type = EventType::TimeSplit;
+            m_events[--out] = timeSplitEvent;
+        }
+    }
 }
 
-void CalculateWaits(std::vector<Event>& events)
+void Converter::CalculateWaits(std::vector<Event>& events)
 {
-    g_initialWait = events[0].time;
+    m_initialWait = events[0].time;
     int wholeNoteCount = 0;
 
     for (unsigned i = 0; i < events.size() && events[i].type != EventType::EndOfTrack; i++)
@@ -873,92 +907,195 @@ bool IsCompressionMatch(std::vector<Event>& events, int index1, int index2)
     return IsPatternBoundary(events[index2].type);
 }
 
-void CompressWholeNote(std::vector<Event>& events, int index)
+static std::uint64_t HashCombine(std::uint64_t hash, std::uint64_t value)
 {
-    for (int j = index + 1; events[j].type != EventType::EndOfTrack; j++)
-    {
-        while (events[j].type != EventType::WholeNoteMark)
-        {
-            j++;
+    hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+    return hash * 0xFF51AFD7ED558CCDull;
+}
 
-            if (events[j].type == EventType::EndOfTrack)
-                return;
-        }
+static std::uint64_t HashEvent(std::uint64_t hash, const Event& event)
+{
+    hash = HashCombine(hash, (std::uint32_t)event.time);
+    hash = HashCombine(hash, ((std::uint64_t)event.type << 16) | (event.note << 8) | event.param1);
+    return HashCombine(hash, (std::uint32_t)event.param2);
+}
 
-        if (IsCompressionMatch(events, index, j))
-        {
-            events[j].type = EventType::Pattern;
-            events[j].param2 = events[index].param2 & 0x7FFFFFFF;
-            events[index].param2 |= 0x80000000;
-        }
-    }
+// Hashes exactly what IsCompressionMatch compares: the mark's time, note and
+// param1, then the events up to the next pattern boundary.
+static std::uint64_t HashWholeNote(std::vector<Event>& events, int index)
+{
+    std::uint64_t hash = HashCombine(0, (std::uint32_t)events[index].time);
+    hash = HashCombine(hash, (events[index].note << 8) | events[index].param1);
+
+    int i = index + 1;
+
+    do
+    {
+        hash = HashEvent(hash, events[i]);
+        i++;
+    } while (!IsPatternBoundary(events[i].type));
+
+    return hash;
 }
 
+// The first whole note seen with a given body, and whether it scores high
+// enough to become a pattern.
+struct PatternCandidate
+{
+    int index;
+    bool compress;
+};
+
+// Every later whole note identical to a high-scoring one is replaced with a
+// PATT to it. Matching is an equivalence and identical whole notes score the
+// same, so comparing each whole note only with the first of its kind gives
+// the same result as comparing it with every earlier one, in linear time.
 void Compress(std::vector<Event>& events)
 {
+    std::unordered_map<std::uint64_t, std::vector<PatternCandidate>> candidates;
+
     for (int i = 0; events[i].type != EventType::EndOfTrack; i++)
     {
-        while (events[i].type != EventType::WholeNoteMark)
-        {
-            i++;
+        // An empty whole note scores at most 1, so it can't be a pattern.
+        if (events[i].type != EventType::WholeNoteMark || IsPatternBoundary(events[i + 1].type))
+            continue;
 
-            if (events[i].type == EventType::EndOfTrack)
-                return;
-        }
+        std::vector<PatternCandidate>& bucket = candidates[HashWholeNote(events, i)];
+        bool found = false;
 
-        if (CalculateCompressionScore(events, i) >= 6)
+        for (const PatternCandidate& candidate : bucket)
         {
-            CompressWholeNote(events, i);
+            if (IsCompressionMatch(events, candidate.index, i))
+            {
+                if (candidate.compress)
+                {
+                    events[i].type = EventType::Pattern;
+                    events[i].param2 = events[candidate.index].param2 & 0x7FFFFFFF;
+                    events[candidate.index].param2 |= 0x80000000;
+                }
+
+                found = true;
+                break;
+            }
         }
+
+        if (!found)
+            bucket.push_back({ i, CalculateCompressionScore(events, i) >= 6 });
     }
 }
 
-void ReadMidiTracks()
+static const char *const s_stageNames[] = {
+    "read",
+    "merge",
+    "sort",
+    "split",
+    "waits",
+    "compress",
+    "print",
+};
+
+// Ends the current pipeline stage of the track being converted (-T only).
+void Converter::EndStage(Stage stage, std::size_t eventCount)
+{
+    if (!m_options.printStageTimes)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(now - m_stageStart).count();
+
+    m_stageStart = now;
+    m_stageMs[(int)stage] += ms;
+
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), " %s %.3f ms %zu ev,", s_stageNames[(int)stage], ms, eventCount);
+    m_stageLine += buffer;
+}
+
+void Converter::ReadMidiTracks()
 {
     long trackHeaderStart = 14;
 
     ReadMidiTrackHeader(trackHeaderStart);
     ReadSeqEvents();
 
-    g_agbTrack = 1;
+    m_agbTrack = 1;
 
-    for (int midiTrack = 0; midiTrack < g_midiTrackCount; midiTrack++)
+    for (int midiTrack = 0; midiTrack < m_midiTrackCount; midiTrack++)
     {
         trackHeaderStart += ReadMidiTrackHeader(trackHeaderStart);
 
-        for (g_midiChan = 0; g_midiChan < 16; g_midiChan++)
+        for (m_midiChan = 0; m_midiChan < 16; m_midiChan++)
         {
+            m_stageStart = std::chrono::steady_clock::now();
+            m_stageLine.clear();
+
             ReadTrackEvents();
+            EndStage(Stage::Read, m_trackEvents.size());
 
-            if (s_minNote != 0xFF)
+            if (m_minNote != 0xFF)
             {
 #ifdef DEBUG
-                printf("Track%d = Midi-Ch.%d\n", g_agbTrack, g_midiChan + 1);
+                printf("Track%d = Midi-Ch.%d\n", m_agbTrack, m_midiChan + 1);
 #endif
 
-                std::unique_ptr<std::vector<Event>> events(MergeEvents());
+                MergeEvents();
 
                 // We don't need TEMPO in anything but track 1.
-                if (g_agbTrack == 1)
+                if (m_agbTrack == 1)
                 {
-                    auto it = std::remove_if(s_seqEvents.begin(), s_seqEvents.end(), [](const Event& event) { return event.type == EventType::Tempo; });
-                    s_seqEvents.erase(it, s_seqEvents.end());
+                    auto it = std::remove_if(m_seqEvents.begin(), m_seqEvents.end(), [](const Event& event) { return event.type == EventType::Tempo; });
+                    m_seqEvents.erase(it, m_seqEvents.end());
                 }
 
-                ConvertTimes(*events);
-                events = InsertTimingEvents(*events);
-                events = CreateTies(*events);
-                std::stable_sort(events->begin(), events->end(), EventCompare);
-                events = SplitTime(*events);
-                CalculateWaits(*events);
+                EndStage(Stage::Merge, m_events.size());
+                SortEvents();
+                EndStage(Stage::Sort, m_events.size());
+                SplitTime();
+                EndStage(Stage::Split, m_events.size());
+                CalculateWaits(m_events);
+                EndStage(Stage::Waits, m_events.size());
 
-                if (g_compressionEnabled)
-                    Compress(*events);
+                if (m_options.compressionEnabled)
+                    Compress(m_events);
 
-                PrintAgbTrack(*events);
+                EndStage(Stage::Compress, m_events.size());
 
-                g_agbTrack++;
+                PrintAgbTrack(m_events);
+                EndStage(Stage::Print, m_events.size());
+
+                if (m_options.printStageTimes)
+                {
+                    m_stageLine.pop_back();
+                    std::fprintf(stderr, "%s track %d (ch %d):%s\n", m_options.asmLabel.c_str(), m_agbTrack, m_midiChan + 1, m_stageLine.c_str());
+                }
+
+                m_agbTrack++;
             }
         }
     }
+
+    if (m_options.printStageTimes)
+    {
+        std::string line;
+        char buffer[64];
+
+        for (int stage = 0; stage < (int)Stage::Count; stage++)
+        {
+            std::snprintf(buffer, sizeof(buffer), " %s %.3f ms,", s_stageNames[stage], m_stageMs[stage]);
+            line += buffer;
+        }
+
+        line.pop_back();
+        std::fprintf(stderr, "%s total (%d tracks):%s\n", m_options.asmLabel.c_str(), m_agbTrack - 1, line.c_str());
+    }
+}
+
+std::string Converter::Convert()
+{
+    ReadMidiFileHeader();
+    PrintAgbHeader();
+    ReadMidiTracks();
+    PrintAgbFooter();
+
+    return std::move(m_output);
 }
@@ -29,6 +29,14 @@ enum class MidiFormat
     MultiTrack
 };
 
+enum class MidiEventCategory
+{
+    Control,
+    SysEx,
+    Meta,
+    Invalid,
+};
+
 enum class EventType
 {
     EndOfTie = 0x01,
@@ -73,12 +81,6 @@ struct Event
     }
 };
 
-void ReadMidiFileHeader();
-void ReadMidiTracks();
-
-extern int g_midiChan;
-extern std::int32_t g_initialWait;
-
 inline bool IsPatternBoundary(EventType type)
 {
     return type == EventType::EndOfTrack || (int)type <= 0x17;
@@ -1,16 +1,20 @@
-"""CLI del harness de debug visual: screenshot/boot/read sobre la ROM debug.
+"""CLI del harness de debug visual: screenshot/boot/read/profile sobre la ROM debug.
 
 La ROM por defecto es la de PHANTOM_DEBUG_BOOT (arranca directo al overworld,
-sin navegar título ni minijuego) -- ver Makefile y src/intro.c.
+sin navegar título ni minijuego) -- ver Makefile y src/intro.c. `profile` usa
+por defecto la misma variante con FRAME_PROFILER=1 (sufijo _debug_prof), que es
+la única que tiene gFrameProfile.
 """
 import argparse
+import os
+import sys
 
 from .emu import Emu
 from .symbols import SymbolReader
 
-DEF_ROM = "pokeemerald_modern_debug.gba"
-DEF_MAP = "pokeemerald_modern_debug.map"
-DEF_ELF = "pokeemerald_modern_debug.elf"
+DEF_BUILD = "pokeemerald_modern_debug"
+DEF_PROFILE_BUILD = "pokeemerald_modern_debug_prof"  # make modern PHANTOM_DEBUG_BOOT=1 FRAME_PROFILER=1
+FRAME_CYCLES = 280896  # PROFILER_FRAME_CYCLES, include/frame_profiler.h
 
 
 def boot(emu, frames=600):
@@ -18,11 +22,23 @@ def boot(emu, frames=600):
     emu.run(frames)
 
 
+def format_profile(profile):
+    """Tabla de SymbolReader.frame_profile(), con el avg como % del frame."""
+    lines = [f"{'zone':<16}{'min':>8}{'avg':>8}{'max':>8}{'calls':>7}{'avg%':>7}"]
+    for zone, s in profile.items():
+        if s["samples"] == 0:
+            lines.append(f"{zone:<16}{'-':>8}{'-':>8}{'-':>8}{0:>7}{'-':>7}")
+            continue
+        pct = 100.0 * s["avg"] / FRAME_CYCLES
+        lines.append(f"{zone:<16}{s['min']:>8}{s['avg']:>8}{s['max']:>8}{s['samples']:>7}{pct:>6.1f}%")
+    return "\n".join(lines)
+
+
 def main(argv=None):
     p = argparse.ArgumentParser(prog="phantom_dbg")
-    p.add_argument("--rom", default=DEF_ROM)
-    p.add_argument("--map", default=DEF_MAP)
-    p.add_argument("--elf", default=DEF_ELF)
+    p.add_argument("--rom")
+    p.add_argument("--map")
+    p.add_argument("--elf")
     sub = p.add_subparsers(dest="cmd", required=True)
     s = sub.add_parser("screenshot")
     s.add_argument("out")
@@ -35,8 +51,20 @@ def main(argv=None):
     r.add_argument("kind", choices=["var", "flag"])
     r.add_argument("id")
     r.add_argument("--frames", type=int, default=600)
+    pr = sub.add_parser("profile")
+    pr.add_argument("--frames", type=int, default=600)
     args = p.parse_args(argv)
 
+    build = DEF_PROFILE_BUILD if args.cmd == "profile" else DEF_BUILD
+    args.rom = args.rom or build + ".gba"
+    args.map = args.map or build + ".map"
+    args.elf = args.elf or build + ".elf"
+    if args.cmd == "profile" and not os.path.exists(args.map):
+        print(f"{args.map}: no existe; `profile` necesita una ROM compilada con FRAME_PROFILER=1 "
+              f"(p. ej. make modern PHANTOM_DEBUG_BOOT=1 FRAME_PROFILER=1 -> {DEF_PROFILE_BUILD}.gba)",
+              file=sys.stderr)
+        return 1
+
     emu = Emu(args.rom)
     emu.run(args.frames)
     if args.cmd == "screenshot":
@@ -52,4 +80,13 @@ def main(argv=None):
         sr = SymbolReader(emu, args.map, args.elf)
         v = sr.read_var(int(args.id, 0)) if args.kind == "var" else sr.read_flag(int(args.id, 0))
         print(v)
+    elif args.cmd == "profile":
+        sr = SymbolReader(emu, args.map, args.elf)
+        try:
+            profile = sr.frame_profile()
+        except RuntimeError as e:
+            print(f"{e} (p. ej. make modern PHANTOM_DEBUG_BOOT=1 FRAME_PROFILER=1 -> {DEF_PROFILE_BUILD}.gba)",
+                  file=sys.stderr)
+            return 1
+        print(format_profile(profile))
     return 0
@@ -10,9 +10,12 @@ SPECIAL_FLAGS_START = 0x4000  # include/constants/flags.h
 class SymbolReader:
     def __init__(self, emu, map_path, elf_path):
         self.emu = emu
+        self._map_path = map_path
         self._globals = self._parse_map(map_path)
         self._elf_path = elf_path
         self._offset_cache = {}
+        self._size_cache = {}
+        self._enum_cache = {}
 
     def _parse_map(self, map_path):
         g = {}
@@ -48,6 +51,38 @@ class SymbolReader:
                                 return off
         raise KeyError(f"offset no encontrado: {struct}.{field}")
 
+    def _find_die(self, tag, name):
+        with open(self._elf_path, "rb") as f:
+            dwarf = ELFFile(f).get_dwarf_info()
+            for cu in dwarf.iter_CUs():
+                for die in cu.iter_DIEs():
+                    if (die.tag == tag
+                            and die.attributes.get("DW_AT_name")
+                            and die.attributes["DW_AT_name"].value == name.encode()
+                            and not die.attributes.get("DW_AT_declaration")):
+                        yield die
+
+    def struct_size(self, struct):
+        if struct not in self._size_cache:
+            for die in self._find_die("DW_TAG_structure_type", struct):
+                self._size_cache[struct] = die.attributes["DW_AT_byte_size"].value
+                break
+            else:
+                raise KeyError(f"struct no encontrado: {struct}")
+        return self._size_cache[struct]
+
+    def enum_values(self, enum):
+        """{nombre: valor} de los enumeradores de `enum <enum>` (p. ej. ProfilerZone)."""
+        if enum not in self._enum_cache:
+            for die in self._find_die("DW_TAG_enumeration_type", enum):
+                self._enum_cache[enum] = {
+                    ch.attributes["DW_AT_name"].value.decode(): ch.attributes["DW_AT_const_value"].value
+                    for ch in die.iter_children() if ch.tag == "DW_TAG_enumerator"}
+                break
+            else:
+                raise KeyError(f"enum no encontrado: {enum}")
+        return self._enum_cache[enum]
+
     # --- alto nivel ---
     def _sb1(self):
         return self.emu.mem_u32(self.global_addr("gSaveBlock1Ptr"))
@@ -78,3 +113,29 @@ class SymbolReader:
         x = self.emu.mem_u16(base + self.struct_offset("Coords16", "x"))
         y = self.emu.mem_u16(base + self.struct_offset("Coords16", "y"))
         return (x, y)
+
+    def frame_profile(self):
+        """Última ventana cerrada del profiler de frame (src/frame_profiler.c).
+
+        Devuelve {zona: {"min", "avg", "max", "samples"}} en ciclos por
+        llamada, con las zonas de `enum ProfilerZone` en minúsculas y sin el
+        prefijo PROFILER_ZONE_. Requiere una ROM con FRAME_PROFILER=1 (si el
+        .map no tiene gFrameProfile levanta RuntimeError); la ventana se
+        cierra cada PROFILER_WINDOW_FRAMES (60) frames.
+        """
+        if "gFrameProfile" not in self._globals:
+            raise RuntimeError(f"{self._map_path}: no tiene gFrameProfile; hace falta una ROM "
+                               "compilada con FRAME_PROFILER=1")
+        base = self.global_addr("gFrameProfile")
+        size = self.struct_size("ProfilerZoneStats")
+        fields = {f: self.struct_offset("ProfilerZoneStats", f)
+                  for f in ("min", "avg", "max", "samples")}
+        zones = self.enum_values("ProfilerZone")
+        out = {}
+        for name, idx in sorted(zones.items(), key=lambda kv: kv[1]):
+            if name == "PROFILER_ZONE_COUNT":
+                continue
+            addr = base + idx * size
+            out[name[len("PROFILER_ZONE_"):].lower()] = {
+                f: self.emu.mem_u32(addr + off) for f, off in fields.items()}
+        return out
@@ -25,14 +25,18 @@
 #include <memory>
 #include <cstring>
 #include <cerrno>
+#include <cstdlib>
+#include <set>
+#include <vector>
 #include "preproc.h"
 #include "c_file.h"
 #include "char_util.h"
 #include "utf8.h"
 #include "string_parser.h"
 #include "io.h"
+#include "incbin_cache.h"
 
-CFile::CFile(const char * filenameCStr, bool isStdin)
+CFile::CFile(const char * filenameCStr, bool isStdin, bool incbinAsm)
 {
     if (isStdin)
         m_filename = std::string{"<stdin>/"}.append(filenameCStr);
@@ -44,15 +48,20 @@ CFile::CFile(const char * filenameCStr, bool isStdin)
     m_pos = 0;
     m_lineNum = 1;
     m_isStdin = isStdin;
+    m_incbinAsm = incbinAsm;
+    m_scannedDeclarations = false;
 }
 
-CFile::CFile(CFile&& other) : m_filename(std::move(other.m_filename))
+CFile::CFile(CFile&& other) : m_filename(std::move(other.m_filename)), m_output(std::move(other.m_output))
 {
     m_buffer = other.m_buffer;
     m_pos = other.m_pos;
     m_size = other.m_size;
     m_lineNum = other.m_lineNum;
     m_isStdin = other.m_isStdin;
+    m_incbinAsm = other.m_incbinAsm;
+    m_scannedDeclarations = other.m_scannedDeclarations;
+    m_declaredArrays = std::move(other.m_declaredArrays);
 
     other.m_buffer = NULL;
 }
@@ -62,6 +71,13 @@ CFile::~CFile()
     free(m_buffer);
 }
 
+// Characters that may change the state of the main loop: the start of a
+// _("...") string or an INCBIN_*, a quote, or a line count update.
+static bool IsSpecialChar(char c)
+{
+    return c == '_' || c == 'I' || c == '"' || c == '\'' || c == '\n';
+}
+
 void CFile::Preproc()
 {
     char stringChar = 0;
@@ -70,28 +86,50 @@ void CFile::Preproc()
     {
         if (stringChar)
         {
+            // Copy the run of plain characters inside the literal in bulk.
+            long start = m_pos;
+
+            while (m_pos < m_size && m_buffer[m_pos] != stringChar && m_buffer[m_pos] != '\\' && m_buffer[m_pos] != '\n')
+                m_pos++;
+
+            m_output.Write(&m_buffer[start], m_pos - start);
+
+            if (m_pos >= m_size)
+                break;
+
             if (m_buffer[m_pos] == stringChar)
             {
-                std::putchar(stringChar);
+                m_output.Put(stringChar);
                 m_pos++;
                 stringChar = 0;
             }
             else if (m_buffer[m_pos] == '\\' && m_buffer[m_pos + 1] == stringChar)
             {
-                std::putchar('\\');
-                std::putchar(stringChar);
+                m_output.Put('\\');
+                m_output.Put(stringChar);
                 m_pos += 2;
             }
             else
             {
                 if (m_buffer[m_pos] == '\n')
                     m_lineNum++;
-                std::putchar(m_buffer[m_pos]);
+                m_output.Put(m_buffer[m_pos]);
                 m_pos++;
             }
         }
         else
         {
+            // Copy the run of source that needs no conversion in bulk.
+            long start = m_pos;
+
+            while (m_pos < m_size && !IsSpecialChar(m_buffer[m_pos]))
+                m_pos++;
+
+            m_output.Write(&m_buffer[start], m_pos - start);
+
+            if (m_pos >= m_size)
+                break;
+
             TryConvertString();
             TryConvertIncbin();
 
@@ -100,7 +138,7 @@ void CFile::Preproc()
 
             char c = m_buffer[m_pos++];
 
-            std::putchar(c);
+            m_output.Put(c);
 
             if (c == '\n')
                 m_lineNum++;
@@ -110,6 +148,8 @@ void CFile::Preproc()
                 stringChar = '\'';
         }
     }
+
+    m_output.Flush();
 }
 
 bool CFile::ConsumeHorizontalWhitespace()
@@ -129,7 +169,7 @@ bool CFile::ConsumeNewline()
     {
         m_pos += 2;
         m_lineNum++;
-        std::putchar('\n');
+        m_output.Put('\n');
         return true;
     }
 
@@ -137,7 +177,7 @@ bool CFile::ConsumeNewline()
     {
         m_pos++;
         m_lineNum++;
-        std::putchar('\n');
+        m_output.Put('\n');
         return true;
     }
 
@@ -180,7 +220,7 @@ void CFile::TryConvertString()
 
     SkipWhitespace();
 
-    std::printf("{ ");
+    m_output.Write("{ ", 2);
 
     while (1)
     {
@@ -202,7 +242,10 @@ void CFile::TryConvertString()
             }
 
             for (int i = 0; i < length; i++)
-                printf("0x%02X, ", s[i]);
+            {
+                m_output.WriteHexByte(s[i]);
+                m_output.Write(", ", 2);
+            }
         }
         else if (m_buffer[m_pos] == ')')
         {
@@ -221,9 +264,9 @@ void CFile::TryConvertString()
     }
 
     if (noTerminator)
-        std::printf(" }");
+        m_output.Write(" }", 2);
     else
-        std::printf("0xFF }");
+        m_output.Write("0xFF }", 6);
 }
 
 bool CFile::CheckIdentifier(const std::string& ident)
@@ -237,48 +280,6 @@ bool CFile::CheckIdentifier(const std::string& ident)
     return (i == ident.length());
 }
 
-std::unique_ptr<unsigned char[]> CFile::ReadWholeFile(const std::string& path, int& size)
-{
-    FILE* fp = std::fopen(path.c_str(), "rb");
-
-    if (fp == nullptr)
-        RaiseError("Failed to open \"%s\" for reading.\n", path.c_str());
-
-    std::fseek(fp, 0, SEEK_END);
-
-    size = std::ftell(fp);
-
-    std::unique_ptr<unsigned char[]> buffer = std::unique_ptr<unsigned char[]>(new unsigned char[size]);
-
-    std::rewind(fp);
-
-    if (std::fread(buffer.get(), size, 1, fp) != 1)
-        RaiseError("Failed to read \"%s\".\n", path.c_str());
-
-    std::fclose(fp);
-
-    return buffer;
-}
-
-int ExtractData(const std::unique_ptr<unsigned char[]>& buffer, int offset, int size)
-{
-    switch (size)
-    {
-    case 1:
-        return buffer[offset];
-    case 2:
-        return (buffer[offset + 1] << 8)
-            | buffer[offset];
-    case 4:
-        return (buffer[offset + 3] << 24)
-            | (buffer[offset + 2] << 16)
-            | (buffer[offset + 1] << 8)
-            | buffer[offset];
-    default:
-        FATAL_ERROR("Invalid size passed to ExtractData.\n");
-    }
-}
-
 void CFile::TryConvertIncbin()
 {
     std::string idents[6] = { "INCBIN_S8", "INCBIN_U8", "INCBIN_S16", "INCBIN_U16", "INCBIN_S32", "INCBIN_U32" };
@@ -315,7 +316,10 @@ void CFile::TryConvertIncbin()
 
     m_pos++;
 
-    std::printf("{");
+    if (m_incbinAsm && TryConvertIncbinToAsm(oldPos, size))
+        return;
+
+    m_output.Put('{');
 
     while (true)
     {
@@ -351,24 +355,25 @@ void CFile::TryConvertIncbin()
 
         m_pos++;
 
-        int fileSize;
-        std::unique_ptr<unsigned char[]> buffer = ReadWholeFile(path, fileSize);
+        MappedFile file(path);
 
-        if ((fileSize % size) != 0)
-            RaiseError("Size %d doesn't evenly divide file size %d.\n", size, fileSize);
+        if (!file.IsOpen())
+            RaiseError("Failed to open \"%s\" for reading.\n", path.c_str());
 
-        int count = fileSize / size;
-        int offset = 0;
+        long fileSize = file.Size();
 
-        for (int i = 0; i < count; i++)
-        {
-            int data = ExtractData(buffer, offset, size);
-            offset += size;
+        if ((fileSize % size) != 0)
+            RaiseError("Size %d doesn't evenly divide file size %ld.\n", size, fileSize);
 
-            if (isSigned)
-                std::printf("%d,", data);
-            else
-                std::printf("%uu,", data);
+        if (g_incbinCache != nullptr)
+        {
+            g_incbinCache->Write(m_output, file.Data(), fileSize, size, isSigned);
+        }
+        else
+        {
+            m_incbinText.clear();
+            FormatIncbinElements(m_incbinText, file.Data(), fileSize, size, isSigned);
+            m_output.Write(m_incbinText.data(), m_incbinText.size());
         }
 
         SkipWhitespace();
@@ -384,7 +389,260 @@ void CFile::TryConvertIncbin()
 
     m_pos++;
 
-    std::printf("}");
+    m_output.Put('}');
+}
+
+static bool IsHorizontalWhitespace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// Returns whether `word` appears in `text` as a whole identifier, and if so
+// its position in `pos`.
+static bool FindWord(const std::string& text, const std::string& word, std::size_t& pos)
+{
+    for (pos = text.find(word); pos != std::string::npos; pos = text.find(word, pos + 1))
+    {
+        std::size_t end = pos + word.length();
+
+        if ((pos == 0 || !IsIdentifierChar(text[pos - 1]))
+            && (end == text.length() || !IsIdentifierChar(text[end])))
+            return true;
+    }
+
+    return false;
+}
+
+// Returns whether the source contains `name[];` anywhere. The names are
+// collected in one pass over the file the first time this is called.
+bool CFile::HasTentativeDeclaration(const std::string& name)
+{
+    if (!m_scannedDeclarations)
+    {
+        for (long pos = 0; pos < m_size; pos++)
+        {
+            if (m_buffer[pos] != '[' || m_buffer[pos + 1] != ']')
+                continue;
+
+            long end = pos + 2;
+
+            while (IsHorizontalWhitespace(m_buffer[end]))
+                end++;
+
+            if (m_buffer[end] != ';')
+                continue;
+
+            long nameEnd = pos;
+
+            while (nameEnd > 0 && IsHorizontalWhitespace(m_buffer[nameEnd - 1]))
+                nameEnd--;
+
+            long nameStart = nameEnd;
+
+            while (nameStart > 0 && IsIdentifierChar(m_buffer[nameStart - 1]))
+                nameStart--;
+
+            if (nameStart < nameEnd)
+                m_declaredArrays.insert(std::string(&m_buffer[nameStart], nameEnd - nameStart));
+        }
+
+        m_scannedDeclarations = true;
+    }
+
+    return m_declaredArrays.count(name) != 0;
+}
+
+// Pass-through mode (-a). A single-line declaration of the form
+//   [static] <type> [attributes] name[] = INCBIN_XX("path", ...);
+// is turned into a top-level asm block that places the files in .rodata with
+// .incbin, followed by an extern declaration of the array with its size, so
+// cc1 never sees the data. Anything else (non-const arrays, nested
+// initializers, sized arrays, multi-line declarations) returns false and falls
+// back to an array literal.
+// m_pos is just past the '(' of the INCBIN.
+bool CFile::TryConvertIncbinToAsm(long identPos, int size)
+{
+    long lineStart = identPos;
+
+    while (lineStart > 0 && m_buffer[lineStart - 1] != '\n')
+        lineStart--;
+
+    long declEnd = identPos;
+
+    while (declEnd > lineStart && IsHorizontalWhitespace(m_buffer[declEnd - 1]))
+        declEnd--;
+
+    if (declEnd == lineStart || m_buffer[declEnd - 1] != '=')
+        return false;
+
+    declEnd--;
+
+    while (declEnd > lineStart && IsHorizontalWhitespace(m_buffer[declEnd - 1]))
+        declEnd--;
+
+    std::string decl(&m_buffer[lineStart], declEnd - lineStart);
+
+    if (decl.length() < 3 || !IsIdentifierStartingChar(decl[0])
+        || decl.compare(decl.length() - 2, 2, "[]") != 0
+        || decl.find_first_of("\"'=;{}") != std::string::npos)
+        return false;
+
+    long nameEnd = decl.length() - 2;
+
+    while (nameEnd > 0 && IsHorizontalWhitespace(decl[nameEnd - 1]))
+        nameEnd--;
+
+    long nameStart = nameEnd;
+
+    while (nameStart > 0 && IsIdentifierChar(decl[nameStart - 1]))
+        nameStart--;
+
+    if (nameStart == nameEnd || nameStart == 0)
+        return false;
+
+    // Only read-only arrays can move to .rodata; a writable one must stay a
+    // literal so it keeps landing in RAM. The const has to qualify the
+    // element, i.e. come after the last '*' of the declarator.
+    std::size_t elementStart = decl.rfind('*', nameStart);
+    std::size_t wordPos;
+
+    elementStart = (elementStart == std::string::npos) ? 0 : elementStart + 1;
+
+    if (!FindWord(decl.substr(elementStart, nameStart - elementStart), "const", wordPos))
+        return false;
+
+    std::string name = decl.substr(nameStart, nameEnd - nameStart);
+    std::vector<std::string> paths;
+    long pos = m_pos;
+
+    while (true)
+    {
+        while (IsHorizontalWhitespace(m_buffer[pos]))
+            pos++;
+
+        if (m_buffer[pos] != '"')
+            return false;
+
+        long pathStart = ++pos;
+
+        while (m_buffer[pos] != '"')
+        {
+            if (m_buffer[pos] == 0 || m_buffer[pos] == '\r' || m_buffer[pos] == '\n' || m_buffer[pos] == '\\')
+                return false;
+            pos++;
+        }
+
+        paths.push_back(std::string(&m_buffer[pathStart], pos - pathStart));
+        pos++;
+
+        while (IsHorizontalWhitespace(m_buffer[pos]))
+            pos++;
+
+        if (m_buffer[pos] != ',')
+            break;
+
+        pos++;
+    }
+
+    if (m_buffer[pos] != ')')
+        return false;
+
+    long closePos = pos++;
+
+    while (IsHorizontalWhitespace(m_buffer[pos]))
+        pos++;
+
+    if (m_buffer[pos] != ';')
+        return false;
+
+    long totalSize = 0;
+
+    for (const std::string& path : paths)
+    {
+        FILE* fp = std::fopen(path.c_str(), "rb");
+
+        if (fp == nullptr)
+            RaiseError("Failed to open \"%s\" for reading.\n", path.c_str());
+
+        std::fseek(fp, 0, SEEK_END);
+        long fileSize = std::ftell(fp);
+        std::fclose(fp);
+
+        if ((fileSize % size) != 0)
+            RaiseError("Size %d doesn't evenly divide file size %ld.\n", size, fileSize);
+
+        totalSize += fileSize;
+    }
+
+    if (totalSize == 0)
+        return false;
+
+    bool isStatic = FindWord(decl, "static", wordPos);
+
+    // A prior `static <type> name[];` is a tentative definition, which would
+    // turn into a second definition once the array here is only extern.
+    if (isStatic && HasTentativeDeclaration(name))
+        return false;
+
+    // The declaration was already copied to the output; take it back.
+    if (!m_output.Unwrite(&m_buffer[lineStart], identPos - lineStart))
+        return false;
+
+    if (isStatic)
+    {
+        std::size_t wordEnd = wordPos + 6;
+
+        while (wordEnd < decl.length() && IsHorizontalWhitespace(decl[wordEnd]))
+            wordEnd++;
+        decl.erase(wordPos, wordEnd - wordPos);
+    }
+
+    int alignment = size;
+
+    for (const std::string word : { "aligned", "__aligned__" })
+    {
+        if (FindWord(decl, word, wordPos) && decl[wordPos + word.length()] == '(')
+        {
+            int requested = std::atoi(&decl[wordPos + word.length() + 1]);
+
+            if (requested > alignment)
+                alignment = requested;
+        }
+    }
+
+    // Static arrays get a local label, which the assembler binds to the
+    // extern reference in this same object.
+    m_output.WriteString("__asm__(\".pushsection .rodata\\n\\t.balign ");
+    m_output.WriteUnsigned(alignment);
+    m_output.WriteString("\\n");
+    if (!isStatic)
+    {
+        m_output.WriteString("\\t.global ");
+        m_output.WriteString(name.c_str());
+        m_output.WriteString("\\n");
+    }
+    m_output.WriteString("\\t.type ");
+    m_output.WriteString(name.c_str());
+    m_output.WriteString(", %object\\n");
+    m_output.WriteString(name.c_str());
+    m_output.WriteString(":\\n");
+    for (const std::string& path : paths)
+    {
+        m_output.WriteString("\\t.incbin \\\"");
+        m_output.WriteString(path.c_str());
+        m_output.WriteString("\\\"\\n");
+    }
+    m_output.WriteString("\\t.size ");
+    m_output.WriteString(name.c_str());
+    m_output.WriteString(", .-");
+    m_output.WriteString(name.c_str());
+    m_output.WriteString("\\n\\t.popsection\"); extern ");
+    m_output.Write(decl.c_str(), decl.length() - 1);
+    m_output.WriteUnsigned(totalSize / size);
+    m_output.Put(']');
+
+    m_pos = closePos + 1;
+    return true;
 }
 
 // Reports a diagnostic message.
@@ -23,14 +23,16 @@
 
 #include <cstdarg>
 #include <cstdint>
+#include <set>
 #include <string>
 #include <memory>
 #include "preproc.h"
+#include "io.h"
 
 class CFile
 {
 public:
-    CFile(const char * filenameCStr, bool isStdin);
+    CFile(const char * filenameCStr, bool isStdin, bool incbinAsm);
     CFile(CFile&& other);
     CFile(const CFile&) = delete;
     ~CFile();
@@ -43,14 +45,20 @@ private:
     long m_lineNum;
     std::string m_filename;
     bool m_isStdin;
+    bool m_incbinAsm;
+    bool m_scannedDeclarations;
+    std::set<std::string> m_declaredArrays;
+    std::string m_incbinText;
+    OutputBuffer m_output;
 
     bool ConsumeHorizontalWhitespace();
     bool ConsumeNewline();
     void SkipWhitespace();
     void TryConvertString();
-    std::unique_ptr<unsigned char[]> ReadWholeFile(const std::string& path, int& size);
     bool CheckIdentifier(const std::string& ident);
     void TryConvertIncbin();
+    bool TryConvertIncbinToAsm(long identPos, int size);
+    bool HasTentativeDeclaration(const std::string& name);
     void ReportDiagnostic(const char* type, const char* format, std::va_list args);
     void RaiseError(const char* format, ...);
     void RaiseWarning(const char* format, ...);
@@ -0,0 +1,150 @@
+// Copyright(c) 2016 YamaArashi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include "preproc.h"
+#include "incbin_cache.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define MakeDirectory(path) _mkdir(path)
+#define getpid _getpid
+#else
+#include <unistd.h>
+#define MakeDirectory(path) mkdir(path, 0777)
+#endif
+
+IncbinCache *g_incbinCache;
+
+static unsigned int ExtractData(const unsigned char *data, int size)
+{
+    switch (size)
+    {
+    case 1:
+        return data[0];
+    case 2:
+        return (data[1] << 8)
+            | data[0];
+    case 4:
+        return ((unsigned int)data[3] << 24)
+            | (data[2] << 16)
+            | (data[1] << 8)
+            | data[0];
+    default:
+        FATAL_ERROR("Invalid size passed to ExtractData.\n");
+    }
+}
+
+void FormatIncbinElements(std::string& dest, const unsigned char *data, long size, int elementSize, bool isSigned)
+{
+    // Worst case per element: a sign, the digits and the "u," suffix.
+    long count = size / elementSize;
+    std::size_t start = dest.size();
+
+    dest.resize(start + count * (kMaxNumberLength + 2));
+
+    char *out = &dest[start];
+
+    for (long i = 0; i < count; i++, data += elementSize)
+    {
+        unsigned int value = ExtractData(data, elementSize);
+
+        // Matches the historical "%d," output: only 32-bit values can come
+        // out negative, since 8/16-bit reads are zero-extended.
+        if (isSigned && elementSize == 4 && (value & 0x80000000))
+        {
+            *out++ = '-';
+            value = 0u - value;
+        }
+
+        out += FormatUnsigned(out, value);
+
+        if (!isSigned)
+            *out++ = 'u';
+        *out++ = ',';
+    }
+
+    dest.resize(out - dest.data());
+}
+
+// 64-bit FNV-1a.
+static unsigned long long HashBytes(const unsigned char *data, long size)
+{
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+
+    for (long i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+IncbinCache::IncbinCache(const std::string& dir) : m_dir(dir)
+{
+    if (MakeDirectory(dir.c_str()) != 0 && errno != EEXIST)
+        FATAL_ERROR("Failed to create INCBIN cache directory \"%s\". (error: %s)\n", dir.c_str(), std::strerror(errno));
+}
+
+void IncbinCache::Write(OutputBuffer& output, const unsigned char *data, long size, int elementSize, bool isSigned)
+{
+    char name[64];
+
+    std::snprintf(name, sizeof(name), "/%016llx-%ld-%c%d.txt", HashBytes(data, size), size, isSigned ? 's' : 'u', elementSize * 8);
+
+    std::string path = m_dir + name;
+
+    {
+        MappedFile cached(path);
+
+        if (cached.IsOpen())
+        {
+            output.Write(reinterpret_cast<const char *>(cached.Data()), cached.Size());
+            return;
+        }
+    }
+
+    m_text.clear();
+    FormatIncbinElements(m_text, data, size, elementSize, isSigned);
+    output.Write(m_text.data(), m_text.size());
+
+    // Entries are written to a unique temporary name and renamed into place,
+    // so that concurrent preproc processes never see a partial entry. A
+    // failure to store one is not an error; it just isn't cached.
+    char suffix[32];
+
+    std::snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+
+    std::string tmpPath = path + suffix;
+    FILE *fp = std::fopen(tmpPath.c_str(), "wb");
+
+    if (fp == NULL)
+        return;
+
+    bool ok = std::fwrite(m_text.data(), 1, m_text.size(), fp) == m_text.size();
+
+    if (std::fclose(fp) != 0 || !ok || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+        std::remove(tmpPath.c_str());
+}
@@ -18,16 +18,31 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
-#ifndef AGB_H
-#define AGB_H
+#ifndef INCBIN_CACHE_H_
+#define INCBIN_CACHE_H_
 
-#include <vector>
-#include "midi.h"
+#include <string>
+#include "io.h"
 
-void PrintAgbHeader();
-void PrintAgbTrack(std::vector<Event>& events);
-void PrintAgbFooter();
+// Appends the elements of an INCBIN_* file to `dest` in array literal form
+// ("1u,2u," or "1,2,"), reading `elementSize`-byte little-endian values.
+void FormatIncbinElements(std::string& dest, const unsigned char *data, long size, int elementSize, bool isSigned);
 
-extern int g_agbTrack;
+// Persistent cache of formatted INCBIN_* elements, addressed by the hash and
+// size of the file contents and the element type. Each entry is a file in
+// the cache directory, so that the same asset INCBIN'd from several TUs, or
+// unchanged between builds, is only formatted once.
+class IncbinCache
+{
+public:
+    IncbinCache(const std::string& dir);
+    void Write(OutputBuffer& output, const unsigned char *data, long size, int elementSize, bool isSigned);
 
-#endif // AGB_H
+private:
+    std::string m_dir;
+    std::string m_text;
+};
+
+extern IncbinCache *g_incbinCache;
+
+#endif // INCBIN_CACHE_H_
@@ -4,6 +4,13 @@
 #include <cerrno>
 #include <cstring>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 char *ReadFileToBuffer(const char *filename, bool isStdin, long *size)
 {
     FILE *fp;
@@ -49,3 +56,190 @@ char *ReadFileToBuffer(const char *filename, bool isStdin, long *size)
     std::fclose(fp);
     return buffer;
 }
+
+void OutputBuffer::Write(const char *s, long length)
+{
+    if (length >= kCapacity)
+    {
+        Flush();
+        if (std::fwrite(s, 1, length, stdout) != (std::size_t)length)
+            FATAL_ERROR("Failed to write output. (error: %s)", std::strerror(errno));
+        return;
+    }
+
+    Reserve(length);
+    std::memcpy(&m_data[m_size], s, length);
+    m_size += length;
+}
+
+void OutputBuffer::WriteString(const char *s)
+{
+    Write(s, std::strlen(s));
+}
+
+void OutputBuffer::WriteUnsigned(unsigned int value)
+{
+    Reserve(kMaxNumberLength);
+    m_size += FormatUnsigned(&m_data[m_size], value);
+}
+
+void OutputBuffer::WriteHexByte(unsigned char value)
+{
+    static const char hexDigits[] = "0123456789ABCDEF";
+
+    Reserve(4);
+    m_data[m_size++] = '0';
+    m_data[m_size++] = 'x';
+    m_data[m_size++] = hexDigits[value >> 4];
+    m_data[m_size++] = hexDigits[value & 0xF];
+}
+
+// Removes the last `length` bytes of output if they are still buffered and
+// equal to `s`. Returns whether they were removed.
+bool OutputBuffer::Unwrite(const char *s, long length)
+{
+    if (length > m_size || std::memcmp(&m_data[m_size - length], s, length) != 0)
+        return false;
+
+    m_size -= length;
+    return true;
+}
+
+// Writes out everything up to the last buffered newline, or the whole buffer
+// if that doesn't free `length` bytes.
+void OutputBuffer::MakeRoom(long length)
+{
+    long keep = 0;
+
+    for (long i = m_size; i > 0; i--)
+    {
+        if (m_data[i - 1] == '\n')
+        {
+            keep = m_size - i;
+            break;
+        }
+    }
+
+    if (keep + length > kCapacity)
+    {
+        Flush();
+        return;
+    }
+
+    long flushSize = m_size - keep;
+
+    if (flushSize > 0 && std::fwrite(m_data.get(), 1, flushSize, stdout) != (std::size_t)flushSize)
+        FATAL_ERROR("Failed to write output. (error: %s)", std::strerror(errno));
+
+    std::memmove(m_data.get(), &m_data[flushSize], keep);
+    m_size = keep;
+}
+
+void OutputBuffer::Flush()
+{
+    if (m_size > 0 && std::fwrite(m_data.get(), 1, m_size, stdout) != (std::size_t)m_size)
+        FATAL_ERROR("Failed to write output. (error: %s)", std::strerror(errno));
+    m_size = 0;
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) : m_isOpen(false), m_isMapped(false), m_data(nullptr), m_size(0)
+{
+    FILE *fp = std::fopen(path.c_str(), "rb");
+
+    if (fp == NULL)
+        return;
+
+    std::fseek(fp, 0, SEEK_END);
+    m_size = std::ftell(fp);
+    std::rewind(fp);
+
+    unsigned char *data = new unsigned char[m_size > 0 ? m_size : 1];
+
+    if (m_size > 0 && std::fread(data, m_size, 1, fp) != 1)
+    {
+        delete[] data;
+        std::fclose(fp);
+        return;
+    }
+
+    std::fclose(fp);
+    m_data = data;
+    m_isOpen = true;
+}
+
+MappedFile::~MappedFile()
+{
+    delete[] m_data;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) : m_isOpen(false), m_isMapped(false), m_data(nullptr), m_size(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return;
+    }
+
+    m_size = st.st_size;
+
+    if (m_size >= kMinMappedSize)
+    {
+        void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            m_data = static_cast<const unsigned char *>(data);
+            m_isMapped = true;
+            m_isOpen = true;
+        }
+    }
+    else
+    {
+        // Setting up and tearing down a mapping costs more than a plain
+        // read for the small files that most INCBINs are.
+        unsigned char *data = new unsigned char[m_size > 0 ? m_size : 1];
+        long done = 0;
+
+        while (done < m_size)
+        {
+            ssize_t count = read(fd, data + done, m_size - done);
+
+            if (count <= 0)
+                break;
+            done += count;
+        }
+
+        if (done == m_size)
+        {
+            m_data = data;
+            m_isOpen = true;
+        }
+        else
+        {
+            delete[] data;
+        }
+    }
+
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_isMapped)
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+    else
+        delete[] m_data;
+}
+
+#endif // _WIN32
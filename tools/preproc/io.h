@@ -1,8 +1,95 @@
 #ifndef IO_H_
 #define IO_H_
 
+#include <memory>
+#include <string>
+
 #define CHUNK_SIZE 4096
 
 char *ReadFileToBuffer(const char *filename, bool isStdin, long *size);
 
+// Collects output in a large buffer that is written to stdout with a single
+// fwrite whenever it fills up, instead of one stdio call per byte/element.
+// The line being written is kept buffered when possible so that it can still
+// be taken back with Unwrite.
+class OutputBuffer
+{
+public:
+    OutputBuffer() : m_data(new char[kCapacity]), m_size(0) {}
+    OutputBuffer(OutputBuffer&& other) = default;
+    ~OutputBuffer() { if (m_data) Flush(); }
+
+    void Put(char c)
+    {
+        if (m_size == kCapacity)
+            MakeRoom(1);
+        m_data[m_size++] = c;
+    }
+
+    void Write(const char *s, long length);
+    void WriteString(const char *s);
+    void WriteUnsigned(unsigned int value);
+    void WriteHexByte(unsigned char value);
+    bool Unwrite(const char *s, long length);
+    void Flush();
+
+private:
+    static const long kCapacity = 1 << 16;
+
+    std::unique_ptr<char[]> m_data;
+    long m_size;
+
+    void Reserve(long length)
+    {
+        if (m_size + length > kCapacity)
+            MakeRoom(length);
+    }
+
+    void MakeRoom(long length);
+};
+
+// A read-only view of a whole file. Large files are memory-mapped where the
+// platform supports it; the rest are read into memory.
+class MappedFile
+{
+public:
+    MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+    bool IsOpen() const { return m_isOpen; }
+    const unsigned char *Data() const { return m_data; }
+    long Size() const { return m_size; }
+
+private:
+    static const long kMinMappedSize = 1 << 16;
+
+    bool m_isOpen;
+    bool m_isMapped;
+    const unsigned char *m_data;
+    long m_size;
+};
+
+// Longest formatted integer: "-2147483648"
+const int kMaxNumberLength = 11;
+
+// Writes the decimal digits of `value` to `dest` (not NUL-terminated) and
+// returns how many were written.
+inline int FormatUnsigned(char *dest, unsigned int value)
+{
+    char digits[kMaxNumberLength];
+    int count = 0;
+
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    for (int i = 0; i < count; i++)
+        dest[i] = digits[count - 1 - i];
+
+    return count;
+}
+
 #endif // IO_H_
@@ -18,6 +18,7 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <cstring>
 #include <string>
 #include <stack>
 #include <unistd.h>
@@ -25,6 +26,7 @@
 #include "asm_file.h"
 #include "c_file.h"
 #include "charmap.h"
+#include "incbin_cache.h"
 
 #ifdef _WIN32
 #include <io.h>
@@ -118,9 +120,9 @@ void PreprocAsmFile(std::string filename, bool isStdin, bool doEnum)
     }
 }
 
-void PreprocCFile(const char * filename, bool isStdin)
+void PreprocCFile(const char * filename, bool isStdin, bool incbinAsm)
 {
-    CFile cFile(filename, isStdin);
+    CFile cFile(filename, isStdin, incbinAsm);
     cFile.Preproc();
 }
 
@@ -147,20 +149,109 @@ const char* GetFileExtension(const char* filename)
 
 static void UsageAndExit(const char *program)
 {
-    std::fprintf(stderr, "Usage: %s [-i] [-e] SRC_FILE CHARMAP_FILE\nwhere -i denotes if input is from stdin\n      -e enables enum handling\n", program);
+    std::fprintf(stderr,
+        "Usage: %s [-i] [-e] [-a] [-c CACHE_DIR] SRC_FILE CHARMAP_FILE\n"
+        "       %s [-a] [-c CACHE_DIR] -b JOB_FILE CHARMAP_FILE\n"
+        "where -i denotes if input is from stdin\n"
+        "      -e enables enum handling\n"
+        "      -a emits INCBIN_* array definitions as .incbin in a top-level\n"
+        "         asm block where possible, instead of an array literal\n"
+        "      -c keeps the formatted elements of INCBIN_* files in CACHE_DIR,\n"
+        "         keyed by file contents, and reuses them in later runs\n"
+        "      -b processes every job in JOB_FILE (\"-\" for stdin) with a single\n"
+        "         charmap load; each line is \"[-e] SRC_FILE OUT_FILE\"\n",
+        program, program);
     std::exit(EXIT_FAILURE);
 }
 
+static void PreprocFile(const char *source, bool isStdin, bool doEnum, bool incbinAsm)
+{
+    const char* extension = GetFileExtension(source);
+
+    if (!extension)
+        FATAL_ERROR("\"%s\" has no file extension.\n", source);
+
+    if ((extension[0] == 's') && extension[1] == 0)
+    {
+        PreprocAsmFile(source, isStdin, doEnum);
+    }
+    else if ((extension[0] == 'c' || extension[0] == 'i') && extension[1] == 0)
+    {
+        if (doEnum)
+            FATAL_ERROR("-e is invalid for C sources\n");
+        PreprocCFile(source, isStdin, incbinAsm);
+    }
+    else
+    {
+        FATAL_ERROR("\"%s\" has an unknown file extension of \"%s\".\n", source, extension);
+    }
+}
+
+// Runs each job of a job list, redirecting stdout to the job's output file.
+// Any error still terminates the whole run, like a single-file invocation.
+static void PreprocBatch(const char *jobFile, bool incbinAsm)
+{
+    bool fromStdin = std::strcmp(jobFile, "-") == 0;
+    FILE *fp = fromStdin ? stdin : std::fopen(jobFile, "r");
+
+    if (fp == NULL)
+        FATAL_ERROR("Failed to open \"%s\" for reading.\n", jobFile);
+
+    char line[2 * kMaxPath + 8];
+    int lineNum = 0;
+
+    while (std::fgets(line, sizeof(line), fp) != NULL)
+    {
+        lineNum++;
+
+        char *tokens[3];
+        int numTokens = 0;
+
+        for (char *token = std::strtok(line, " \t\r\n"); token != NULL; token = std::strtok(NULL, " \t\r\n"))
+        {
+            if (numTokens == 3)
+                FATAL_ERROR("%s:%d: too many fields in job\n", jobFile, lineNum);
+            tokens[numTokens++] = token;
+        }
+
+        if (numTokens == 0)
+            continue;
+
+        bool doEnum = (numTokens == 3);
+
+        if (numTokens < 2 || (doEnum && std::strcmp(tokens[0], "-e") != 0))
+            FATAL_ERROR("%s:%d: expected \"[-e] SRC_FILE OUT_FILE\"\n", jobFile, lineNum);
+
+        const char *source = tokens[numTokens - 2];
+        const char *output = tokens[numTokens - 1];
+
+        if (std::freopen(output, "wb", stdout) == NULL)
+            FATAL_ERROR("Failed to open \"%s\" for writing.\n", output);
+
+        PreprocFile(source, false, doEnum, incbinAsm);
+    }
+
+    if (!fromStdin)
+        std::fclose(fp);
+
+    std::fflush(stdout);
+}
+
 int main(int argc, char **argv)
 {
     int opt;
     const char *source = NULL;
     const char *charmap = NULL;
+    const char *jobFile = NULL;
     bool isStdin = false;
     bool doEnum = false;
+    bool incbinAsm = false;
 
-    /* preproc [-i] [-e] SRC_FILE CHARMAP_FILE */
-    while ((opt = getopt(argc, argv, "ie")) != -1)
+    const char *cacheDir = NULL;
+
+    /* preproc [-i] [-e] [-a] [-c CACHE_DIR] SRC_FILE CHARMAP_FILE */
+    /* preproc [-a] [-c CACHE_DIR] -b JOB_FILE CHARMAP_FILE */
+    while ((opt = getopt(argc, argv, "ieab:c:")) != -1)
     {
         switch (opt)
         {
@@ -170,44 +261,51 @@ int main(int argc, char **argv)
         case 'e':
             doEnum = true;
             break;
+        case 'a':
+            incbinAsm = true;
+            break;
+        case 'b':
+            jobFile = optarg;
+            break;
+        case 'c':
+            cacheDir = optarg;
+            break;
         default:
             UsageAndExit(argv[0]);
             break;
         }
     }
 
-    if (optind + 2 != argc)
-        UsageAndExit(argv[0]);
+    if (jobFile != NULL)
+    {
+        if (isStdin || doEnum || optind + 1 != argc)
+            UsageAndExit(argv[0]);
+
+        charmap = argv[optind];
+    }
+    else
+    {
+        if (optind + 2 != argc)
+            UsageAndExit(argv[0]);
 
-    source = argv[optind + 0];
-    charmap = argv[optind + 1];
+        source = argv[optind + 0];
+        charmap = argv[optind + 1];
+    }
 
     g_charmap = new Charmap(charmap);
 
+    if (cacheDir != NULL)
+        g_incbinCache = new IncbinCache(cacheDir);
+
 #ifdef _WIN32
 	// On Windows, piping from stdout can break newlines. Treat stdout as binary stream to avoid this.
 	_setmode(_fileno(stdout), _O_BINARY);
 #endif
 
-    const char* extension = GetFileExtension(source);
-
-    if (!extension)
-        FATAL_ERROR("\"%s\" has no file extension.\n", argv[1]);
-
-    if ((extension[0] == 's') && extension[1] == 0)
-    {
-        PreprocAsmFile(source, isStdin, doEnum);
-    }
-    else if ((extension[0] == 'c' || extension[0] == 'i') && extension[1] == 0)
-    {
-        if (doEnum)
-            FATAL_ERROR("-e is invalid for C sources\n");
-        PreprocCFile(source, isStdin);
-    }
+    if (jobFile != NULL)
+        PreprocBatch(jobFile, incbinAsm);
     else
-    {
-        FATAL_ERROR("\"%s\" has an unknown file extension of \"%s\".\n", argv[1], extension);
-    }
+        PreprocFile(source, isStdin, doEnum, incbinAsm);
 
     return 0;
 }
@@ -3,215 +3,268 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "ramscrgen.h"
 #include "elf.h"
 
 #define SHN_COMMON 0xFFF2
 
-static std::string s_elfPath;
-static std::string s_archiveFilePath;
-static std::string s_archiveObjectPath;
+// A read-only view of a whole file. It is mmap'd where that's available and
+// read into memory otherwise; either way the ELF tables are read in place.
+class FileView
+{
+public:
+    explicit FileView(const std::string& path, const std::string& displayPath);
+    ~FileView();
+
+    const std::uint8_t *Data() const { return m_data; }
+    std::size_t Size() const { return m_size; }
+
+private:
+    const std::uint8_t *m_data = nullptr;
+    std::size_t m_size = 0;
+    bool m_mapped = false;
+    std::vector<std::uint8_t> m_buffer;
+};
 
-static FILE *s_file;
+FileView::FileView(const std::string& path, const std::string& displayPath)
+{
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
 
-static std::uint32_t s_sectionHeaderOffset;
-static int s_sectionHeaderEntrySize;
-static int s_sectionCount;
-static int s_shstrtabIndex;
+    if (fd < 0)
+        FATAL_ERROR("error: failed to open \"%s\" for reading\n", displayPath.c_str());
 
-static std::uint32_t s_symtabOffset;
-static std::uint32_t s_strtabOffset;
-static std::uint32_t s_pseudoCommonSectionIndex;
+    struct stat st;
 
-static std::uint32_t s_symbolCount;
-static std::uint32_t s_elfFileOffset;
+    if (fstat(fd, &st) != 0)
+        FATAL_ERROR("error: failed to stat \"%s\"\n", path.c_str());
 
-struct Symbol
-{
-    std::uint32_t nameOffset;
-    std::uint32_t size;
-};
+    m_size = st.st_size;
 
-static void Seek(long offset)
-{
-    if (std::fseek(s_file, s_elfFileOffset + offset, SEEK_SET) != 0)
-        FATAL_ERROR("error: failed to seek to %ld in \"%s\"", offset, s_elfPath.c_str());
+    if (m_size > 0)
+    {
+        void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+            FATAL_ERROR("error: failed to map \"%s\"\n", path.c_str());
+
+        m_data = static_cast<const std::uint8_t *>(data);
+        m_mapped = true;
+    }
+
+    close(fd);
+#else
+    FILE *file = std::fopen(path.c_str(), "rb");
+
+    if (file == NULL)
+        FATAL_ERROR("error: failed to open \"%s\" for reading\n", displayPath.c_str());
+
+    std::fseek(file, 0, SEEK_END);
+    m_buffer.resize(std::ftell(file));
+    std::fseek(file, 0, SEEK_SET);
+
+    if (!m_buffer.empty() && std::fread(m_buffer.data(), m_buffer.size(), 1, file) != 1)
+        FATAL_ERROR("error: failed to read \"%s\"\n", path.c_str());
+
+    std::fclose(file);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#endif
 }
 
-static void Skip(long offset)
+FileView::~FileView()
 {
-    if (std::fseek(s_file, offset, SEEK_CUR) != 0)
-        FATAL_ERROR("error: failed to skip %ld bytes in \"%s\"", offset, s_elfPath.c_str());
+#ifndef _WIN32
+    if (m_mapped)
+        munmap(const_cast<std::uint8_t *>(m_data), m_size);
+#endif
 }
 
-static std::uint32_t ReadInt8()
+// Reads the symbol table of one 32-bit little-endian ELF object straight out
+// of its FileView. Every access is bounds-checked against the file size.
+class ElfReader
 {
-    int c = std::fgetc(s_file);
-
-    if (c < 0)
-        FATAL_ERROR("error: unexpected EOF when reading ELF file \"%s\"\n", s_elfPath.c_str());
+public:
+    ElfReader(const std::string& path, const FileView& file)
+        : m_path(path), m_data(file.Data()), m_size(file.Size()) {}
+
+    CommonSymbolList GetCommonSymbols();
+
+private:
+    void Check(std::uint32_t offset, std::uint32_t length) const;
+    std::uint32_t ReadInt16(std::uint32_t offset) const;
+    std::uint32_t ReadInt32(std::uint32_t offset) const;
+    const char *ReadString(std::uint32_t offset) const;
+    std::uint32_t SectionHeader(int index) const;
+    void VerifyElfIdent() const;
+    void ReadElfHeader();
+    void FindTableOffsets();
+
+    std::string m_path;
+    const std::uint8_t *m_data;
+    std::size_t m_size;
+
+    std::uint32_t m_sectionHeaderOffset = 0;
+    int m_sectionHeaderEntrySize = 0;
+    int m_sectionCount = 0;
+    int m_shstrtabIndex = 0;
+
+    std::uint32_t m_symtabOffset = 0;
+    std::uint32_t m_strtabOffset = 0;
+    std::uint32_t m_pseudoCommonSectionIndex = 0;
+    std::uint32_t m_symbolCount = 0;
+};
 
-    return c;
+void ElfReader::Check(std::uint32_t offset, std::uint32_t length) const
+{
+    if (offset > m_size || length > m_size - offset)
+        FATAL_ERROR("error: unexpected EOF when reading ELF file \"%s\"\n", m_path.c_str());
 }
 
-static std::uint32_t ReadInt16()
+std::uint32_t ElfReader::ReadInt16(std::uint32_t offset) const
 {
-    std::uint32_t val = 0;
-    val |= ReadInt8();
-    val |= ReadInt8() << 8;
-    return val;
+    Check(offset, 2);
+    return m_data[offset] | (m_data[offset + 1] << 8);
 }
 
-static std::uint32_t ReadInt32()
+std::uint32_t ElfReader::ReadInt32(std::uint32_t offset) const
 {
-    std::uint32_t val = 0;
-    val |= ReadInt8();
-    val |= ReadInt8() << 8;
-    val |= ReadInt8() << 16;
-    val |= ReadInt8() << 24;
-    return val;
+    Check(offset, 4);
+    return m_data[offset]
+        | (m_data[offset + 1] << 8)
+        | (m_data[offset + 2] << 16)
+        | ((std::uint32_t)m_data[offset + 3] << 24);
 }
 
-static std::string ReadString()
+// Returns a pointer into the file; the string must be terminated inside it.
+const char *ElfReader::ReadString(std::uint32_t offset) const
 {
-    std::string s;
-    char c;
+    Check(offset, 1);
+
+    const void *end = std::memchr(m_data + offset, 0, m_size - offset);
 
-    while ((c = ReadInt8()) != 0)
-        s += c;
+    if (end == nullptr)
+        FATAL_ERROR("error: unexpected EOF when reading ELF file \"%s\"\n", m_path.c_str());
 
-    return s;
+    return reinterpret_cast<const char *>(m_data + offset);
 }
 
-static void VerifyElfIdent()
+std::uint32_t ElfReader::SectionHeader(int index) const
 {
-    char expectedMagic[4] = { 0x7F, 'E', 'L', 'F' };
-    char magic[4];
+    return m_sectionHeaderOffset + m_sectionHeaderEntrySize * index;
+}
 
-    if (std::fread(magic, 4, 1, s_file) != 1)
-        FATAL_ERROR("error: failed to read ELF magic from \"%s\"\n", s_elfPath.c_str());
+void ElfReader::VerifyElfIdent() const
+{
+    const std::uint8_t expectedMagic[4] = { 0x7F, 'E', 'L', 'F' };
 
-    if (std::memcmp(magic, expectedMagic, 4) != 0)
-        FATAL_ERROR("error: ELF magic did not match in \"%s\"\n", s_elfPath.c_str());
+    if (m_size < 4)
+        FATAL_ERROR("error: failed to read ELF magic from \"%s\"\n", m_path.c_str());
 
-    if (std::fgetc(s_file) != 1)
-        FATAL_ERROR("error: \"%s\" not 32-bit ELF\n", s_elfPath.c_str());
+    if (std::memcmp(m_data, expectedMagic, 4) != 0)
+        FATAL_ERROR("error: ELF magic did not match in \"%s\"\n", m_path.c_str());
 
-    if (std::fgetc(s_file) != 1)
-        FATAL_ERROR("error: \"%s\" not little-endian ELF\n", s_elfPath.c_str());
-}
+    if (m_size < 5 || m_data[4] != 1)
+        FATAL_ERROR("error: \"%s\" not 32-bit ELF\n", m_path.c_str());
 
-static void ReadElfHeader()
-{
-    Seek(0x20);
-    s_sectionHeaderOffset = ReadInt32();
-    Seek(0x2E);
-    s_sectionHeaderEntrySize = ReadInt16();
-    s_sectionCount = ReadInt16();
-    s_shstrtabIndex = ReadInt16();
+    if (m_size < 6 || m_data[5] != 1)
+        FATAL_ERROR("error: \"%s\" not little-endian ELF\n", m_path.c_str());
 }
 
-static std::string GetSectionName(std::uint32_t shstrtabOffset, int index)
+void ElfReader::ReadElfHeader()
 {
-    Seek(s_sectionHeaderOffset + s_sectionHeaderEntrySize * index);
-    std::uint32_t nameOffset = ReadInt32();
-    Seek(shstrtabOffset + nameOffset);
-    return ReadString();
+    m_sectionHeaderOffset = ReadInt32(0x20);
+    m_sectionHeaderEntrySize = ReadInt16(0x2E);
+    m_sectionCount = ReadInt16(0x30);
+    m_shstrtabIndex = ReadInt16(0x32);
 }
 
-static void FindTableOffsets()
+void ElfReader::FindTableOffsets()
 {
-    s_symtabOffset = 0;
-    s_strtabOffset = 0;
-    s_pseudoCommonSectionIndex = 0;
+    std::uint32_t shstrtabOffset = ReadInt32(SectionHeader(m_shstrtabIndex) + 0x10);
 
-    Seek(s_sectionHeaderOffset + s_sectionHeaderEntrySize * s_shstrtabIndex + 0x10);
-    std::uint32_t shstrtabOffset = ReadInt32();
-
-    for (int i = 0; i < s_sectionCount; i++)
+    for (int i = 0; i < m_sectionCount; i++)
     {
-        std::string name = GetSectionName(shstrtabOffset, i);
+        const char *name = ReadString(shstrtabOffset + ReadInt32(SectionHeader(i)));
 
-        if (name == ".symtab")
+        if (std::strcmp(name, ".symtab") == 0)
         {
-            if (s_symtabOffset)
-                FATAL_ERROR("error: mutiple .symtab sections found in \"%s\"\n", s_elfPath.c_str());
-            Seek(s_sectionHeaderOffset + s_sectionHeaderEntrySize * i + 0x10);
-            s_symtabOffset = ReadInt32();
-            std::uint32_t size = ReadInt32();
-            s_symbolCount = size / 16;
+            if (m_symtabOffset)
+                FATAL_ERROR("error: mutiple .symtab sections found in \"%s\"\n", m_path.c_str());
+            m_symtabOffset = ReadInt32(SectionHeader(i) + 0x10);
+            m_symbolCount = ReadInt32(SectionHeader(i) + 0x14) / 16;
         }
-        else if (name == ".strtab")
+        else if (std::strcmp(name, ".strtab") == 0)
         {
-            if (s_strtabOffset)
-                FATAL_ERROR("error: mutiple .strtab sections found in \"%s\"\n", s_elfPath.c_str());
-            Seek(s_sectionHeaderOffset + s_sectionHeaderEntrySize * i + 0x10);
-            s_strtabOffset = ReadInt32();
-        } else if (name == "common_data") {
-            if (s_pseudoCommonSectionIndex) {
-                FATAL_ERROR("error: mutiple common_data sections found in \"%s\"\n", s_elfPath.c_str());
+            if (m_strtabOffset)
+                FATAL_ERROR("error: mutiple .strtab sections found in \"%s\"\n", m_path.c_str());
+            m_strtabOffset = ReadInt32(SectionHeader(i) + 0x10);
+        } else if (std::strcmp(name, "common_data") == 0) {
+            if (m_pseudoCommonSectionIndex) {
+                FATAL_ERROR("error: mutiple common_data sections found in \"%s\"\n", m_path.c_str());
             }
-            s_pseudoCommonSectionIndex = i;
+            m_pseudoCommonSectionIndex = i;
         }
     }
 
-    if (!s_symtabOffset)
-        FATAL_ERROR("error: couldn't find .symtab section in \"%s\"\n", s_elfPath.c_str());
+    if (!m_symtabOffset)
+        FATAL_ERROR("error: couldn't find .symtab section in \"%s\"\n", m_path.c_str());
 
-    if (!s_strtabOffset)
-        FATAL_ERROR("error: couldn't find .strtab section in \"%s\"\n", s_elfPath.c_str());
+    if (!m_strtabOffset)
+        FATAL_ERROR("error: couldn't find .strtab section in \"%s\"\n", m_path.c_str());
 }
 
-static std::vector<std::pair<std::string, std::uint32_t>> GetCommonSymbols_Shared()
+CommonSymbolList ElfReader::GetCommonSymbols()
 {
     VerifyElfIdent();
     ReadElfHeader();
     FindTableOffsets();
 
-    std::vector<std::pair<std::string, std::uint32_t>> commonSymbols;
+    CommonSymbolList commonSymbols;
 
-    if (s_pseudoCommonSectionIndex) {
-        std::vector<Symbol> commonSymbolVec;
-    
-        Seek(s_symtabOffset);
-    
-        for (std::uint32_t i = 0; i < s_symbolCount; i++)
-        {
-            Symbol sym;
-            sym.nameOffset = ReadInt32();
-            Skip(4);
-            sym.size = ReadInt32();
-            Skip(2);
-            std::uint16_t sectionIndex = ReadInt16();
-            if (sectionIndex == s_pseudoCommonSectionIndex)
-                commonSymbolVec.push_back(sym);
-        }
-    
-        for (const Symbol& sym : commonSymbolVec)
+    if (m_pseudoCommonSectionIndex) {
+        for (std::uint32_t i = 0; i < m_symbolCount; i++)
         {
-            Seek(s_strtabOffset + sym.nameOffset);
-            std::string name = ReadString();
-            if (name == "$d" || name == "") {
+            std::uint32_t entry = m_symtabOffset + 16 * i;
+
+            if (ReadInt16(entry + 14) != m_pseudoCommonSectionIndex)
+                continue;
+
+            const char *name = ReadString(m_strtabOffset + ReadInt32(entry));
+            if (std::strcmp(name, "$d") == 0 || name[0] == 0) {
                 continue;
             }
-            commonSymbols.emplace_back(name, sym.size);
+            commonSymbols.emplace_back(name, ReadInt32(entry + 8));
         }
     }
 
     return commonSymbols;
 }
 
-std::vector<std::pair<std::string, std::uint32_t>> GetCommonSymbols(std::string sourcePath, std::string path)
+CommonSymbolList GetCommonSymbols(std::string sourcePath, std::string path)
 {
-    s_elfFileOffset = 0;
     if (path[0] == '*')
         FATAL_ERROR("error: library common syms are unsupported (filename: \"%s\")\n", path.c_str());
 
-    s_elfPath = sourcePath + "/" + path;
-    s_file = std::fopen(s_elfPath.c_str(), "rb");
+    std::string elfPath = sourcePath + "/" + path;
+    FileView file(elfPath, path);
+
+    return ElfReader(elfPath, file).GetCommonSymbols();
+}
+
+const CommonSymbolList& SymbolIndex::GetCommonSymbols(const std::string& sourcePath, const std::string& path)
+{
+    std::string key = sourcePath + "/" + path;
+    auto it = m_objects.find(key);
 
-    if (s_file == NULL)
-        FATAL_ERROR("error: failed to open \"%s\" for reading\n", path.c_str());
+    if (it == m_objects.end())
+        it = m_objects.emplace(key, ::GetCommonSymbols(sourcePath, path)).first;
 
-    return GetCommonSymbols_Shared();
+    return it->second;
 }
@@ -22,9 +22,24 @@
 #define ELF_H
 
 #include <cstdint>
+#include <map>
 #include <vector>
 #include <string>
 
-std::vector<std::pair<std::string, std::uint32_t>> GetCommonSymbols(std::string sourcePath, std::string path);
+typedef std::vector<std::pair<std::string, std::uint32_t>> CommonSymbolList;
+
+CommonSymbolList GetCommonSymbols(std::string sourcePath, std::string path);
+
+// Remembers the common symbols of every object file read during one
+// invocation, so each .o is mapped and parsed once no matter how many
+// sections include it.
+class SymbolIndex
+{
+public:
+    const CommonSymbolList& GetCommonSymbols(const std::string& sourcePath, const std::string& path);
+
+private:
+    std::map<std::string, CommonSymbolList> m_objects;
+};
 
 #endif // ELF_H
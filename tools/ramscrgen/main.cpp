@@ -19,15 +19,58 @@
 // THE SOFTWARE.
 
 #include <cstdio>
+#include <cstdarg>
 #include <cstring>
 #include <string>
+#include <vector>
 #include "ramscrgen.h"
 #include "sym_file.h"
 #include "elf.h"
 
-void HandleCommonInclude(std::string filename, std::string sourcePath, std::string symOrderPath, std::string lang)
+struct CommonPaths
 {
-    auto commonSymbols = GetCommonSymbols(sourcePath, filename);
+    std::string sourcePath;
+    std::string commonSymPath;
+    std::string libSourcePath;
+};
+
+struct LinkerScriptJob
+{
+    std::string sectionName;
+    std::string symFileName;
+    std::string outputFileName;
+    bool common;
+    CommonPaths paths;
+};
+
+static void Printf(std::string& out, const char *format, ...)
+{
+    char buffer[1024];
+    std::va_list args;
+    va_start(args, format);
+    int length = std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length < 0)
+        FATAL_ERROR("error: failed to format output\n");
+
+    if ((std::size_t)length < sizeof(buffer))
+    {
+        out.append(buffer, length);
+    }
+    else
+    {
+        std::vector<char> bigBuffer(length + 1);
+        va_start(args, format);
+        std::vsnprintf(bigBuffer.data(), bigBuffer.size(), format, args);
+        va_end(args);
+        out.append(bigBuffer.data(), length);
+    }
+}
+
+void HandleCommonInclude(std::string& out, SymbolIndex& symbolIndex, std::string filename, std::string sourcePath, std::string symOrderPath, std::string lang)
+{
+    const auto& commonSymbols = symbolIndex.GetCommonSymbols(sourcePath, filename);
 
     for (const auto& commonSym : commonSymbols)
     {
@@ -38,15 +81,16 @@ void HandleCommonInclude(std::string filename, std::string sourcePath, std::stri
             alignment = 8;
         if (size > 8)
             alignment = 16;
-        printf(". = ALIGN(%d);\n", alignment);
-        printf("%s = .;\n", commonSym.first.c_str());
-        printf(". += 0x%lX;\n", size);
+        Printf(out, ". = ALIGN(%d);\n", alignment);
+        Printf(out, "%s = .;\n", commonSym.first.c_str());
+        Printf(out, ". += 0x%lX;\n", size);
     }
 }
 
-void ConvertSymFile(std::string filename, std::string sectionName, std::string lang, bool common, std::string sourcePath, std::string commonSymPath, std::string libSourcePath)
+std::string ConvertSymFile(SymbolIndex& symbolIndex, std::string filename, std::string sectionName, std::string lang, bool common, const CommonPaths& paths)
 {
     SymFile symFile(filename);
+    std::string out;
 
     while (!symFile.IsAtEnd())
     {
@@ -60,11 +104,11 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
         {
             std::string incFilename = symFile.ReadPath();
             symFile.ExpectEmptyRestOfLine();
-            printf(". = ALIGN(4);\n");
+            Printf(out, ". = ALIGN(4);\n");
             if (common)
-                HandleCommonInclude(incFilename, incFilename[0] == '*' ? libSourcePath : sourcePath, commonSymPath, lang);
+                HandleCommonInclude(out, symbolIndex, incFilename, incFilename[0] == '*' ? paths.libSourcePath : paths.sourcePath, paths.commonSymPath, lang);
             else
-                printf("%s(%s);\n", incFilename.c_str(), sectionName.c_str());
+                Printf(out, "%s(%s);\n", incFilename.c_str(), sectionName.c_str());
             break;
         }
         case Directive::Space:
@@ -73,7 +117,7 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
             if (!symFile.ReadInteger(length))
                 symFile.RaiseError("expected integer after .space directive");
             symFile.ExpectEmptyRestOfLine();
-            printf(". += 0x%lX;\n", length);
+            Printf(out, ". += 0x%lX;\n", length);
             break;
         }
         case Directive::Align:
@@ -85,7 +129,7 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
                 symFile.RaiseError("max alignment amount is 4");
             amount = 1UL << amount;
             symFile.ExpectEmptyRestOfLine();
-            printf(". = ALIGN(%lu);\n", amount);
+            Printf(out, ". = ALIGN(%lu);\n", amount);
             break;
         }
         case Directive::Unknown:
@@ -94,7 +138,7 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
 
             if (label.length() != 0)
             {
-                printf("%s = .;\n", label.c_str());
+                Printf(out, "%s = .;\n", label.c_str());
             }
 
             symFile.ExpectEmptyRestOfLine();
@@ -103,13 +147,116 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
         }
         }
     }
+
+    return out;
+}
+
+CommonPaths ParseCommonPaths(const char *arg)
+{
+    CommonPaths paths;
+    std::string pathList = std::string(arg);
+    std::size_t commaPos = pathList.find(',');
+
+    if (commaPos == std::string::npos)
+        FATAL_ERROR("error: missing comma in argument after \"-c\"\n");
+
+    paths.sourcePath = pathList.substr(0, commaPos);
+    paths.commonSymPath = pathList.substr(commaPos + 1);
+    commaPos = paths.commonSymPath.find(',');
+    if (commaPos == std::string::npos) {
+        paths.libSourcePath = "tools/agbcc/lib";
+    } else {
+        paths.libSourcePath = paths.commonSymPath.substr(commaPos + 1);
+        paths.commonSymPath = paths.commonSymPath.substr(0, commaPos);
+    }
+
+    return paths;
+}
+
+// Writes the file unless it already holds exactly these contents, so the
+// linker scripts keep their timestamps when nothing in them changed.
+void WriteFileIfChanged(const std::string& filename, const std::string& contents)
+{
+    FILE *fp = std::fopen(filename.c_str(), "rb");
+
+    if (fp != NULL)
+    {
+        std::string existing;
+        char buffer[4096];
+        std::size_t count;
+
+        while ((count = std::fread(buffer, 1, sizeof(buffer), fp)) > 0)
+            existing.append(buffer, count);
+
+        std::fclose(fp);
+
+        if (existing == contents)
+            return;
+    }
+
+    fp = std::fopen(filename.c_str(), "wb");
+
+    if (fp == NULL)
+        FATAL_ERROR("error: failed to open \"%s\" for writing\n", filename.c_str());
+
+    if (!contents.empty() && std::fwrite(contents.data(), contents.size(), 1, fp) != 1)
+        FATAL_ERROR("error: failed to write \"%s\"\n", filename.c_str());
+
+    std::fclose(fp);
+}
+
+// ramscrgen --batch LANG [-c PATHS] SECTION_NAME SYM_FILE OUTPUT ...
+// A "-c" applies to the job that follows it. All jobs share one symbol index,
+// so every object file is read once per invocation.
+int RunBatch(int argc, char **argv)
+{
+    if (argc < 3)
+        FATAL_ERROR("error: missing LANG after \"--batch\"\n");
+
+    std::string lang = std::string(argv[2]);
+    std::vector<LinkerScriptJob> jobs;
+
+    for (int i = 3; i < argc;)
+    {
+        LinkerScriptJob job;
+        job.common = false;
+
+        if (std::strcmp(argv[i], "-c") == 0)
+        {
+            if (i + 1 >= argc)
+                FATAL_ERROR("error: missing SRC_PATH,COMMON_SYM_PATH after \"-c\"\n");
+            job.common = true;
+            job.paths = ParseCommonPaths(argv[i + 1]);
+            i += 2;
+        }
+
+        if (i + 3 > argc)
+            FATAL_ERROR("error: expected SECTION_NAME SYM_FILE OUTPUT in batch job %d\n", (int)jobs.size() + 1);
+
+        job.sectionName = argv[i];
+        job.symFileName = argv[i + 1];
+        job.outputFileName = argv[i + 2];
+        jobs.push_back(job);
+        i += 3;
+    }
+
+    SymbolIndex symbolIndex;
+
+    for (const LinkerScriptJob& job : jobs)
+        WriteFileIfChanged(job.outputFileName, ConvertSymFile(symbolIndex, job.symFileName, job.sectionName, lang, job.common, job.paths));
+
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
+    if (argc > 1 && std::strcmp(argv[1], "--batch") == 0)
+        return RunBatch(argc, argv);
+
     if (argc < 4)
     {
-        fprintf(stderr, "Usage: %s SECTION_NAME SYM_FILE LANG [-c SRC_PATH,COMMON_SYM_PATH]", argv[0]);
+        fprintf(stderr, "Usage: %s SECTION_NAME SYM_FILE LANG [-c SRC_PATH,COMMON_SYM_PATH]\n"
+                        "       %s --batch LANG [-c SRC_PATH,COMMON_SYM_PATH] SECTION_NAME SYM_FILE OUTPUT ...", argv[0], argv[0]);
         return 1;
     }
 
@@ -117,9 +264,7 @@ int main(int argc, char **argv)
     std::string sectionName = std::string(argv[1]);
     std::string symFileName = std::string(argv[2]);
     std::string lang = std::string(argv[3]);
-    std::string sourcePath;
-    std::string commonSymPath;
-    std::string libSourcePath;
+    CommonPaths paths;
 
     if (argc > 4)
     {
@@ -130,23 +275,11 @@ int main(int argc, char **argv)
             FATAL_ERROR("error: missing SRC_PATH,COMMON_SYM_PATH after \"-c\"\n");
 
         common = true;
-        std::string paths = std::string(argv[5]);
-        std::size_t commaPos = paths.find(',');
-
-        if (commaPos == std::string::npos)
-            FATAL_ERROR("error: missing comma in argument after \"-c\"\n");
-
-        sourcePath = paths.substr(0, commaPos);
-        commonSymPath = paths.substr(commaPos + 1);
-        commaPos = commonSymPath.find(',');
-        if (commaPos == std::string::npos) {
-            libSourcePath = "tools/agbcc/lib";
-        } else {
-            libSourcePath = commonSymPath.substr(commaPos + 1);
-            commonSymPath = commonSymPath.substr(0, commaPos);
-        }
+        paths = ParseCommonPaths(argv[5]);
     }
 
-    ConvertSymFile(symFileName, sectionName, lang, common, sourcePath, commonSymPath, libSourcePath);
+    SymbolIndex symbolIndex;
+    std::string out = ConvertSymFile(symbolIndex, symFileName, sectionName, lang, common, paths);
+    std::fwrite(out.data(), 1, out.size(), stdout);
     return 0;
 }
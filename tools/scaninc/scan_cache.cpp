@@ -0,0 +1,174 @@
+// Copyright(c) 2015-2017 YamaArashi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sys/stat.h>
+#include "scan_cache.h"
+
+#define CACHE_MAGIC "scaninc-cache 1"
+
+// Returns false if the file can't be stat'd. The mtime keeps sub-second
+// precision where the platform exposes it, since generated headers are
+// frequently rewritten several times within the same second.
+static bool GetFileStamp(const std::string& path, long long& mtime, long long& size)
+{
+    struct stat st;
+
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+#if defined(__APPLE__)
+    mtime = (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    mtime = (long long)st.st_mtime * 1000000000LL;
+#endif
+    size = st.st_size;
+    return true;
+}
+
+void ScanCache::Load(const std::string& path)
+{
+    std::ifstream input(path);
+
+    if (!input.is_open())
+        return;
+
+    std::string line;
+
+    // A cache from another version is silently discarded and rebuilt.
+    if (!std::getline(input, line) || line != CACHE_MAGIC)
+        return;
+
+    ScanEntry *entry = nullptr;
+
+    while (std::getline(input, line))
+    {
+        if (line.size() < 2 || line[1] != '\t')
+            break;
+
+        std::string rest = line.substr(2);
+
+        if (line[0] == 'F')
+        {
+            long long mtime, size;
+            int type, consumed;
+
+            if (std::sscanf(rest.c_str(), "%lld\t%lld\t%d\t%n", &mtime, &size, &type, &consumed) != 3)
+                break;
+
+            entry = &m_entries[rest.substr(consumed)];
+            entry->mtime = mtime;
+            entry->size = size;
+            entry->fileType = static_cast<SourceFileType>(type);
+            entry->incbins.clear();
+            entry->includes.clear();
+        }
+        else if (entry != nullptr && line[0] == 'B')
+        {
+            entry->incbins.insert(rest);
+        }
+        else if (entry != nullptr && line[0] == 'I')
+        {
+            entry->includes.insert(rest);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+void ScanCache::Save(const std::string& path)
+{
+    if (!m_dirty)
+        return;
+
+    // Write to a temporary file and rename it over the cache, so that a
+    // concurrent scaninc never reads a half-written cache.
+    std::string tmpPath = path + ".tmp";
+    std::ofstream output(tmpPath);
+
+    if (!output.is_open())
+        FATAL_ERROR("Failed to open \"%s\" for writing.\n", tmpPath.c_str());
+
+    output << CACHE_MAGIC << '\n';
+
+    for (const auto& it : m_entries)
+    {
+        const ScanEntry& entry = it.second;
+
+        output << "F\t" << entry.mtime << '\t' << entry.size << '\t'
+               << static_cast<int>(entry.fileType) << '\t' << it.first << '\n';
+        for (const std::string& incbin : entry.incbins)
+            output << "B\t" << incbin << '\n';
+        for (const std::string& include : entry.includes)
+            output << "I\t" << include << '\n';
+    }
+
+    output.close();
+
+    if (output.fail() || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+        FATAL_ERROR("Failed to write \"%s\".\n", path.c_str());
+
+    m_dirty = false;
+}
+
+const ScanEntry& ScanCache::Get(const std::string& path)
+{
+    long long mtime = -1, size = -1;
+    bool hasStamp = GetFileStamp(path, mtime, size);
+    auto it = m_entries.find(path);
+
+    if (hasStamp && it != m_entries.end() && it->second.mtime == mtime && it->second.size == size)
+        return it->second;
+
+    // SourceFile reports missing/unreadable files itself.
+    SourceFile file(path);
+    ScanEntry& entry = m_entries[path];
+
+    entry.mtime = mtime;
+    entry.size = size;
+    entry.fileType = file.FileType();
+    entry.incbins = file.GetIncbins();
+    entry.includes = file.GetIncludes();
+    m_dirty = true;
+    return entry;
+}
+
+bool ScanCache::CanOpenFile(const std::string& path)
+{
+    auto it = m_probes.find(path);
+
+    if (it != m_probes.end())
+        return it->second;
+
+    FILE *fp = std::fopen(path.c_str(), "rb");
+    bool exists = fp != NULL;
+
+    if (fp != NULL)
+        std::fclose(fp);
+
+    m_probes[path] = exists;
+    return exists;
+}
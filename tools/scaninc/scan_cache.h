@@ -0,0 +1,56 @@
+// Copyright(c) 2015-2017 YamaArashi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef SCAN_CACHE_H
+#define SCAN_CACHE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include "source_file.h"
+
+// Parsed include/incbin lists of a single source file, tagged with the
+// mtime and size the file had when it was parsed.
+struct ScanEntry
+{
+    long long mtime;
+    long long size;
+    SourceFileType fileType;
+    std::set<std::string> incbins;
+    std::set<std::string> includes;
+};
+
+// Memoizes SourceFile parses (optionally persisted to disk between runs)
+// and include path probes (per process only).
+class ScanCache
+{
+public:
+    void Load(const std::string& path);
+    void Save(const std::string& path);
+    const ScanEntry& Get(const std::string& path);
+    bool CanOpenFile(const std::string& path);
+
+private:
+    std::map<std::string, ScanEntry> m_entries;
+    std::map<std::string, bool> m_probes;
+    bool m_dirty = false;
+};
+
+#endif // SCAN_CACHE_H
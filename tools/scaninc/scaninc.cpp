@@ -29,35 +29,157 @@
 #include <fstream>
 #include "scaninc.h"
 #include "source_file.h"
+#include "scan_cache.h"
 
-bool CanOpenFile(std::string path)
+const char *const USAGE =
+    "Usage: scaninc [-I INCLUDE_PATH] [-C CACHE_PATH] [-M DEPENDENCY_OUT_PATH] FILE_PATH\n"
+    "       scaninc [-I INCLUDE_PATH] [-C CACHE_PATH] -B JOB_LIST_PATH\n"
+    "\n"
+    "  -B  Scan many files in one process. Each line of JOB_LIST_PATH (\"-\" for\n"
+    "      stdin) is \"DEPENDENCY_OUT_PATH FILE_PATH\"; a make rule file is written\n"
+    "      for each job as with -M.\n"
+    "  -C  Keep parsed include/incbin lists in CACHE_PATH between runs. Entries\n"
+    "      are reused while the file's mtime and size are unchanged.\n";
+
+struct Dependencies
+{
+    std::set<std::string> all;
+    std::set<std::string> includes;
+};
+
+static void ScanFile(const std::string& initialPath, std::vector<std::string> includeDirs, ScanCache& cache, Dependencies& deps)
 {
-    FILE *fp = std::fopen(path.c_str(), "rb");
+    std::queue<std::string> filesToProcess;
 
-    if (fp == NULL)
-        return false;
+    filesToProcess.push(initialPath);
+
+    while (!filesToProcess.empty())
+    {
+        std::string filePath = filesToProcess.front();
+        const ScanEntry& file = cache.Get(filePath);
+        filesToProcess.pop();
+
+        includeDirs.push_back(GetDir(filePath));
+        for (auto incbin : file.incbins)
+        {
+            deps.all.insert(incbin);
+        }
+        for (auto include : file.includes)
+        {
+            bool exists = false;
+            std::string path("");
+            for (auto includeDir : includeDirs)
+            {
+                path = includeDir + include;
+                if (cache.CanOpenFile(path))
+                {
+                    exists = true;
+                    break;
+                }
+            }
+            if (!exists && (file.fileType == SourceFileType::Asm || file.fileType == SourceFileType::Inc))
+            {
+                path = include;
+                if (cache.CanOpenFile(path))
+                    exists = true;
+            }
+            if (!exists)
+                continue;
 
-    std::fclose(fp);
-    return true;
+            deps.includes.insert(path);
+            bool inserted = deps.all.insert(path).second;
+            if (inserted && exists)
+            {
+                filesToProcess.push(path);
+            }
+        }
+        includeDirs.pop_back();
+    }
 }
 
-const char *const USAGE = "Usage: scaninc [-I INCLUDE_PATH] [-M DEPENDENCY_OUT_PATH] FILE_PATH\n";
+static void WriteMakeRules(const std::string& make_outfile, const Dependencies& deps)
+{
+    // Write out make rules to a file
+    std::ofstream output(make_outfile);
 
-int main(int argc, char **argv)
+    if (!output.is_open())
+        FATAL_ERROR("Failed to open \"%s\" for writing.\n", make_outfile.c_str());
+
+    // Print a make rule for the object file
+    size_t ext_pos = make_outfile.find_last_of(".");
+    auto object_file = make_outfile.substr(0, ext_pos + 1) + "o";
+    output << object_file.c_str() << ":";
+    for (const std::string &path : deps.all)
+    {
+        output << " " << path;
+    }
+    output << '\n';
+
+    // Dependency list rule.
+    // Although these rules are identical, they need to be separate, else make will trigger the rule again after the file is created for the first time.
+    output << make_outfile.c_str() << ":";
+    for (const std::string &path : deps.includes)
+    {
+        output << " " << path;
+    }
+    output << '\n';
+
+    // Dummy rules
+    // If a dependency is deleted, make will try to make it, instead of rescanning the dependencies before trying to do that.
+    for (const std::string &path : deps.all)
+    {
+        output << path << ":\n";
+    }
+
+    output.flush();
+    output.close();
+}
+
+static void RunBatch(const std::string& jobListPath, const std::vector<std::string>& includeDirs, ScanCache& cache)
 {
-    std::queue<std::string> filesToProcess;
-    std::set<std::string> dependencies;
-    std::set<std::string> dependencies_includes;
+    std::ifstream jobFile;
+    std::istream *jobs = &std::cin;
+
+    if (jobListPath != "-")
+    {
+        jobFile.open(jobListPath);
+        if (!jobFile.is_open())
+            FATAL_ERROR("Failed to open \"%s\" for reading.\n", jobListPath.c_str());
+        jobs = &jobFile;
+    }
+
+    std::string line;
+
+    while (std::getline(*jobs, line))
+    {
+        if (line.empty())
+            continue;
+
+        std::size_t space = line.find(' ');
 
+        if (space == std::string::npos)
+            FATAL_ERROR("Malformed job \"%s\" in \"%s\".\n", line.c_str(), jobListPath.c_str());
+
+        Dependencies deps;
+
+        ScanFile(line.substr(space + 1), includeDirs, cache, deps);
+        WriteMakeRules(line.substr(0, space), deps);
+    }
+}
+
+int main(int argc, char **argv)
+{
     std::vector<std::string> includeDirs;
 
     bool makeformat = false;
     std::string make_outfile;
+    std::string cache_path;
+    std::string job_list;
 
     argc--;
     argv++;
 
-    while (argc > 1)
+    while (argc > 0 && argv[0][0] == '-')
     {
         std::string arg(argv[0]);
         if (arg.substr(0, 2) == "-I")
@@ -67,6 +189,8 @@ int main(int argc, char **argv)
             {
                 argc--;
                 argv++;
+                if (argc == 0)
+                    FATAL_ERROR(USAGE);
                 includeDir = std::string(argv[0]);
             }
             if (!includeDir.empty() && includeDir.back() != '/')
@@ -75,12 +199,25 @@ int main(int argc, char **argv)
             }
             includeDirs.push_back(includeDir);
         }
-        else if(arg.substr(0, 2) == "-M")
+        else if (arg == "-M" || arg == "-C" || arg == "-B")
         {
-            makeformat = true;
             argc--;
             argv++;
-            make_outfile = std::string(argv[0]);
+            if (argc == 0)
+                FATAL_ERROR(USAGE);
+            if (arg == "-M")
+            {
+                makeformat = true;
+                make_outfile = std::string(argv[0]);
+            }
+            else if (arg == "-C")
+            {
+                cache_path = std::string(argv[0]);
+            }
+            else
+            {
+                job_list = std::string(argv[0]);
+            }
         }
         else
         {
@@ -90,97 +227,39 @@ int main(int argc, char **argv)
         argv++;
     }
 
-    if (argc != 1) {
+    if (job_list.empty() ? argc != 1 : (argc != 0 || makeformat)) {
         FATAL_ERROR(USAGE);
     }
 
-    std::string initialPath(argv[0]);
-
-    filesToProcess.push(initialPath);
-
-    while (!filesToProcess.empty())
-    {
-        std::string filePath = filesToProcess.front();
-        SourceFile file(filePath);
-        filesToProcess.pop();
-
-        includeDirs.push_back(file.GetSrcDir());
-        for (auto incbin : file.GetIncbins())
-        {
-            dependencies.insert(incbin);
-        }
-        for (auto include : file.GetIncludes())
-        {
-            bool exists = false;
-            std::string path("");
-            for (auto includeDir : includeDirs)
-            {
-                path = includeDir + include;
-                if (CanOpenFile(path))
-                {
-                    exists = true;
-                    break;
-                }
-            }
-            if (!exists && (file.FileType() == SourceFileType::Asm || file.FileType() == SourceFileType::Inc))
-            {
-                path = include;
-                if (CanOpenFile(path))
-                    exists = true;
-            }
-            if (!exists)
-                continue;
+    ScanCache cache;
 
-            dependencies_includes.insert(path);
-            bool inserted = dependencies.insert(path).second;
-            if (inserted && exists)
-            {
-                filesToProcess.push(path);
-            }
-        }
-        includeDirs.pop_back();
-    }
+    if (!cache_path.empty())
+        cache.Load(cache_path);
 
-    if(!makeformat)
+    if (!job_list.empty())
     {
-        for (const std::string &path : dependencies)
-        {
-            std::printf("%s\n", path.c_str());
-        }
-        std::cout << std::endl;
+        RunBatch(job_list, includeDirs, cache);
     }
     else
     {
-        // Write out make rules to a file
-        std::ofstream output(make_outfile);
-
-        // Print a make rule for the object file
-        size_t ext_pos = make_outfile.find_last_of(".");
-        auto object_file = make_outfile.substr(0, ext_pos + 1) + "o";
-        output << object_file.c_str() << ":";
-        for (const std::string &path : dependencies)
-        {
-            output << " " << path;
-        }
-        output << '\n';
+        Dependencies deps;
 
-        // Dependency list rule.
-        // Although these rules are identical, they need to be separate, else make will trigger the rule again after the file is created for the first time.
-        output << make_outfile.c_str() << ":";
-        for (const std::string &path : dependencies_includes)
+        ScanFile(std::string(argv[0]), includeDirs, cache, deps);
+
+        if(!makeformat)
         {
-            output << " " << path;
+            for (const std::string &path : deps.all)
+            {
+                std::printf("%s\n", path.c_str());
+            }
+            std::cout << std::endl;
         }
-        output << '\n';
-
-        // Dummy rules
-        // If a dependency is deleted, make will try to make it, instead of rescanning the dependencies before trying to do that.
-        for (const std::string &path : dependencies)
+        else
         {
-            output << path << ":\n";
+            WriteMakeRules(make_outfile, deps);
         }
-
-        output.flush();
-        output.close();
     }
+
+    if (!cache_path.empty())
+        cache.Save(cache_path);
 }